@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <limits.h>
+#include <signal.h>
 
 #define ZT_SELF_TEST_BUILD
 #include "zt.c"
@@ -316,6 +317,12 @@ static void test_find_binary_relation(void)
     assert(zt_find_binary_relation("<") == ZT_REL_LT);
     assert(zt_find_binary_relation(">") == ZT_REL_GT);
     assert(zt_find_binary_relation("potato") == ZT_REL_INVALID);
+    assert(zt_find_binary_relation("") == ZT_REL_INVALID);
+    assert(zt_find_binary_relation("=") == ZT_REL_INVALID);
+    assert(zt_find_binary_relation("!") == ZT_REL_INVALID);
+    assert(zt_find_binary_relation("===") == ZT_REL_INVALID);
+    assert(zt_find_binary_relation("<<") == ZT_REL_INVALID);
+    assert(zt_find_binary_relation(">=>") == ZT_REL_INVALID);
 }
 
 static void test_invert_binary_relation(void)
@@ -343,6 +350,73 @@ static void test_binary_relation_as_text(void)
     assert(strcmp(zt_binary_relation_as_text(1000), "invalid") == 0);
 }
 
+static void test_relation_code_holds(void)
+{
+    assert(zt_relation_code_holds(ZT_RELATION(==), 0));
+    assert(!zt_relation_code_holds(ZT_RELATION(==), 1));
+    assert(zt_relation_code_holds(ZT_RELATION(!=), -1));
+    assert(!zt_relation_code_holds(ZT_RELATION(!=), 0));
+    assert(zt_relation_code_holds(ZT_RELATION(<=), 0));
+    assert(!zt_relation_code_holds(ZT_RELATION(<=), 1));
+    assert(zt_relation_code_holds(ZT_RELATION(>=), 0));
+    assert(!zt_relation_code_holds(ZT_RELATION(>=), -1));
+    assert(zt_relation_code_holds(ZT_RELATION(<), -1));
+    assert(!zt_relation_code_holds(ZT_RELATION(<), 0));
+    assert(zt_relation_code_holds(ZT_RELATION(>), 1));
+    assert(!zt_relation_code_holds(ZT_RELATION(>), 0));
+    assert(!zt_relation_code_holds(0, 0));
+}
+
+/* fast path of passing claims */
+
+static void test_claim_holds(void)
+{
+    zt_claim claim;
+    const char* p = "p";
+
+    /* Passing claims take the fast path. */
+    claim = ZT_TRUE(true);
+    assert(zt_claim_holds(&claim));
+    claim = ZT_FALSE(false);
+    assert(zt_claim_holds(&claim));
+    claim = ZT_NULL(NULL);
+    assert(zt_claim_holds(&claim));
+    claim = ZT_NOT_NULL(p);
+    assert(zt_claim_holds(&claim));
+    claim = ZT_CMP_BOOL(true, !=, false);
+    assert(zt_claim_holds(&claim));
+    claim = ZT_CMP_RUNE('a', <, 'b');
+    assert(zt_claim_holds(&claim));
+    claim = ZT_CMP_INT(-1, <=, 0);
+    assert(zt_claim_holds(&claim));
+    claim = ZT_CMP_UINT(2u, >, 1u);
+    assert(zt_claim_holds(&claim));
+    claim = ZT_CMP_PTR(p, ==, p);
+    assert(zt_claim_holds(&claim));
+
+    /* Failing claims, and claims the fast path does not handle, are verified as usual. */
+    claim = ZT_TRUE(false);
+    assert(!zt_claim_holds(&claim));
+    claim = ZT_CMP_INT(1, <, 0);
+    assert(!zt_claim_holds(&claim));
+    claim = ZT_CMP_UINT(1u, !=, 1u);
+    assert(!zt_claim_holds(&claim));
+    claim = ZT_CMP_BOOL(true, <, false);
+    assert(!zt_claim_holds(&claim));
+    claim = ZT_CMP_PTR(p, >=, p);
+    assert(!zt_claim_holds(&claim));
+    claim = ZT_CMP_CSTR("a", ==, "a");
+    assert(!zt_claim_holds(&claim));
+    claim = zt_cmp_int(ZT_CURRENT_LOCATION(), zt_pack_integer(1, "1"),
+        zt_pack_string("==", "!="), zt_pack_integer(1, "1"));
+    assert(!zt_claim_holds(&claim));
+    claim = zt_cmp_int(ZT_CURRENT_LOCATION(), zt_pack_integer(1, "1"),
+        zt_pack_string("==", "=="), zt_pack_integer(1, "1"));
+    assert(!zt_claim_holds(&claim));
+    claim = zt_true(ZT_CURRENT_LOCATION(), zt_pack_integer(1, "1"));
+    assert(!zt_claim_holds(&claim));
+}
+
 /* boolean formatting */
 
 static void test_boolean_as_text(void)
@@ -1760,6 +1834,111 @@ static void test_zt_cmp_uint_legacy(void)
     assert(claim.args[2].kind == ZT_UINTMAX);
 }
 
+static void test_ZT_RELATION(void)
+{
+    assert(ZT_RELATION(==) == 1);
+    assert(ZT_RELATION(<) == 2);
+    assert(ZT_RELATION(<=) == 3);
+    assert(ZT_RELATION(>) == 4);
+    assert(ZT_RELATION(>=) == 5);
+    assert(ZT_RELATION(!=) == 6);
+    assert(strcmp(zt_relation_text(ZT_RELATION(==)), "==") == 0);
+    assert(strcmp(zt_relation_text(ZT_RELATION(!=)), "!=") == 0);
+    assert(strcmp(zt_relation_text(ZT_RELATION(<)), "<") == 0);
+    assert(strcmp(zt_relation_text(ZT_RELATION(<=)), "<=") == 0);
+    assert(strcmp(zt_relation_text(ZT_RELATION(>)), ">") == 0);
+    assert(strcmp(zt_relation_text(ZT_RELATION(>=)), ">=") == 0);
+    assert(strcmp(zt_relation_text(0), "invalid") == 0);
+    assert(strcmp(zt_relation_text(7), "invalid") == 0);
+    /* The code is recovered from the text of the relation, not from other strings. */
+    assert(zt_relation_code(zt_relation_text(ZT_RELATION(==))) == ZT_RELATION(==));
+    assert(zt_relation_code(zt_relation_text(ZT_RELATION(>=))) == ZT_RELATION(>=));
+    assert(zt_relation_code(zt_relation_text(0)) == 0);
+    assert(zt_relation_code("==") == 0);
+    assert(zt_relation_code(zt_relation_text(ZT_RELATION(<=)) + 1) == 0);
+}
+
+static void test_zt_cmp(void)
+{
+    zt_claim claim;
+    zt_test t;
+
+    /* The kind of the left hand side selects the verifier. */
+    claim = zt_cmp(ZT_CURRENT_LOCATION(), zt_pack_boolean(true, "a"), ZT_RELATION(==), zt_pack_boolean(true, "b"));
+    assert(claim.make_verifier == zt_verifier_for_boolean_relation);
+    claim = zt_cmp(ZT_CURRENT_LOCATION(), zt_pack_rune('a', "a"), ZT_RELATION(==), zt_pack_rune('b', "b"));
+    assert(claim.make_verifier == zt_verifier_for_rune_relation);
+    claim = zt_cmp(ZT_CURRENT_LOCATION(), zt_pack_unsigned(1, "a"), ZT_RELATION(==), zt_pack_unsigned(2, "b"));
+    assert(claim.make_verifier == zt_verifier_for_unsigned_relation);
+    claim = zt_cmp(ZT_CURRENT_LOCATION(), zt_pack_string("x", "a"), ZT_RELATION(==), zt_pack_string("y", "b"));
+    assert(claim.make_verifier == zt_verifier_for_string_relation);
+    claim = zt_cmp(ZT_CURRENT_LOCATION(), zt_pack_pointer(NULL, "a"), ZT_RELATION(==), zt_pack_pointer(NULL, "b"));
+    assert(claim.make_verifier == zt_verifier_for_pointer_relation);
+    claim = zt_cmp(ZT_CURRENT_LOCATION(), zt_pack_nothing(), ZT_RELATION(==), zt_pack_nothing());
+    assert(claim.make_verifier == zt_verifier_for_integer_relation);
+
+    /* Legacy values are promoted. */
+    claim = zt_cmp(ZT_CURRENT_LOCATION(), zt_pack_legacy_integer(1, "a"), ZT_RELATION(<), zt_pack_legacy_integer(2, "b"));
+    assert(claim.make_verifier == zt_verifier_for_integer_relation);
+    assert(claim.args[0].kind == ZT_INTMAX);
+    assert(claim.args[2].kind == ZT_INTMAX);
+    claim = zt_cmp(ZT_CURRENT_LOCATION(), zt_pack_legacy_unsigned(1, "a"), ZT_RELATION(<), zt_pack_legacy_unsigned(2, "b"));
+    assert(claim.make_verifier == zt_verifier_for_unsigned_relation);
+    assert(claim.args[0].kind == ZT_UINTMAX);
+    assert(claim.args[2].kind == ZT_UINTMAX);
+
+    /* The relation is carried as text, for failure messages. */
+    assert(strcmp(claim.args[1].as.string, "<") == 0);
+    assert(claim.args[1].source == claim.args[1].as.string);
+    t = selftest_make_test();
+    claim = zt_cmp(zt_location_at("file.c", 13), zt_pack_integer(1, "L"), ZT_RELATION(>=), zt_pack_integer(2, "R"));
+    zt_check(&t, claim);
+    assert(t.outcome == ZT_FAILED);
+    selftest_stream_eq(t.stream, "file.c:13: assertion L >= R failed because 1 < 2\n");
+    selftest_close_test(&t);
+
+    /* Codes not made by ZT_RELATION are reported as unsupported. */
+    t = selftest_make_test();
+    claim = zt_cmp(zt_location_at("file.c", 13), zt_pack_integer(1, "L"), 0, zt_pack_integer(1, "R"));
+    zt_check(&t, claim);
+    assert(t.outcome == ZT_FAILED);
+    selftest_stream_eq(t.stream, "file.c:13: assertion L invalid R uses unsupported relation\n");
+    selftest_close_test(&t);
+}
+
+static void test_zt_cmp_at(void)
+{
+    static const zt_claim_site int_site = { { "file.c", 13 }, "L", "R", ZT_RELATION(>=), ZT_INTMAX };
+    static const zt_claim_site rune_site = { { "file.c", 14 }, "L", "R", ZT_RELATION(==), ZT_RUNE };
+    zt_claim claim;
+    zt_test t;
+
+    /* The claim is the same as the one made by zt_cmp. */
+    claim = zt_cmp_at(&int_site, zt_scalar_integer(1), zt_scalar_integer(2));
+    assert(claim.make_verifier == zt_verifier_for_integer_relation);
+    assert(claim.location.fname == int_site.location.fname);
+    assert(claim.location.lineno == 13);
+    assert(claim.args[0].kind == ZT_INTMAX);
+    assert(claim.args[0].as.intmax == 1);
+    assert(claim.args[0].source == int_site.left_source);
+    assert(strcmp(claim.args[1].as.string, ">=") == 0);
+    assert(claim.args[2].kind == ZT_INTMAX);
+    assert(claim.args[2].as.intmax == 2);
+    assert(claim.args[2].source == int_site.right_source);
+    t = selftest_make_test();
+    zt_check(&t, claim);
+    assert(t.outcome == ZT_FAILED);
+    selftest_stream_eq(t.stream, "file.c:13: assertion L >= R failed because 1 < 2\n");
+    selftest_close_test(&t);
+
+    /* Runes are normalized like in zt_pack_rune. */
+    claim = zt_cmp_at(&rune_site, zt_scalar_rune('\xFF'), zt_scalar_rune(0xFF));
+    assert(claim.make_verifier == zt_verifier_for_rune_relation);
+    assert(claim.args[0].kind == ZT_RUNE);
+    assert(claim.args[0].as.rune == 0xFF);
+    assert(zt_claim_holds(&claim));
+}
+
 static void test_ZT_CMP_CSTR(void)
 {
     const char *a, *b;
@@ -1905,19 +2084,19 @@ static void selftest_stub_test_suite(zt_visitor visitor)
     ZT_VISIT_TEST_SUITE(visitor, selftest_stub_nested_test_suite);
 }
 
-static void test_lister_visitor_visit_suite(void)
+static void selftest_stub_root_test_suite(zt_visitor visitor)
+{
+    ZT_VISIT_TEST_SUITE(visitor, selftest_stub_test_suite);
+}
+
+static void test_list_tests_from(void)
 {
     FILE* f = selftest_temporary_file();
-    zt_test_lister lister;
-    zt_visitor visitor;
-    memset(&lister, 0, sizeof lister);
-    lister.stream = f;
-    visitor = zt_visitor_from_test_lister(&lister);
     selftest_stub_nested_test_suite_visited = false;
     selftest_stub_nested_test_case_visited = false;
     selftest_stub_test_suite_visited = false;
     selftest_stub_test_case_visited = false;
-    ZT_VISIT_TEST_SUITE(visitor, selftest_stub_test_suite);
+    assert(zt_list_tests_from(f, selftest_stub_root_test_suite, NULL, ZT_LIST_HUMAN));
     /* test suites are visited, test cases are not. */
     assert(selftest_stub_test_suite_visited == true);
     assert(selftest_stub_nested_test_suite_visited == true);
@@ -1933,21 +2112,28 @@ static void test_lister_visitor_visit_suite(void)
     fclose(f);
 }
 
-static void test_runner_visitor_visit_suite(void)
+static void test_run_tests_in_process(void)
 {
     FILE* stream_out = selftest_temporary_file();
     FILE* stream_err = selftest_temporary_file();
     zt_test_runner runner;
-    zt_visitor visitor;
+    zt_test_table table;
     memset(&runner, 0, sizeof runner);
+    memset(&table, 0, sizeof table);
     runner.stream_out = stream_out;
     runner.stream_err = stream_err;
-    visitor = zt_visitor_from_test_runner(&runner);
     selftest_stub_nested_test_suite_visited = false;
     selftest_stub_nested_test_case_visited = false;
     selftest_stub_test_suite_visited = false;
     selftest_stub_test_case_visited = false;
-    ZT_VISIT_TEST_SUITE(visitor, selftest_stub_test_suite);
+    assert(zt_collect_tests_from(&table, selftest_stub_root_test_suite, NULL));
+    /* test suites are visited while collecting, test cases are not. */
+    assert(selftest_stub_test_suite_visited == true);
+    assert(selftest_stub_nested_test_suite_visited == true);
+    assert(selftest_stub_test_case_visited == false);
+    assert(selftest_stub_nested_test_case_visited == false);
+    zt_run_tests_in_process(&runner, &table);
+    zt_test_table_free(&table);
     /* test suites and test cases are all visited. */
     assert(selftest_stub_test_suite_visited == true);
     assert(selftest_stub_nested_test_suite_visited == true);
@@ -1960,6 +2146,22 @@ static void test_runner_visitor_visit_suite(void)
     fclose(stream_err);
 }
 
+/** selftest_run_test_case runs a single test case with the in-process runner. */
+static void selftest_run_test_case(zt_test_runner* runner, zt_test_case_func func, const char* name)
+{
+    zt_test_table table;
+    zt_test_entry* entry;
+    memset(&table, 0, sizeof table);
+    entry = zt_test_table_append(&table);
+    assert(entry != NULL);
+    entry->name = name;
+    entry->func = func;
+    entry->parent = ZT_NO_PARENT;
+    entry->kind = ZT_ENTRY_CASE;
+    zt_run_tests_in_process(runner, &table);
+    zt_test_table_free(&table);
+}
+
 static bool selftest_case_pending_visited;
 static void selftest_case_pending(zt_t t)
 {
@@ -1967,18 +2169,16 @@ static void selftest_case_pending(zt_t t)
     assert(t->outcome == ZT_PENDING);
 }
 
-static void test_runner_visitor_visit_case_outcome_pending(void)
+static void test_run_test_case_outcome_pending(void)
 {
     FILE* stream_out = selftest_temporary_file();
     FILE* stream_err = selftest_temporary_file();
     zt_test_runner runner;
-    zt_visitor visitor;
     memset(&runner, 0, sizeof runner);
     runner.stream_out = stream_out;
     runner.stream_err = stream_err;
-    visitor = zt_visitor_from_test_runner(&runner);
     selftest_case_pending_visited = false;
-    ZT_VISIT_TEST_CASE(visitor, selftest_case_pending);
+    selftest_run_test_case(&runner, selftest_case_pending, "selftest_case_pending");
     assert(selftest_case_pending_visited == true);
 
     selftest_stream_eq(stream_out, "");
@@ -1996,18 +2196,16 @@ static void selftest_case_passed(zt_t t)
     t->outcome = ZT_PASSED;
 }
 
-static void test_runner_visitor_visit_case_outcome_passed(void)
+static void test_run_test_case_outcome_passed(void)
 {
     FILE* stream_out = selftest_temporary_file();
     FILE* stream_err = selftest_temporary_file();
     zt_test_runner runner;
-    zt_visitor visitor;
     memset(&runner, 0, sizeof runner);
     runner.stream_out = stream_out;
     runner.stream_err = stream_err;
-    visitor = zt_visitor_from_test_runner(&runner);
     selftest_case_passed_visited = false;
-    ZT_VISIT_TEST_CASE(visitor, selftest_case_passed);
+    selftest_run_test_case(&runner, selftest_case_passed, "selftest_case_passed");
     assert(selftest_case_passed_visited == true);
 
     selftest_stream_eq(stream_out, "");
@@ -2025,18 +2223,16 @@ static void selftest_case_failed(zt_t t)
     t->outcome = ZT_FAILED;
 }
 
-static void test_runner_visitor_visit_case_outcome_failed(void)
+static void test_run_test_case_outcome_failed(void)
 {
     FILE* stream_out = selftest_temporary_file();
     FILE* stream_err = selftest_temporary_file();
     zt_test_runner runner;
-    zt_visitor visitor;
     memset(&runner, 0, sizeof runner);
     runner.stream_out = stream_out;
     runner.stream_err = stream_err;
-    visitor = zt_visitor_from_test_runner(&runner);
     selftest_case_failed_visited = false;
-    ZT_VISIT_TEST_CASE(visitor, selftest_case_failed);
+    selftest_run_test_case(&runner, selftest_case_failed, "selftest_case_failed");
     assert(selftest_case_failed_visited == true);
 
     selftest_stream_eq(stream_out, "");
@@ -2054,19 +2250,17 @@ static void selftest_case_bogus_outcome(zt_t t)
     t->outcome = 42;
 }
 
-static void test_runner_visitor_visit_case_outcome_bogus(void)
+static void test_run_test_case_outcome_bogus(void)
 {
     FILE* stream_out = selftest_temporary_file();
     FILE* stream_err = selftest_temporary_file();
     zt_test_runner runner;
-    zt_visitor visitor;
 
     memset(&runner, 0, sizeof runner);
     runner.stream_out = stream_out;
     runner.stream_err = stream_err;
-    visitor = zt_visitor_from_test_runner(&runner);
     selftest_case_bogus_outcome_visited = false;
-    ZT_VISIT_TEST_CASE(visitor, selftest_case_bogus_outcome);
+    selftest_run_test_case(&runner, selftest_case_bogus_outcome, "selftest_case_bogus_outcome");
     assert(selftest_case_bogus_outcome_visited == true);
 
     selftest_stream_eq(stream_out, "");
@@ -2112,6 +2306,9 @@ static void selftest_failing_check(zt_t t)
     zt_check(t, ZT_CMP_INT(1, !=, 1));
 }
 
+/* Line of the first failing check, the second one is on the next line. */
+static const int selftest_failing_check_lineno = __LINE__ - 5;
+
 static void selftest_passing_assert(zt_t t)
 {
     zt_assert(t, ZT_TRUE(1));
@@ -2122,6 +2319,8 @@ static void selftest_failing_assert(zt_t t)
     zt_assert(t, ZT_TRUE(0));
 }
 
+static const int selftest_failing_assert_lineno = __LINE__ - 3;
+
 static void selftest_empty_suite(ZT_UNUSED zt_visitor v)
 {
     (void)v;
@@ -2201,7 +2400,8 @@ static void test_main_verbosely_running_failing_tests(void)
         "%s:%d: assertion failed because 0 is false\n"
         "%s:%d: assertion 1 != 1 failed because 1 == 1\n"
         "%s:%d: assertion failed because 0 is false\n",
-        __FILE__, __LINE__ - 93, __FILE__, __LINE__ - 92, __FILE__, __LINE__ - 82);
+        __FILE__, selftest_failing_check_lineno, __FILE__, selftest_failing_check_lineno + 1,
+        __FILE__, selftest_failing_assert_lineno);
     fclose(zt_mock_stdout);
     fclose(zt_mock_stderr);
     zt_mock_stdout = NULL;
@@ -2243,103 +2443,3407 @@ static void test_main_verbosely_running_mixed_tests(void)
     zt_mock_stderr = NULL;
 }
 
-static void test_stdout_stderr(void)
+static void test_parse_options(void)
 {
-    assert(zt_stdout() == stdout);
-    assert(zt_stderr() == stderr);
+    char* argv_none[] = { "a.out" };
+    char* argv_list_verbose[] = { "a.out", "-l", "-v" };
+    char* argv_jobs_separate[] = { "a.out", "-j", "4" };
+    char* argv_jobs_joined[] = { "a.out", "-j16" };
+    char* argv_jobs_missing[] = { "a.out", "-j" };
+    char* argv_jobs_zero[] = { "a.out", "-j0" };
+    char* argv_jobs_garbage[] = { "a.out", "-j", "4x" };
+    char* argv_batch[] = { "a.out", "-j", "2", "-b", "100" };
+    char* argv_batch_zero[] = { "a.out", "-b0" };
+    char* argv_threads[] = { "a.out", "-t", "8" };
+    char* argv_threads_zero[] = { "a.out", "-t", "0" };
+    char* argv_history[] = { "a.out", "-d", "durations" };
+    char* argv_history_missing[] = { "a.out", "-d" };
+    char* argv_shard_separate[] = { "a.out", "--shard", "2/3" };
+    char* argv_shard_joined[] = { "a.out", "--shard=1/1" };
+    char* argv_shard_zero[] = { "a.out", "--shard", "0/3" };
+    char* argv_shard_too_big[] = { "a.out", "--shard=4/3" };
+    char* argv_shard_garbage[] = { "a.out", "--shard", "1" };
+    char* argv_unknown[] = { "a.out", "-x" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_none, NULL));
+    assert(opts.list == false);
+    assert(opts.verbose == false);
+    assert(opts.jobs == 0);
+    assert(opts.threads == 0);
+    assert(opts.batch == 0);
+    assert(opts.history == NULL);
+    assert(opts.num_shards == 0);
+
+    assert(zt_parse_options(&opts, 3, argv_list_verbose, NULL));
+    assert(opts.list == true);
+    assert(opts.verbose == true);
+
+    assert(zt_parse_options(&opts, 3, argv_jobs_separate, NULL));
+    assert(opts.jobs == 4);
+
+    assert(zt_parse_options(&opts, 2, argv_jobs_joined, NULL));
+    assert(opts.jobs == 16);
+
+    assert(zt_parse_options(&opts, 3, argv_threads, NULL));
+    assert(opts.threads == 8);
+
+    assert(zt_parse_options(&opts, 5, argv_batch, NULL));
+    assert(opts.jobs == 2);
+    assert(opts.batch == 100);
+
+    assert(zt_parse_options(&opts, 3, argv_history, NULL));
+    assert(strcmp(opts.history, "durations") == 0);
+
+    assert(zt_parse_options(&opts, 3, argv_shard_separate, NULL));
+    assert(opts.shard == 1);
+    assert(opts.num_shards == 3);
+
+    assert(zt_parse_options(&opts, 2, argv_shard_joined, NULL));
+    assert(opts.shard == 0);
+    assert(opts.num_shards == 1);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 2, argv_jobs_missing, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_jobs_zero, stream_err));
+    assert(!zt_parse_options(&opts, 3, argv_jobs_garbage, stream_err));
+    assert(!zt_parse_options(&opts, 3, argv_threads_zero, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_batch_zero, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_history_missing, stream_err));
+    assert(!zt_parse_options(&opts, 3, argv_shard_zero, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_shard_too_big, stream_err));
+    assert(!zt_parse_options(&opts, 3, argv_shard_garbage, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_unknown, stream_err));
+    selftest_stream_eq(stream_err,
+        "option -j requires a positive number of jobs\n"
+        "option -j requires a positive number of jobs\n"
+        "option -j requires a positive number of jobs\n"
+        "option -t requires a positive number of threads\n"
+        "option -b requires a positive batch size\n"
+        "option -d requires a file name\n"
+        "option --shard requires a value I/N, with I from 1 to N\n"
+        "option --shard requires a value I/N, with I from 1 to N\n"
+        "option --shard requires a value I/N, with I from 1 to N\n"
+        "unknown option: -x\n");
+    fclose(stream_err);
 }
 
-int main(ZT_UNUSED int argc, ZT_UNUSED char** argv, ZT_UNUSED char** envp)
+static void test_main_with_unknown_option(void)
 {
-    (void)argc;
-    (void)argv;
-    (void)envp;
-    test_MAJOR_MINOR_VERSION();
+    char* test_argv[] = { "a.out", "--bogus" };
+    int exit_code;
 
-    test_pack_boolean();
-    test_pack_rune();
-    test_pack_integer();
-    test_pack_unsigned();
-    test_pack_string();
-    test_pack_pointer();
-    test_promote_value();
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
 
-    test_find_binary_relation();
-    test_invert_binary_relation();
-    test_binary_relation_as_text();
+    exit_code = zt_main(2, test_argv, NULL, selftest_passing_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(zt_mock_stdout, "");
+    selftest_stream_eq(zt_mock_stderr, "unknown option: --bogus\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
 
-    test_boolean_as_text();
+static void test_collect_tests_from(void)
+{
+    zt_test_table table;
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_mixed_suite, NULL));
+    assert(table.len == 9);
+    assert(strcmp(table.entries[0].name, "selftest_passing_suite") == 0);
+    assert(table.entries[0].kind == ZT_ENTRY_SUITE);
+    assert(table.entries[0].nesting == 0);
+    assert(table.entries[0].func == NULL);
+    assert(table.entries[0].parent == ZT_NO_PARENT);
+    assert(strcmp(table.entries[1].name, "selftest_passing_check") == 0);
+    assert(table.entries[1].kind == ZT_ENTRY_CASE);
+    assert(table.entries[1].nesting == 1);
+    assert(table.entries[1].func == selftest_passing_check);
+    assert(table.entries[1].parent == 0);
+    assert(strcmp(table.entries[3].name, "selftest_empty_suite") == 0);
+    assert(table.entries[3].kind == ZT_ENTRY_SUITE);
+    assert(table.entries[3].parent == 0);
+    assert(table.entries[7].parent == 4);
+    assert(strcmp(table.entries[8].name, "selftest_case_bogus_outcome") == 0);
+    assert(table.entries[8].nesting == 0);
+    assert(table.entries[8].parent == ZT_NO_PARENT);
+    zt_test_table_free(&table);
+    assert(table.entries == NULL);
+    assert(table.len == 0);
+}
 
-    test_verify_claim0();
-    test_verify_claim1();
-    test_verify_claim2();
-    test_verify_claim3();
-    test_verify_bogus_claim4();
-    test_verify_mismatch_claim1of1();
-    test_verify_mismatch_claim1of2();
-    test_verify_mismatch_claim2of2();
-    test_verify_mismatch_claim1of3();
-    test_verify_mismatch_claim2of3();
-    test_verify_mismatch_claim3of3();
+static void selftest_thread_safe_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE_MT(v, selftest_passing_check);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_failing_assert);
+    ZT_VISIT_TEST_SUITE(v, selftest_passing_suite);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_passing_assert);
+}
 
-    test_verifier_for_true();
-    test_verify_true();
+static void test_collect_thread_safe_tests_from(void)
+{
+    zt_test_table table;
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_thread_safe_suite, NULL));
+    assert(table.len == 8);
+    assert(table.entries[0].thread_safe == true);
+    assert(table.entries[1].thread_safe == false);
+    assert(table.entries[2].thread_safe == true);
+    assert(table.entries[3].thread_safe == false);
+    assert(table.entries[4].thread_safe == false);
+    assert(table.entries[7].thread_safe == true);
+    zt_test_table_free(&table);
+}
 
-    test_verifier_for_false();
-    test_verify_false();
+static void test_main_listing_thread_safe_tests(void)
+{
+    char* test_argv[] = { "a.out", "-l" };
+    int exit_code;
 
-    test_verifier_for_boolean_relation();
-    test_verify_boolean_relation();
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
 
-    test_verifier_for_rune_relation();
-    test_verify_rune_relation();
+    exit_code = zt_main(2, test_argv, NULL, selftest_thread_safe_suite);
+    assert(exit_code == 0);
+    selftest_stream_eq(
+        zt_mock_stdout, ""
+                        "- selftest_passing_check\n"
+                        "- selftest_passing_assert\n"
+                        "- selftest_failing_assert\n"
+                        "- selftest_passing_suite\n"
+                        "  - selftest_passing_check\n"
+                        "  - selftest_passing_assert\n"
+                        "  - selftest_empty_suite\n"
+                        "- selftest_passing_assert\n");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
 
-    test_verifier_for_integer_relation();
-    test_verify_integer_relation();
+static void test_main_verbosely_running_thread_safe_tests(void)
+{
+    char* test_argv[] = { "a.out", "-v", "-t", "4" };
+    int exit_code;
 
-    test_verifier_for_unsigned_relation();
-    test_verify_unsigned_relation();
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
 
-    test_verifier_for_string_relation();
-    test_verify_string_relation();
+    exit_code = zt_main(4, test_argv, NULL, selftest_thread_safe_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_check ok\n"
+        "- selftest_passing_assert ok\n"
+        "- selftest_failing_assert failed\n"
+        "+ selftest_passing_suite\n"
+        "  - selftest_passing_check ok\n"
+        "  - selftest_passing_assert ok\n"
+        "  + selftest_empty_suite\n"
+        "- selftest_passing_assert ok\n");
+    selftest_stream_eq_at(
+        zt_mock_stderr, __FILE__, __LINE__,
+        "%s:%d: assertion failed because 0 is false\n",
+        __FILE__, selftest_failing_assert_lineno);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
 
-    test_verifier_for_pointer_relation();
-    test_verify_pointer_relation();
+static int selftest_setup_calls;
+static int selftest_setup_value;
+static void selftest_passing_setup(zt_t t)
+{
+    selftest_setup_calls++;
+    selftest_setup_value = 42;
+    zt_check(t, ZT_TRUE(true));
+}
 
-    test_verifier_for_null();
-    test_verify_null();
+static void selftest_failing_setup(zt_t t)
+{
+    selftest_setup_calls++;
+    zt_assert(t, ZT_TRUE(false));
+}
 
-    test_verifier_for_not_null();
-    test_verify_not_null();
+static void selftest_case_using_setup(zt_t t)
+{
+    zt_check(t, ZT_CMP_INT(selftest_setup_value, ==, 42));
+}
 
-    test_ZT_TRUE();
-    test_ZT_FALSE();
-    test_ZT_CMP_BOOL();
-    test_ZT_CMP_RUNE();
-    test_ZT_CMP_INT();
-    test_zt_cmp_int_legacy();
-    test_ZT_CMP_UINT();
-    test_zt_cmp_uint_legacy();
-    test_ZT_CMP_CSTR();
-    test_ZT_CMP_PTR();
-    test_ZT_NULL();
-    test_ZT_NOT_NULL();
+static bool selftest_case_after_failed_setup_visited;
+static void selftest_case_after_failed_setup(ZT_UNUSED zt_t t)
+{
+    (void)t;
+    selftest_case_after_failed_setup_visited = true;
+}
 
-    test_quote_string();
-    test_quote_rune();
+static void selftest_suite_with_setup(zt_visitor v)
+{
+    ZT_VISIT_SUITE_SETUP(v, selftest_passing_setup);
+    ZT_VISIT_TEST_CASE(v, selftest_case_using_setup);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_case_using_setup);
+}
 
-    test_lister_visitor_visit_suite();
-    test_runner_visitor_visit_suite();
-    test_runner_visitor_visit_case_outcome_pending();
-    test_runner_visitor_visit_case_outcome_passed();
-    test_runner_visitor_visit_case_outcome_failed();
-    test_runner_visitor_visit_case_outcome_bogus();
+static void selftest_suite_with_failing_setup(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+    ZT_VISIT_SUITE_SETUP(v, selftest_failing_setup);
+    ZT_VISIT_TEST_CASE(v, selftest_case_after_failed_setup);
+    ZT_VISIT_TEST_SUITE(v, selftest_suite_with_setup);
+}
 
-    test_main_listing_tests();
-    test_main_running_passing_tests();
-    test_main_verbosely_running_passing_tests();
-    test_main_verbosely_running_failing_tests();
-    test_main_verbosely_running_mixed_tests();
+static void selftest_suites_with_setup(zt_visitor v)
+{
+    ZT_VISIT_TEST_SUITE(v, selftest_suite_with_failing_setup);
+    ZT_VISIT_TEST_SUITE(v, selftest_suite_with_setup);
+}
+
+static void test_main_listing_tests_with_setup(void)
+{
+    char* test_argv[] = { "a.out", "-l" };
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    selftest_setup_calls = 0;
+    exit_code = zt_main(2, test_argv, NULL, selftest_suite_with_setup);
+    assert(exit_code == 0);
+    /* Listing tests does not execute setup functions. */
+    assert(selftest_setup_calls == 0);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_case_using_setup\n"
+        "- selftest_case_using_setup\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void selftest_main_verbosely_running_tests_with_setup(int argc, char** argv)
+{
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    selftest_setup_calls = 0;
+    selftest_setup_value = 0;
+    selftest_case_after_failed_setup_visited = false;
+    exit_code = zt_main(argc, argv, NULL, selftest_suites_with_setup);
+    assert(exit_code == EXIT_FAILURE);
+    /* The failing setup prevents setup of the nested suite. */
+    assert(selftest_setup_calls == 2);
+    assert(selftest_case_after_failed_setup_visited == false);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "+ selftest_suite_with_failing_setup\n"
+        "  - selftest_passing_check ok\n"
+        "  * selftest_failing_setup failed\n"
+        "  - selftest_case_after_failed_setup failed\n"
+        "  + selftest_suite_with_setup\n"
+        "     - selftest_case_using_setup failed\n"
+        "     - selftest_case_using_setup failed\n"
+        "+ selftest_suite_with_setup\n"
+        "  * selftest_passing_setup ok\n"
+        "  - selftest_case_using_setup ok\n"
+        "  - selftest_case_using_setup ok\n");
+    selftest_stream_eq_at(
+        zt_mock_stderr, __FILE__, __LINE__,
+        "%s:%d: assertion failed because false is false\n"
+        "  - selftest_case_after_failed_setup - not executed because selftest_failing_setup failed\n"
+        "     - selftest_case_using_setup - not executed because selftest_failing_setup failed\n"
+        "     - selftest_case_using_setup - not executed because selftest_failing_setup failed\n",
+        __FILE__, __LINE__ - 93);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void test_main_verbosely_running_tests_with_setup(void)
+{
+    char* argv_serial[] = { "a.out", "-v" };
+    char* argv_threads[] = { "a.out", "-v", "-t", "2" };
+
+    selftest_main_verbosely_running_tests_with_setup(2, argv_serial);
+    selftest_main_verbosely_running_tests_with_setup(4, argv_threads);
+}
+
+#ifdef ZT_HAVE_POSIX
+static void test_main_verbosely_running_tests_with_setup_in_parallel(void)
+{
+    char* argv_parallel[] = { "a.out", "-v", "-j", "4" };
+
+    /* Setup functions run once, in the parent process. */
+    selftest_main_verbosely_running_tests_with_setup(4, argv_parallel);
+}
+
+static int selftest_thread_safe_count;
+static pthread_mutex_t selftest_thread_safe_lock = PTHREAD_MUTEX_INITIALIZER;
+static void selftest_thread_safe_counting_case(zt_t t)
+{
+    pthread_mutex_lock(&selftest_thread_safe_lock);
+    selftest_thread_safe_count++;
+    pthread_mutex_unlock(&selftest_thread_safe_lock);
+    zt_assert(t, ZT_TRUE(true));
+}
+
+static void selftest_thread_safe_counting_suite(zt_visitor v)
+{
+    int i;
+    for (i = 0; i < 1000; i++) {
+        ZT_VISIT_TEST_CASE_MT(v, selftest_thread_safe_counting_case);
+    }
+}
+
+static void test_run_tests_in_threads(void)
+{
+    zt_test_runner runner;
+    zt_test_table table;
+    size_t i;
+
+    memset(&runner, 0, sizeof runner);
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_thread_safe_counting_suite, NULL));
+    selftest_thread_safe_count = 0;
+    zt_run_tests_in_threads(&runner, &table, 8);
+    assert(selftest_thread_safe_count == 1000);
+    for (i = 0; i < table.len; i++) {
+        assert(table.entries[i].done == true);
+        assert(table.entries[i].outcome == ZT_PENDING);
+    }
+    /* Outcomes are counted by the runner when reported. */
+    assert(runner.num_passed == 0);
+    assert(runner.num_failed == 0);
+    zt_test_table_free(&table);
+}
+
+static void test_main_verbosely_running_mixed_tests_in_parallel(void)
+{
+    char* test_argv[] = { "a.out", "-v", "-j", "1" };
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    /* With a single job the output is identical to that of the serial runner. */
+    exit_code = zt_main(4, test_argv, NULL, selftest_mixed_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "+ selftest_passing_suite\n"
+        "  - selftest_passing_check ok\n"
+        "  - selftest_passing_assert ok\n"
+        "  + selftest_empty_suite\n"
+        "+ selftest_failing_suite\n"
+        "  - selftest_failing_check failed\n"
+        "  - selftest_failing_assert failed\n"
+        "  + selftest_empty_suite\n"
+        "- selftest_case_bogus_outcome outcome code 42 (?)\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void test_main_running_passing_tests_in_parallel(void)
+{
+    char* test_argv[] = { "a.out", "-j4" };
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    exit_code = zt_main(2, test_argv, NULL, selftest_passing_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(zt_mock_stdout, "");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void selftest_crashing_case(ZT_UNUSED zt_t t)
+{
+    (void)t;
+    raise(SIGKILL);
+}
+
+static void selftest_crashing_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+    ZT_VISIT_TEST_CASE(v, selftest_crashing_case);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+}
+
+static void test_main_running_crashing_tests_in_parallel(void)
+{
+    char* test_argv[] = { "a.out", "-v", "-j", "2" };
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    /* The crash is confined to the crashing test case. */
+    exit_code = zt_main(4, test_argv, NULL, selftest_crashing_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_check ok\n"
+        "- selftest_crashing_case failed\n"
+        "- selftest_passing_assert ok\n");
+    selftest_stream_eq(zt_mock_stderr, "test case selftest_crashing_case killed by signal 9\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+#endif
+
+#ifdef ZT_HAVE_POSIX
+/* Test cases record the order in which they were executed. */
+static const char* selftest_execution_order[4];
+static size_t selftest_execution_count;
+
+static void selftest_record_execution(const char* name)
+{
+    if (selftest_execution_count < sizeof selftest_execution_order / sizeof *selftest_execution_order) {
+        selftest_execution_order[selftest_execution_count] = name;
+    }
+    selftest_execution_count++;
+}
+
+static void selftest_short_case(ZT_UNUSED zt_t t)
+{
+    selftest_record_execution("short");
+}
+
+static void selftest_long_case(ZT_UNUSED zt_t t)
+{
+    selftest_record_execution("long");
+}
+
+static void selftest_medium_case(ZT_UNUSED zt_t t)
+{
+    selftest_record_execution("medium");
+}
+
+static void selftest_new_case(ZT_UNUSED zt_t t)
+{
+    selftest_record_execution("new");
+}
+
+static void selftest_timed_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE_MT(v, selftest_short_case);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_long_case);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_medium_case);
+}
+
+static void selftest_timed_suite_with_new_case(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE_MT(v, selftest_new_case);
+    selftest_timed_suite(v);
+}
+
+/** selftest_temporary_path creates an empty temporary file and returns its name. */
+static void selftest_temporary_path(char* path, size_t size)
+{
+    const char* tmp_dir_name = getenv("TMPDIR");
+    int fd;
+
+    if (tmp_dir_name == NULL) {
+        tmp_dir_name = "/tmp";
+    }
+    snprintf(path, size, "%s/zt-test-XXXXXX", tmp_dir_name);
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("cannot create temporary file");
+        exit(1);
+    }
+    close(fd);
+}
+
+static void test_collect_path_hashes(void)
+{
+    zt_test_table table;
+
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_mixed_suite, NULL));
+    assert(table.len == 9);
+    /* Path hashes are FNV-1a hashes of slash-separated suite names. */
+    assert(strcmp(table.entries[1].name, "selftest_passing_check") == 0);
+    assert(table.entries[1].path_hash == zt_fnv1a(ZT_FNV1A_OFFSET, "selftest_passing_suite/selftest_passing_check"));
+    /* Suites with the same name have distinct paths in distinct parents. */
+    assert(strcmp(table.entries[3].name, "selftest_empty_suite") == 0);
+    assert(strcmp(table.entries[7].name, "selftest_empty_suite") == 0);
+    assert(table.entries[3].path_hash != table.entries[7].path_hash);
+    assert(table.entries[7].path_hash == zt_fnv1a(ZT_FNV1A_OFFSET, "selftest_failing_suite/selftest_empty_suite"));
+    zt_test_table_free(&table);
+}
+
+static void test_history_save_and_open(void)
+{
+    char path[PATH_MAX];
+    zt_history history;
+    zt_test_table table;
+    uint32_t duration;
+
+    selftest_temporary_path(path, sizeof path);
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_timed_suite, NULL));
+    assert(table.len == 3);
+
+    /* An empty file is an empty history. */
+    zt_history_open(&history, path);
+    assert(history.len == 0);
+    assert(!zt_history_find(&history, table.entries[0].path_hash, &duration));
+
+    table.entries[0].elapsed = 100;
+    table.entries[0].timed = true;
+    table.entries[1].elapsed = 3000;
+    table.entries[1].timed = true;
+    assert(zt_history_save(&history, &table, path, NULL));
+    zt_history_close(&history);
+
+    zt_history_open(&history, path);
+    assert(history.len == 2);
+    assert(history.map_size == sizeof(zt_history_header) + 2 * 12);
+    assert(zt_history_find(&history, table.entries[0].path_hash, &duration));
+    assert(duration == 100);
+    assert(zt_history_find(&history, table.entries[1].path_hash, &duration));
+    assert(duration == 3000);
+    assert(!zt_history_find(&history, table.entries[2].path_hash, &duration));
+
+    /* New measurements are averaged with old ones, old durations are kept. */
+    table.entries[0].timed = false;
+    table.entries[1].elapsed = 1000;
+    table.entries[2].elapsed = 2000;
+    table.entries[2].timed = true;
+    assert(zt_history_save(&history, &table, path, NULL));
+    zt_history_close(&history);
+
+    zt_history_open(&history, path);
+    assert(history.len == 3);
+    assert(zt_history_find(&history, table.entries[0].path_hash, &duration));
+    assert(duration == 100);
+    assert(zt_history_find(&history, table.entries[1].path_hash, &duration));
+    assert(duration == 2000);
+    assert(zt_history_find(&history, table.entries[2].path_hash, &duration));
+    assert(duration == 2000);
+    zt_history_close(&history);
+
+    zt_test_table_free(&table);
+    unlink(path);
+}
+
+static void test_history_estimate(void)
+{
+    char path[PATH_MAX];
+    zt_history history;
+    zt_test_table table;
+    size_t items[4] = { 0, 1, 2, 3 };
+
+    selftest_temporary_path(path, sizeof path);
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_timed_suite, NULL));
+    table.entries[0].elapsed = 100;
+    table.entries[1].elapsed = 3000;
+    table.entries[2].elapsed = 2000;
+    table.entries[0].timed = table.entries[1].timed = table.entries[2].timed = true;
+    zt_history_open(&history, path);
+    assert(zt_history_save(&history, &table, path, NULL));
+    zt_history_close(&history);
+    zt_test_table_free(&table);
+
+    /* Test cases without history are expected to take the mean duration. */
+    assert(zt_collect_tests_from(&table, selftest_timed_suite_with_new_case, NULL));
+    zt_history_open(&history, path);
+    zt_history_estimate(&history, &table);
+    zt_history_close(&history);
+    assert(table.longest_first);
+    assert(table.entries[0].expected == 1700);
+    assert(table.entries[1].expected == 100);
+    assert(table.entries[2].expected == 3000);
+    assert(table.entries[3].expected == 2000);
+
+    zt_test_table_sort_longest_first(&table, items, 4);
+    assert(items[0] == 2);
+    assert(items[1] == 3);
+    assert(items[2] == 0);
+    assert(items[3] == 1);
+
+    zt_test_table_free(&table);
+    unlink(path);
+}
+
+static void test_main_running_tests_longest_first(void)
+{
+    char path[PATH_MAX];
+    char* test_argv[] = { "a.out", "-v", "-t", "1", "-d", NULL };
+    zt_history history;
+    zt_test_table table;
+    int exit_code;
+
+    selftest_temporary_path(path, sizeof path);
+    test_argv[5] = path;
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_timed_suite, NULL));
+    table.entries[0].elapsed = 100;
+    table.entries[1].elapsed = 3000;
+    table.entries[2].elapsed = 2000;
+    table.entries[0].timed = table.entries[1].timed = table.entries[2].timed = true;
+    zt_history_open(&history, path);
+    assert(zt_history_save(&history, &table, path, NULL));
+    zt_history_close(&history);
+    zt_test_table_free(&table);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    selftest_execution_count = 0;
+    exit_code = zt_main(6, test_argv, NULL, selftest_timed_suite_with_new_case);
+    assert(exit_code == EXIT_SUCCESS);
+    /* Test cases are executed longest first but reported in order. */
+    assert(selftest_execution_count == 4);
+    assert(strcmp(selftest_execution_order[0], "long") == 0);
+    assert(strcmp(selftest_execution_order[1], "medium") == 0);
+    assert(strcmp(selftest_execution_order[2], "new") == 0);
+    assert(strcmp(selftest_execution_order[3], "short") == 0);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_new_case ok\n"
+        "- selftest_short_case ok\n"
+        "- selftest_long_case ok\n"
+        "- selftest_medium_case ok\n");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+
+    /* The run updated the history with the new test case. */
+    zt_history_open(&history, path);
+    assert(history.len == 4);
+    zt_history_close(&history);
+    unlink(path);
+}
+
+static void test_shard_by_duration(void)
+{
+    char path[PATH_MAX];
+    zt_history history;
+    zt_test_table table;
+
+    selftest_temporary_path(path, sizeof path);
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_timed_suite, NULL));
+    table.entries[0].elapsed = 100;
+    table.entries[1].elapsed = 3000;
+    table.entries[2].elapsed = 2000;
+    table.entries[0].timed = table.entries[1].timed = table.entries[2].timed = true;
+    zt_history_open(&history, path);
+    assert(zt_history_save(&history, &table, path, NULL));
+    zt_history_close(&history);
+    zt_test_table_free(&table);
+
+    /* Longest first: long (3000) and medium (2000) open the two shards,
+     * the new test case (1700) joins medium and short (100) joins long. */
+    assert(zt_collect_tests_from(&table, selftest_timed_suite_with_new_case, NULL));
+    zt_history_open(&history, path);
+    zt_history_estimate(&history, &table);
+    zt_history_close(&history);
+    assert(zt_test_table_shard(&table, 0, 2));
+    assert(strcmp(table.entries[0].name, "selftest_new_case") == 0);
+    assert(table.entries[0].excluded == true);
+    assert(table.entries[1].excluded == false);
+    assert(table.entries[2].excluded == false);
+    assert(table.entries[3].excluded == true);
+    zt_test_table_free(&table);
+    unlink(path);
+}
+
+static void test_shard_independent_of_order(void)
+{
+    char path[PATH_MAX];
+    char other_path[PATH_MAX];
+    char* argv_first[] = { "a.out", "-d", NULL, "--shard", "1/2", "--shuffle=1" };
+    char* argv_second[] = { "a.out", "-d", NULL, "--shard", "2/2", "--shuffle=2" };
+    const zt_test_entry* sorted[3];
+    zt_history history;
+    zt_test_table table;
+    size_t i, j;
+
+    /* Without any known duration test cases are assigned by path hash. */
+    selftest_temporary_path(path, sizeof path);
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_timed_suite, NULL));
+    zt_history_open(&history, path);
+    zt_history_estimate(&history, &table);
+    zt_history_close(&history);
+    assert(!table.longest_first);
+    assert(zt_test_table_shard(&table, 0, 2));
+    for (i = 0; i < table.len; i++) {
+        assert(table.entries[i].excluded == (table.entries[i].path_hash % 2 != 0));
+    }
+    zt_test_table_free(&table);
+
+    /* Test cases of equal duration are assigned in the order of path hashes. */
+    assert(zt_collect_tests_from(&table, selftest_timed_suite, NULL));
+    for (i = 0; i < table.len; i++) {
+        table.entries[i].elapsed = 1000;
+        table.entries[i].timed = true;
+    }
+    /* Each machine has its own copy of the same history. */
+    selftest_temporary_path(other_path, sizeof other_path);
+    zt_history_open(&history, path);
+    assert(zt_history_save(&history, &table, path, NULL));
+    zt_history_close(&history);
+    zt_history_open(&history, other_path);
+    assert(zt_history_save(&history, &table, other_path, NULL));
+    zt_history_close(&history);
+    zt_test_table_free(&table);
+    assert(zt_collect_tests_from(&table, selftest_timed_suite, NULL));
+    zt_history_open(&history, path);
+    zt_history_estimate(&history, &table);
+    zt_history_close(&history);
+    assert(zt_test_table_shard(&table, 0, 2));
+    for (i = 0; i < 3; i++) {
+        sorted[i] = &table.entries[i];
+    }
+    for (i = 0; i < 3; i++) {
+        for (j = i + 1; j < 3; j++) {
+            if (sorted[j]->path_hash < sorted[i]->path_hash) {
+                const zt_test_entry* tmp = sorted[i];
+                sorted[i] = sorted[j];
+                sorted[j] = tmp;
+            }
+        }
+    }
+    assert(!sorted[0]->excluded);
+    assert(sorted[1]->excluded);
+    assert(!sorted[2]->excluded);
+    zt_test_table_free(&table);
+
+    /* Shards shuffled with different seeds still execute each test case once. */
+    argv_first[2] = path;
+    argv_second[2] = other_path;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    selftest_execution_count = 0;
+    assert(zt_main(6, argv_first, NULL, selftest_timed_suite) == EXIT_SUCCESS);
+    assert(zt_main(6, argv_second, NULL, selftest_timed_suite) == EXIT_SUCCESS);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+    assert(selftest_execution_count == 3);
+    for (i = 0; i < 3; i++) {
+        for (j = i + 1; j < 3; j++) {
+            assert(strcmp(selftest_execution_order[i], selftest_execution_order[j]) != 0);
+        }
+    }
+    unlink(path);
+    unlink(other_path);
+}
+
+static void test_main_verbosely_running_mixed_tests_in_workers(void)
+{
+    char* test_argv[] = { "a.out", "-v", "-j", "2", "-b", "3" };
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    exit_code = zt_main(6, test_argv, NULL, selftest_mixed_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "+ selftest_passing_suite\n"
+        "  - selftest_passing_check ok\n"
+        "  - selftest_passing_assert ok\n"
+        "  + selftest_empty_suite\n"
+        "+ selftest_failing_suite\n"
+        "  - selftest_failing_check failed\n"
+        "  - selftest_failing_assert failed\n"
+        "  + selftest_empty_suite\n"
+        "- selftest_case_bogus_outcome outcome code 42 (?)\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+/* Worker processes execute many test cases, this counter is not reset in between. */
+static int selftest_worker_counter;
+
+static void selftest_worker_first(zt_t t)
+{
+    selftest_worker_counter++;
+    zt_check(t, ZT_CMP_INT(selftest_worker_counter, ==, 1));
+}
+
+static void selftest_worker_second(zt_t t)
+{
+    selftest_worker_counter++;
+    zt_check(t, ZT_CMP_INT(selftest_worker_counter, ==, 2));
+}
+
+static void selftest_worker_crashing_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_worker_first);
+    ZT_VISIT_TEST_CASE(v, selftest_worker_second);
+    ZT_VISIT_TEST_CASE(v, selftest_crashing_case);
+    /* The worker that crashed was replaced by a new one. */
+    ZT_VISIT_TEST_CASE(v, selftest_worker_first);
+    ZT_VISIT_TEST_CASE(v, selftest_worker_second);
+    ZT_VISIT_TEST_CASE(v, selftest_crashing_case);
+    ZT_VISIT_TEST_CASE(v, selftest_crashing_case);
+    ZT_VISIT_TEST_CASE(v, selftest_worker_first);
+}
+
+static void test_main_running_crashing_tests_in_workers(void)
+{
+    char* test_argv[] = { "a.out", "-v", "-j", "1", "-b", "100" };
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    selftest_worker_counter = 0;
+    exit_code = zt_main(6, test_argv, NULL, selftest_worker_crashing_suite);
+    assert(exit_code == EXIT_FAILURE);
+    assert(selftest_worker_counter == 0);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_worker_first ok\n"
+        "- selftest_worker_second ok\n"
+        "- selftest_crashing_case failed\n"
+        "- selftest_worker_first ok\n"
+        "- selftest_worker_second ok\n"
+        "- selftest_crashing_case failed\n"
+        "- selftest_crashing_case failed\n"
+        "- selftest_worker_first ok\n");
+    selftest_stream_eq(
+        zt_mock_stderr,
+        "test case selftest_crashing_case killed by signal 9\n"
+        "test case selftest_crashing_case killed by signal 9\n"
+        "test case selftest_crashing_case killed by signal 9\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void selftest_noisy_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_SUITE(v, selftest_mixed_suite);
+    ZT_VISIT_TEST_SUITE(v, selftest_thread_safe_suite);
+    ZT_VISIT_TEST_SUITE(v, selftest_suites_with_setup);
+    ZT_VISIT_TEST_SUITE(v, selftest_mixed_suite);
+}
+
+/**
+ * selftest_run_main_combined runs zt_main with stdout and stderr sent to one stream.
+ *
+ * The combined output of both streams is stored in the given buffer.
+ **/
+static int selftest_run_main_combined(int argc, char** argv, zt_test_suite_func tsuite,
+    char* buf, size_t size)
+{
+    int exit_code;
+    size_t n;
+
+    zt_mock_stdout = zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(argc, argv, NULL, tsuite);
+    fseek(zt_mock_stdout, 0, SEEK_SET);
+    n = fread(buf, 1, size - 1, zt_mock_stdout);
+    assert(n < size - 1);
+    buf[n] = '\0';
+    fclose(zt_mock_stdout);
+    zt_mock_stdout = zt_mock_stderr = NULL;
+    return exit_code;
+}
+
+/**
+ * selftest_run_main_sharing_file runs zt_main with stdout and stderr writing to one file.
+ *
+ * Unlike in selftest_run_main_combined the streams are distinct. Like the
+ * standard streams, standard output is buffered and standard error is not.
+ **/
+static int selftest_run_main_sharing_file(int argc, char** argv, zt_test_suite_func tsuite,
+    char* buf, size_t size)
+{
+    int exit_code;
+    size_t n;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = fdopen(dup(fileno(zt_mock_stdout)), "w");
+    assert(zt_mock_stderr != NULL);
+    setvbuf(zt_mock_stderr, NULL, _IONBF, 0);
+    exit_code = zt_main(argc, argv, NULL, tsuite);
+    fclose(zt_mock_stderr);
+    fflush(zt_mock_stdout);
+    fseek(zt_mock_stdout, 0, SEEK_SET);
+    n = fread(buf, 1, size - 1, zt_mock_stdout);
+    assert(n < size - 1);
+    buf[n] = '\0';
+    fclose(zt_mock_stdout);
+    zt_mock_stdout = zt_mock_stderr = NULL;
+    return exit_code;
+}
+
+static void test_main_parallel_output_is_ordered(void)
+{
+    char* argv_serial[] = { "a.out", "-v" };
+    char* argv_jobs[] = { "a.out", "-v", "-j", "4" };
+    char* argv_threads[] = { "a.out", "-v", "-t", "3", "-j", "2" };
+    char* argv_workers[] = { "a.out", "-v", "-j", "3", "-b", "2" };
+    static char expected[8192];
+    static char actual[8192];
+
+    assert(selftest_run_main_combined(2, argv_serial, selftest_noisy_suite, expected, sizeof expected) == EXIT_FAILURE);
+    assert(strstr(expected, "assertion failed because 0 is false") != NULL);
+
+    /* Messages of test cases are reported together with their outcome. */
+    assert(selftest_run_main_combined(4, argv_jobs, selftest_noisy_suite, actual, sizeof actual) == EXIT_FAILURE);
+    assert(strcmp(actual, expected) == 0);
+    assert(selftest_run_main_combined(6, argv_threads, selftest_noisy_suite, actual, sizeof actual) == EXIT_FAILURE);
+    assert(strcmp(actual, expected) == 0);
+    assert(selftest_run_main_combined(6, argv_workers, selftest_noisy_suite, actual, sizeof actual) == EXIT_FAILURE);
+    assert(strcmp(actual, expected) == 0);
+
+    /* Standard output is flushed before anything is written to standard error. */
+    assert(selftest_run_main_sharing_file(2, argv_serial, selftest_noisy_suite, actual, sizeof actual) == EXIT_FAILURE);
+    assert(strcmp(actual, expected) == 0);
+    assert(selftest_run_main_sharing_file(4, argv_jobs, selftest_noisy_suite, actual, sizeof actual) == EXIT_FAILURE);
+    assert(strcmp(actual, expected) == 0);
+}
+
+static void test_output_queue(void)
+{
+    zt_output_queue queue;
+    zt_buffer buf;
+    FILE* stream_out = selftest_temporary_file();
+    FILE* stream_err = selftest_temporary_file();
+    int i;
+
+    memset(&buf, 0, sizeof buf);
+    fputs("buffered ", stream_out);
+    assert(zt_output_queue_start(&queue, stream_out, stream_err));
+    for (i = 0; i < 3; i++) {
+        assert(zt_buffer_printf(&buf, "out %d, ", i));
+        zt_output_queue_put(&queue, stream_out, &buf);
+        assert(buf.len == 0);
+        assert(zt_buffer_printf(&buf, "err %d, ", i));
+        zt_output_queue_put(&queue, stream_err, &buf);
+    }
+    zt_output_queue_stop(&queue);
+    selftest_stream_eq(stream_out, "buffered out 0, out 1, out 2, ");
+    selftest_stream_eq(stream_err, "err 0, err 1, err 2, ");
+    fclose(stream_out);
+    fclose(stream_err);
+}
+
+static void test_resource_pool(void)
+{
+    zt_resource_pool pool;
+    zt_test_table table;
+
+    memset(&table, 0, sizeof table);
+    assert(zt_resource_pool_init(&pool, "memory=8,port=2", &table));
+    assert(pool.len == 2);
+    /* Resources are shared up to their capacity. */
+    assert(zt_resource_pool_fits(&pool, "memory=4"));
+    zt_resource_pool_update(&pool, "memory=4", 1);
+    assert(zt_resource_pool_fits(&pool, "memory=4,port"));
+    zt_resource_pool_update(&pool, "memory=4,port", 1);
+    assert(!zt_resource_pool_fits(&pool, "memory=1"));
+    assert(zt_resource_pool_fits(&pool, "port"));
+    assert(zt_resource_pool_fits(&pool, NULL));
+    /* Exclusive test cases wait until nothing runs. */
+    assert(!zt_resource_pool_fits(&pool, "exclusive"));
+    zt_resource_pool_update(&pool, "memory=4", -1);
+    zt_resource_pool_update(&pool, "memory=4,port", -1);
+    assert(pool.running == 0);
+    /* Test cases needing more than the capacity run when the resource is unused. */
+    assert(zt_resource_pool_fits(&pool, "memory=16"));
+    zt_resource_pool_update(&pool, "memory=16", 1);
+    assert(!zt_resource_pool_fits(&pool, "memory=1"));
+    zt_resource_pool_update(&pool, "memory=16", -1);
+    assert(zt_resource_pool_fits(&pool, "exclusive"));
+    zt_resource_pool_update(&pool, "exclusive", 1);
+    assert(!zt_resource_pool_fits(&pool, NULL));
+    zt_resource_pool_update(&pool, "exclusive", -1);
+    assert(zt_resource_pool_fits(&pool, NULL));
+    zt_resource_pool_free(&pool);
+}
+
+/* File where test cases in child processes log when they start and finish. */
+static char selftest_resource_log[PATH_MAX];
+
+static void selftest_log_resource_use(char start, char finish)
+{
+    struct timespec delay;
+    int fd = open(selftest_resource_log, O_WRONLY | O_APPEND);
+
+    assert(fd >= 0);
+    assert(write(fd, &start, 1) == 1);
+    delay.tv_sec = 0;
+    delay.tv_nsec = 20 * 1000 * 1000;
+    nanosleep(&delay, NULL);
+    assert(write(fd, &finish, 1) == 1);
+    close(fd);
+}
+
+static void selftest_exclusive_case(ZT_UNUSED zt_t t)
+{
+    selftest_log_resource_use('E', 'e');
+}
+
+static void selftest_port_case(ZT_UNUSED zt_t t)
+{
+    selftest_log_resource_use('P', 'p');
+}
+
+static void selftest_unconstrained_case(ZT_UNUSED zt_t t)
+{
+    selftest_log_resource_use('U', 'u');
+}
+
+static void selftest_resource_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_unconstrained_case);
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_port_case, "port");
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_port_case, "port,memory=2");
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_exclusive_case, "exclusive");
+    ZT_VISIT_TEST_CASE(v, selftest_unconstrained_case);
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_port_case, "port");
+    ZT_VISIT_TEST_CASE(v, selftest_unconstrained_case);
+}
+
+/** selftest_check_resource_log checks that resources were never oversubscribed. */
+static void selftest_check_resource_log(void)
+{
+    FILE* log = fopen(selftest_resource_log, "r");
+    int running = 0;
+    int ports = 0;
+    int exclusive = 0;
+    int max_running = 0;
+    int num_finished = 0;
+    int c;
+
+    assert(log != NULL);
+    while ((c = fgetc(log)) != EOF) {
+        if (isupper(c)) {
+            assert(exclusive == 0);
+            running++;
+        } else {
+            running--;
+            num_finished++;
+        }
+        switch (c) {
+        case 'E':
+            assert(running == 1);
+            exclusive++;
+            break;
+        case 'e':
+            exclusive--;
+            break;
+        case 'P':
+            assert(ports == 0);
+            ports++;
+            break;
+        case 'p':
+            ports--;
+            break;
+        default:
+            break;
+        }
+        if (running > max_running) {
+            max_running = running;
+        }
+    }
+    fclose(log);
+    assert(num_finished == 7);
+    /* Unconstrained test cases still run next to the others. */
+    assert(max_running > 1);
+}
+
+static void test_main_running_tests_with_resources_in_parallel(void)
+{
+    char* argv_jobs[] = { "a.out", "-j", "4" };
+    char* argv_workers[] = { "a.out", "-j", "4", "-b", "2", "-R", "port=1" };
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    selftest_temporary_path(selftest_resource_log, sizeof selftest_resource_log);
+    exit_code = zt_main(3, argv_jobs, NULL, selftest_resource_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_check_resource_log();
+    unlink(selftest_resource_log);
+
+    selftest_temporary_path(selftest_resource_log, sizeof selftest_resource_log);
+    exit_code = zt_main(7, argv_workers, NULL, selftest_resource_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_check_resource_log();
+    unlink(selftest_resource_log);
+
+    selftest_stream_eq(zt_mock_stdout, "");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void selftest_thread_safe_fail_fast_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE_MT(v, selftest_passing_check);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_case_failed);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_passing_assert);
+}
+
+static void selftest_sleeping_case(ZT_UNUSED zt_t t)
+{
+    sleep(30);
+}
+
+static void selftest_sleeping_fail_fast_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_sleeping_case);
+    ZT_VISIT_TEST_CASE(v, selftest_case_failed);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+}
+
+static void test_main_failing_fast_in_parallel(void)
+{
+    char* argv_threads[] = { "a.out", "-v", "--fail-fast", "-t", "1" };
+    char* argv_jobs[] = { "a.out", "-v", "--fail-fast", "-j", "2" };
+    char* argv_workers[] = { "a.out", "-v", "--fail-fast", "-j", "2", "-b", "1" };
+    time_t start;
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    /* The only thread takes work from the bottom of its queue. */
+    exit_code = zt_main(5, argv_threads, NULL, selftest_thread_safe_fail_fast_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_check not executed\n"
+        "- selftest_case_failed failed\n"
+        "- selftest_passing_assert ok\n");
+    selftest_stream_eq(zt_mock_stderr, "test cases not executed because of --fail-fast: 1\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* Test cases in flight are killed instead of running to completion. */
+    start = time(NULL);
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(5, argv_jobs, NULL, selftest_sleeping_fail_fast_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_sleeping_case not executed\n"
+        "- selftest_case_failed failed\n"
+        "- selftest_passing_check not executed\n");
+    selftest_stream_eq(zt_mock_stderr, "test cases not executed because of --fail-fast: 2\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(7, argv_workers, NULL, selftest_sleeping_fail_fast_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_sleeping_case not executed\n"
+        "- selftest_case_failed failed\n"
+        "- selftest_passing_check not executed\n");
+    selftest_stream_eq(zt_mock_stderr, "test cases not executed because of --fail-fast: 2\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+    assert(time(NULL) - start < 10);
+}
+#endif
+
+#ifdef ZT_HAVE_AFFINITY
+static void test_cpu_list_parse(void)
+{
+    cpu_set_t set;
+
+    assert(zt_cpu_list_parse("0-3,8", &set));
+    assert(CPU_COUNT(&set) == 5);
+    assert(CPU_ISSET(0, &set) && CPU_ISSET(3, &set) && CPU_ISSET(8, &set));
+    assert(!CPU_ISSET(4, &set));
+    assert(zt_cpu_list_parse("7", &set));
+    assert(CPU_COUNT(&set) == 1);
+    assert(zt_cpu_list_parse("all", &set));
+    assert(CPU_COUNT(&set) == CPU_SETSIZE);
+    assert(!zt_cpu_list_parse("", &set));
+    assert(!zt_cpu_list_parse("3-1", &set));
+    assert(!zt_cpu_list_parse("0-", &set));
+    assert(!zt_cpu_list_parse("1,", &set));
+    assert(!zt_cpu_list_parse(",1", &set));
+    assert(!zt_cpu_list_parse("cpu0", &set));
+    assert(!zt_cpu_list_parse("99999", &set));
+}
+
+/** selftest_write_cpu_topology describes a CPU in a sysfs-like tree. */
+static void selftest_write_cpu_topology(const char* root, int cpu, int package, int core)
+{
+    char path[PATH_MAX];
+    FILE* file;
+
+    snprintf(path, sizeof path, "%s/cpu%d", root, cpu);
+    assert(mkdir(path, 0700) == 0);
+    snprintf(path, sizeof path, "%s/cpu%d/topology", root, cpu);
+    assert(mkdir(path, 0700) == 0);
+    snprintf(path, sizeof path, "%s/cpu%d/topology/physical_package_id", root, cpu);
+    file = fopen(path, "w");
+    assert(file != NULL);
+    fprintf(file, "%d\n", package);
+    fclose(file);
+    snprintf(path, sizeof path, "%s/cpu%d/topology/core_id", root, cpu);
+    file = fopen(path, "w");
+    assert(file != NULL);
+    fprintf(file, "%d\n", core);
+    fclose(file);
+}
+
+static void selftest_remove_cpu_topology(const char* root, int cpu)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof path, "%s/cpu%d/topology/physical_package_id", root, cpu);
+    unlink(path);
+    snprintf(path, sizeof path, "%s/cpu%d/topology/core_id", root, cpu);
+    unlink(path);
+    snprintf(path, sizeof path, "%s/cpu%d/topology", root, cpu);
+    rmdir(path);
+    snprintf(path, sizeof path, "%s/cpu%d", root, cpu);
+    rmdir(path);
+}
+
+static void test_cpu_topology_read(void)
+{
+    char root[256];
+    const char* tmp_dir_name = getenv("TMPDIR");
+    zt_cpu_topology topo;
+    cpu_set_t selected;
+    int cpu;
+
+    snprintf(root, sizeof root, "%s/zt-test-XXXXXX", tmp_dir_name != NULL ? tmp_dir_name : "/tmp");
+    assert(mkdtemp(root) != NULL);
+    /* Two packages, CPUs 0 and 4 are SMT siblings, CPU 5 has no topology. */
+    selftest_write_cpu_topology(root, 0, 0, 0);
+    selftest_write_cpu_topology(root, 1, 0, 1);
+    selftest_write_cpu_topology(root, 2, 1, 0);
+    selftest_write_cpu_topology(root, 3, 1, 1);
+    selftest_write_cpu_topology(root, 4, 0, 0);
+    assert(zt_cpu_list_parse("0-5", &selected));
+
+    /* Cores of the first package come first, SMT siblings come last. */
+    assert(zt_cpu_topology_read(&topo, root, &selected, false));
+    assert(topo.len == 6);
+    assert(topo.cpus[0].id == 0);
+    assert(topo.cpus[1].id == 1);
+    assert(topo.cpus[2].id == 5);
+    assert(topo.cpus[3].id == 2);
+    assert(topo.cpus[4].id == 3);
+    assert(topo.cpus[5].id == 4);
+    assert(topo.cpus[5].thread == 1);
+    zt_cpu_topology_free(&topo);
+
+    assert(zt_cpu_topology_read(&topo, root, &selected, true));
+    assert(topo.len == 5);
+    assert(topo.cpus[4].id == 3);
+    zt_cpu_topology_free(&topo);
+
+    CPU_ZERO(&selected);
+    assert(!zt_cpu_topology_read(&topo, root, &selected, false));
+    zt_cpu_topology_free(&topo);
+
+    for (cpu = 0; cpu < 5; cpu++) {
+        selftest_remove_cpu_topology(root, cpu);
+    }
+    assert(rmdir(root) == 0);
+}
+
+static void test_parse_cpu_options(void)
+{
+    char* argv_cpus[] = { "a.out", "--cpus", "0-3", "--no-smt" };
+    char* argv_joined[] = { "a.out", "--cpus=all" };
+    char* argv_missing[] = { "a.out", "--cpus" };
+    char* argv_garbage[] = { "a.out", "--cpus=0-" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_cpus, NULL));
+    assert(opts.cpus == NULL);
+    assert(opts.no_smt == false);
+    assert(zt_parse_options(&opts, 4, argv_cpus, NULL));
+    assert(strcmp(opts.cpus, "0-3") == 0);
+    assert(opts.no_smt == true);
+    assert(zt_parse_options(&opts, 2, argv_joined, NULL));
+    assert(strcmp(opts.cpus, "all") == 0);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 2, argv_missing, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_garbage, stream_err));
+    selftest_stream_eq(stream_err,
+        "option --cpus requires a list of CPUs, like 0-3,8, or all\n"
+        "option --cpus requires a list of CPUs, like 0-3,8, or all\n");
+    fclose(stream_err);
+}
+
+static void selftest_pinned_case(zt_t t)
+{
+    cpu_set_t set;
+    zt_assert(t, ZT_CMP_INT(sched_getaffinity(0, sizeof set, &set), ==, 0));
+    zt_check(t, ZT_CMP_INT(CPU_COUNT(&set), ==, 1));
+}
+
+static void selftest_pinned_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_pinned_case);
+    ZT_VISIT_TEST_CASE(v, selftest_pinned_case);
+}
+
+static void test_main_pinning_test_processes(void)
+{
+    char cpus[16];
+    char expected[128];
+    char* argv_jobs[] = { "a.out", "-v", "-j", "2", "--cpus", NULL };
+    char* argv_workers[] = { "a.out", "-v", "-j", "2", "-b", "1", "--cpus", NULL };
+    cpu_set_t allowed;
+    int cpu;
+
+    assert(sched_getaffinity(0, sizeof allowed, &allowed) == 0);
+    for (cpu = 0; !CPU_ISSET((size_t)cpu, &allowed); cpu++) {
+    }
+    snprintf(cpus, sizeof cpus, "%d", cpu);
+    argv_jobs[5] = cpus;
+    argv_workers[7] = cpus;
+    snprintf(expected, sizeof expected,
+        "- selftest_pinned_case (cpu %d) ok\n"
+        "- selftest_pinned_case (cpu %d) ok\n",
+        cpu, cpu);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    assert(zt_main(6, argv_jobs, NULL, selftest_pinned_suite) == EXIT_SUCCESS);
+    selftest_stream_eq(zt_mock_stdout, expected);
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    assert(zt_main(8, argv_workers, NULL, selftest_pinned_suite) == EXIT_SUCCESS);
+    selftest_stream_eq(zt_mock_stdout, expected);
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+#endif
+
+static void test_shard_by_path_hash(void)
+{
+    zt_test_table tables[3];
+    size_t i;
+    int shard;
+
+    for (shard = 0; shard < 3; shard++) {
+        memset(&tables[shard], 0, sizeof tables[shard]);
+        assert(zt_collect_tests_from(&tables[shard], selftest_mixed_suite, NULL));
+        assert(zt_test_table_shard(&tables[shard], shard, 3));
+    }
+    /* Each test case is assigned to exactly one shard, suites to none. */
+    for (i = 0; i < tables[0].len; i++) {
+        int num_selected = 0;
+        for (shard = 0; shard < 3; shard++) {
+            const zt_test_entry* entry = &tables[shard].entries[i];
+            if (entry->kind != ZT_ENTRY_CASE) {
+                assert(!entry->excluded);
+            } else if (!entry->excluded) {
+                assert(entry->path_hash % 3 == (uint64_t)shard);
+                num_selected++;
+            }
+        }
+        assert(tables[0].entries[i].kind != ZT_ENTRY_CASE || num_selected == 1);
+    }
+    for (shard = 0; shard < 3; shard++) {
+        zt_test_table_free(&tables[shard]);
+    }
+}
+
+static void test_main_running_single_shard(void)
+{
+    char* test_argv[] = { "a.out", "-v", "--shard", "1/1" };
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+
+    /* A single shard executes all the test cases. */
+    exit_code = zt_main(4, test_argv, NULL, selftest_passing_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_check ok\n"
+        "- selftest_passing_assert ok\n"
+        "+ selftest_empty_suite\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void test_resources_valid(void)
+{
+    assert(zt_resources_valid(NULL, true));
+    assert(zt_resources_valid("", true));
+    assert(zt_resources_valid("port", true));
+    assert(zt_resources_valid("memory=8,port", true));
+    assert(zt_resources_valid("gpu.0=1,net-ns,big_disk", true));
+    assert(zt_resources_valid("exclusive", true));
+    assert(zt_resources_valid("exclusive,port=2", true));
+    assert(!zt_resources_valid("exclusive", false));
+    assert(!zt_resources_valid("exclusive=2", true));
+    assert(zt_resources_valid("timeout=5,port", true));
+    assert(!zt_resources_valid("timeout=5", false));
+    assert(!zt_resources_valid("timeout", true));
+    assert(!zt_resources_valid(",", true));
+    assert(!zt_resources_valid("port,", true));
+    assert(!zt_resources_valid(",port", true));
+    assert(!zt_resources_valid("port,,memory", true));
+    assert(!zt_resources_valid("memory=", true));
+    assert(!zt_resources_valid("memory=0", true));
+    assert(!zt_resources_valid("memory=-1", true));
+    assert(!zt_resources_valid("memory=8GB", true));
+    assert(!zt_resources_valid("memory=99999999999", true));
+    assert(!zt_resources_valid("memory 8", true));
+}
+
+static void test_parse_resource_options(void)
+{
+    char* argv_joined[] = { "a.out", "-Rmemory=16,port" };
+    char* argv_separate[] = { "a.out", "-R", "memory=16" };
+    char* argv_missing[] = { "a.out", "-R" };
+    char* argv_exclusive[] = { "a.out", "-R", "exclusive" };
+    char* argv_garbage[] = { "a.out", "-R", "memory=" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_joined, NULL));
+    assert(opts.resources == NULL);
+    assert(zt_parse_options(&opts, 2, argv_joined, NULL));
+    assert(strcmp(opts.resources, "memory=16,port") == 0);
+    assert(zt_parse_options(&opts, 3, argv_separate, NULL));
+    assert(strcmp(opts.resources, "memory=16") == 0);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 2, argv_missing, stream_err));
+    assert(!zt_parse_options(&opts, 3, argv_exclusive, stream_err));
+    assert(!zt_parse_options(&opts, 3, argv_garbage, stream_err));
+    selftest_stream_eq(stream_err,
+        "option -R requires a list of resource capacities NAME=N\n"
+        "option -R requires a list of resource capacities NAME=N\n"
+        "option -R requires a list of resource capacities NAME=N\n");
+    fclose(stream_err);
+}
+
+static void selftest_suite_with_resources(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_passing_check, "memory=8,port");
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_passing_assert, "memory=lots");
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_passing_check, "exclusive");
+}
+
+static void test_collect_tests_with_resources(void)
+{
+    zt_test_table table;
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_suite_with_resources, NULL));
+    assert(table.len == 3);
+    assert(strcmp(table.entries[0].resources, "memory=8,port") == 0);
+    assert(table.entries[0].done == false);
+    /* Invalid resources fail the test case without executing it. */
+    assert(table.entries[1].resources == NULL);
+    assert(table.entries[1].done == true);
+    assert(table.entries[1].outcome == ZT_FAILED);
+    assert(strcmp(table.entries[2].resources, "exclusive") == 0);
+    zt_test_table_free(&table);
+}
+
+static void test_main_verbosely_running_tests_with_resources(void)
+{
+    char* argv_serial[] = { "a.out", "-v" };
+    char* argv_parallel[] = { "a.out", "-v", "-j", "2", "-R", "memory=4" };
+    char* argv_listing[] = { "a.out", "-l" };
+    int i;
+
+    /* Serial and parallel runs report invalid resources in the same way. */
+    for (i = 0; i < 2; i++) {
+        int exit_code;
+
+        zt_mock_stdout = selftest_temporary_file();
+        zt_mock_stderr = selftest_temporary_file();
+        exit_code = i == 0
+            ? zt_main(2, argv_serial, NULL, selftest_suite_with_resources)
+            : zt_main(6, argv_parallel, NULL, selftest_suite_with_resources);
+        assert(exit_code == EXIT_FAILURE);
+        selftest_stream_eq(
+            zt_mock_stdout,
+            "- selftest_passing_check ok\n"
+            "- selftest_passing_assert failed\n"
+            "- selftest_passing_check ok\n");
+        selftest_stream_eq(zt_mock_stderr,
+            "test case selftest_passing_assert has invalid resources: memory=lots\n");
+        fclose(zt_mock_stdout);
+        fclose(zt_mock_stderr);
+    }
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    assert(zt_main(2, argv_listing, NULL, selftest_suite_with_resources) == EXIT_SUCCESS);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_check\n"
+        "- selftest_passing_assert\n"
+        "- selftest_passing_check\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void selftest_suite_with_runtime_names(zt_visitor v)
+{
+    char name[16];
+    char resources[16];
+    int i;
+
+    /* Names and resources are built in buffers reused for each test case. */
+    for (i = 0; i < 3; i++) {
+        snprintf(name, sizeof name, "case_%d", i);
+        snprintf(resources, sizeof resources, "memory=%d", i + 1);
+        zt_visit_test_case_with(v, selftest_passing_check, name, resources);
+    }
+}
+
+static void test_main_running_tests_with_runtime_names(void)
+{
+    char* argv_serial[] = { "a.out", "-v" };
+    char* argv_parallel[] = { "a.out", "-v", "-j", "2" };
+    zt_test_table table;
+    int i;
+
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_suite_with_runtime_names, NULL));
+    assert(table.len == 3);
+    assert(strcmp(table.entries[0].name, "case_0") == 0);
+    assert(strcmp(table.entries[0].resources, "memory=1") == 0);
+    assert(strcmp(table.entries[2].name, "case_2") == 0);
+    assert(strcmp(table.entries[2].resources, "memory=3") == 0);
+    zt_test_table_free(&table);
+
+    for (i = 0; i < 2; i++) {
+        int exit_code;
+
+        zt_mock_stdout = selftest_temporary_file();
+        zt_mock_stderr = selftest_temporary_file();
+        exit_code = i == 0
+            ? zt_main(2, argv_serial, NULL, selftest_suite_with_runtime_names)
+            : zt_main(4, argv_parallel, NULL, selftest_suite_with_runtime_names);
+        assert(exit_code == EXIT_SUCCESS);
+        selftest_stream_eq(
+            zt_mock_stdout,
+            "- case_0 ok\n"
+            "- case_1 ok\n"
+            "- case_2 ok\n");
+        selftest_stream_eq(zt_mock_stderr, "");
+        fclose(zt_mock_stdout);
+        fclose(zt_mock_stderr);
+    }
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void test_parse_fail_fast_options(void)
+{
+    char* argv_default[] = { "a.out", "--fail-fast" };
+    char* argv_count[] = { "a.out", "--fail-fast=3" };
+    char* argv_zero[] = { "a.out", "--fail-fast=0" };
+    char* argv_garbage[] = { "a.out", "--fail-fast=x" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_default, NULL));
+    assert(opts.max_failures == 0);
+    assert(zt_parse_options(&opts, 2, argv_default, NULL));
+    assert(opts.max_failures == 1);
+    assert(zt_parse_options(&opts, 2, argv_count, NULL));
+    assert(opts.max_failures == 3);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 2, argv_zero, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_garbage, stream_err));
+    selftest_stream_eq(stream_err,
+        "option --fail-fast requires a positive number of failures\n"
+        "option --fail-fast requires a positive number of failures\n");
+    fclose(stream_err);
+}
+
+static void selftest_fail_fast_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+    ZT_VISIT_TEST_CASE(v, selftest_case_failed);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+    ZT_VISIT_TEST_CASE(v, selftest_case_failed);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+}
+
+static void test_main_failing_fast(void)
+{
+    char* argv_serial[] = { "a.out", "-v", "--fail-fast" };
+    char* argv_jobs[] = { "a.out", "-v", "--fail-fast", "-j", "1" };
+    char* argv_workers[] = { "a.out", "-v", "--fail-fast=2", "-j", "1", "-b", "2" };
+    int exit_code;
+
+    /* Serial and parallel runs stop after the same failure. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_serial, NULL, selftest_fail_fast_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_check ok\n"
+        "- selftest_case_failed failed\n"
+        "- selftest_passing_assert not executed\n"
+        "- selftest_case_failed not executed\n"
+        "- selftest_passing_check not executed\n");
+    selftest_stream_eq(zt_mock_stderr, "test cases not executed because of --fail-fast: 3\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(5, argv_jobs, NULL, selftest_fail_fast_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_check ok\n"
+        "- selftest_case_failed failed\n"
+        "- selftest_passing_assert not executed\n"
+        "- selftest_case_failed not executed\n"
+        "- selftest_passing_check not executed\n");
+    selftest_stream_eq(zt_mock_stderr, "test cases not executed because of --fail-fast: 3\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(7, argv_workers, NULL, selftest_fail_fast_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_check ok\n"
+        "- selftest_case_failed failed\n"
+        "- selftest_passing_assert ok\n"
+        "- selftest_case_failed failed\n"
+        "- selftest_passing_check not executed\n");
+    selftest_stream_eq(zt_mock_stderr, "test cases not executed because of --fail-fast: 1\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void test_glob_match(void)
+{
+    const char* s = "suite/nested/case_1";
+    const char* end = s + strlen(s);
+
+    assert(zt_glob_match("suite/nested/case_1", s, end, false));
+    assert(!zt_glob_match("suite/nested/case_", s, end, false));
+    assert(!zt_glob_match("suite/nested/case_12", s, end, false));
+    assert(zt_glob_match("suite/*/case_?", s, end, false));
+    assert(zt_glob_match("*/*/*", s, end, false));
+    assert(!zt_glob_match("*/case_1", s, end, false));
+    assert(!zt_glob_match("suite/?nested/case_1", s, end, false));
+    assert(zt_glob_match("**case_1", s, end, false));
+    assert(zt_glob_match("suite/**", s, end, false));
+    assert(zt_glob_match("suite/nested/case_[0-9]", s, end, false));
+    assert(zt_glob_match("suite/nested/case_[!a-z]", s, end, false));
+    assert(!zt_glob_match("suite/nested/case_[^0-9]", s, end, false));
+    assert(!zt_glob_match("suite[/]nested/case_1", s, end, false));
+    assert(zt_glob_match("\\suite/nested/case\\_1", s, end, false));
+    assert(!zt_glob_match("suite/nested/case\\?", s, end, false));
+    /* An unterminated bracket expression is taken literally. */
+    s = "case_[1";
+    assert(zt_glob_match("case_[1", s, s + strlen(s), false));
+    s = "suite/nested/case_1";
+
+    /* In prefix mode, the string may end before the pattern. */
+    assert(zt_glob_match("suite/nested/case_1", s, s + 6, true));
+    assert(zt_glob_match("*/nested/*", s, s + 6, true));
+    assert(!zt_glob_match("*/other/*", s, s + 13, true));
+    assert(!zt_glob_match("*case_1", s, s + 6, true));
+    assert(zt_glob_match("**case_1", s, s + 6, true));
+}
+
+static bool selftest_pruned_suite_visited;
+static void selftest_pruned_suite(zt_visitor v)
+{
+    selftest_pruned_suite_visited = true;
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+}
+
+static void selftest_filtered_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_passing_assert);
+    ZT_VISIT_TEST_SUITE(v, selftest_passing_suite);
+    ZT_VISIT_TEST_SUITE(v, selftest_pruned_suite);
+}
+
+static void test_main_filtering_tests(void)
+{
+    char* argv_list[] = { "a.out", "-l", "-r", "selftest_passing_suite" };
+    char* argv_case[] = { "a.out", "-v", "-r", "*_assert" };
+    char* argv_deep[] = { "a.out", "-v", "-r**_check" };
+    char* argv_jobs[] = { "a.out", "-v", "-r", "selftest_passing_suite/*", "-j", "2" };
+    char* argv_none[] = { "a.out", "-r" };
+    int exit_code;
+
+    /* A matching suite selects all of its test cases. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    selftest_pruned_suite_visited = false;
+    exit_code = zt_main(4, argv_list, NULL, selftest_filtered_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    assert(!selftest_pruned_suite_visited);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_suite\n"
+        "  - selftest_passing_check\n"
+        "  - selftest_passing_assert\n"
+        "  - selftest_empty_suite\n");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* A single star does not cross into nested suites. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    selftest_pruned_suite_visited = false;
+    exit_code = zt_main(4, argv_case, NULL, selftest_filtered_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    assert(!selftest_pruned_suite_visited);
+    selftest_stream_eq(zt_mock_stdout, "- selftest_passing_assert ok\n");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* A double star does. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    selftest_pruned_suite_visited = false;
+    exit_code = zt_main(3, argv_deep, NULL, selftest_filtered_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    assert(selftest_pruned_suite_visited);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_passing_check ok\n"
+        "+ selftest_passing_suite\n"
+        "  - selftest_passing_check ok\n"
+        "  + selftest_empty_suite\n"
+        "+ selftest_pruned_suite\n"
+        "  - selftest_passing_check ok\n");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* Test cases are selected when collected for parallel runs. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    selftest_pruned_suite_visited = false;
+    exit_code = zt_main(6, argv_jobs, NULL, selftest_filtered_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    assert(!selftest_pruned_suite_visited);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "+ selftest_passing_suite\n"
+        "  - selftest_passing_check ok\n"
+        "  - selftest_passing_assert ok\n"
+        "  + selftest_empty_suite\n");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(2, argv_none, NULL, selftest_filtered_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(zt_mock_stdout, "");
+    selftest_stream_eq(zt_mock_stderr, "option -r requires a pattern\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static int selftest_setup_suite_value;
+static void selftest_setup_suite_one(zt_t t)
+{
+    (void)t;
+    selftest_setup_suite_value = 1;
+}
+
+static void selftest_setup_suite_two(zt_t t)
+{
+    (void)t;
+    selftest_setup_suite_value = 2;
+}
+
+static void selftest_case_seeing_suite_one(zt_t t)
+{
+    zt_check(t, ZT_CMP_INT(selftest_setup_suite_value, ==, 1));
+}
+
+static void selftest_case_seeing_suite_two(zt_t t)
+{
+    zt_check(t, ZT_CMP_INT(selftest_setup_suite_value, ==, 2));
+}
+
+static void selftest_setup_suite_one_suite(zt_visitor v)
+{
+    ZT_VISIT_SUITE_SETUP(v, selftest_setup_suite_one);
+    ZT_VISIT_TEST_CASE(v, selftest_case_seeing_suite_one);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_case_seeing_suite_one);
+}
+
+static void selftest_setup_suite_two_suite(zt_visitor v)
+{
+    ZT_VISIT_SUITE_SETUP(v, selftest_setup_suite_two);
+    ZT_VISIT_TEST_CASE(v, selftest_case_seeing_suite_two);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_case_seeing_suite_two);
+}
+
+static void selftest_setup_suites(zt_visitor v)
+{
+    ZT_VISIT_TEST_SUITE(v, selftest_setup_suite_one_suite);
+    ZT_VISIT_TEST_SUITE(v, selftest_setup_suite_two_suite);
+    ZT_VISIT_TEST_SUITE(v, selftest_setup_suite_one_suite);
+}
+
+static void selftest_main_running_setup_before_its_test_cases(int argc, char** argv)
+{
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    selftest_setup_suite_value = 0;
+    exit_code = zt_main(argc, argv, NULL, selftest_setup_suites);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(zt_mock_stdout, "");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void test_main_running_setup_before_its_test_cases(void)
+{
+    char* argv_serial[] = { "a.out" };
+    char* argv_threads[] = { "a.out", "-t", "2" };
+#ifdef ZT_HAVE_POSIX
+    char* argv_parallel[] = { "a.out", "-j", "2" };
+    char* argv_workers[] = { "a.out", "-j", "2", "-b", "2" };
+    char* argv_mixed[] = { "a.out", "-j", "2", "-t", "2" };
+#endif
+
+    /* Each test case observes the state prepared by the setup functions
+     * preceding it, even when a later suite sets up conflicting state. */
+    selftest_main_running_setup_before_its_test_cases(1, argv_serial);
+    selftest_main_running_setup_before_its_test_cases(3, argv_threads);
+#ifdef ZT_HAVE_POSIX
+    selftest_main_running_setup_before_its_test_cases(3, argv_parallel);
+    selftest_main_running_setup_before_its_test_cases(5, argv_workers);
+    selftest_main_running_setup_before_its_test_cases(5, argv_mixed);
+#endif
+}
+
+static void selftest_case_failing_check(zt_t t)
+{
+    zt_check(t, ZT_TRUE(0));
+}
+
+static void selftest_suite_with_failing_check(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_case_failing_check);
+}
+
+static void test_main_reporting_name_before_messages(void)
+{
+    char* test_argv[] = { "a.out", "-v" };
+    int exit_code;
+
+    /* Messages of serially executed test cases follow their name. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = zt_mock_stdout;
+    exit_code = zt_main(2, test_argv, NULL, selftest_suite_with_failing_check);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq_at(
+        zt_mock_stdout, __FILE__, __LINE__,
+        "- selftest_case_failing_check%s:%d: assertion failed because 0 is false\n"
+        " failed\n",
+        __FILE__, __LINE__ - 22);
+    fclose(zt_mock_stdout);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+#ifdef ZT_TEST
+static int selftest_registered_calls;
+
+ZT_TEST(selftest_registered_case)
+{
+    zt_check(t, ZT_TRUE(true));
+    selftest_registered_calls++;
+}
+
+ZT_TEST(selftest_another_registered_case)
+{
+    zt_check(t, ZT_TRUE(true));
+    selftest_registered_calls++;
+}
+
+static void selftest_suite_with_registered_tests(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+    ZT_VISIT_REGISTERED_TESTS(v);
+}
+
+static void test_collect_registered_tests(void)
+{
+    zt_test_table table;
+    zt_test_collector collector;
+
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_suite_with_registered_tests, NULL));
+    assert(table.len == 3);
+    assert(table.entries[0].func == selftest_passing_check);
+    /* Registered test cases are visited in the order of definition. */
+    assert(table.entries[1].func == selftest_registered_case);
+    assert(strcmp(table.entries[1].name, "selftest_registered_case") == 0);
+    assert(table.entries[1].kind == ZT_ENTRY_CASE);
+    assert(table.entries[1].nesting == 0);
+    assert(table.entries[2].func == selftest_another_registered_case);
+    assert(strcmp(table.entries[2].name, "selftest_another_registered_case") == 0);
+    zt_test_table_free(&table);
+
+    /* Programs without registered test cases have null bounds. */
+    memset(&table, 0, sizeof table);
+    memset(&collector, 0, sizeof collector);
+    collector.table = &table;
+    zt_visit_registered_tests(zt_visitor_from_test_collector(&collector), NULL, NULL);
+    assert(table.len == 0);
+}
+
+static void test_main_running_registered_tests(void)
+{
+    char* test_argv[] = { "a.out" };
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    selftest_registered_calls = 0;
+    exit_code = zt_main(1, test_argv, NULL, zt_registered_tests);
+    assert(exit_code == EXIT_SUCCESS);
+    assert(selftest_registered_calls == 2);
+    selftest_stream_eq(zt_mock_stdout, "");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+#endif
+
+static void test_parse_repeat_options(void)
+{
+    char* argv_repeat[] = { "a.out", "--repeat", "3", "--until-fail" };
+    char* argv_equals[] = { "a.out", "--repeat=4" };
+    char* argv_zero[] = { "a.out", "--repeat=0" };
+    char* argv_missing[] = { "a.out", "--repeat" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_repeat, NULL));
+    assert(opts.repeat == 0);
+    assert(!opts.until_fail);
+    assert(zt_parse_options(&opts, 4, argv_repeat, NULL));
+    assert(opts.repeat == 3);
+    assert(opts.until_fail);
+    assert(zt_parse_options(&opts, 2, argv_equals, NULL));
+    assert(opts.repeat == 4);
+    assert(!opts.until_fail);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 2, argv_zero, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_missing, stream_err));
+    selftest_stream_eq(stream_err,
+        "option --repeat requires a positive number of iterations\n"
+        "option --repeat requires a positive number of iterations\n");
+    fclose(stream_err);
+}
+
+static int selftest_every_third_call_calls;
+static void selftest_every_third_call_fails(zt_t t)
+{
+    if (++selftest_every_third_call_calls % 3 == 0) {
+        t->outcome = ZT_FAILED;
+    }
+}
+
+static void selftest_nested_repeated_suite(zt_visitor v)
+{
+    ZT_VISIT_SUITE_SETUP(v, selftest_passing_setup);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_every_third_call_fails);
+}
+
+static void selftest_repeated_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+    ZT_VISIT_TEST_SUITE(v, selftest_nested_repeated_suite);
+}
+
+static int selftest_after_repeated_calls;
+static void selftest_after_repeated_case(zt_t t)
+{
+    (void)t;
+    selftest_after_repeated_calls++;
+}
+
+static void selftest_until_fail_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_SUITE(v, selftest_repeated_suite);
+    ZT_VISIT_TEST_CASE(v, selftest_after_repeated_case);
+}
+
+static void test_main_repeating_tests(void)
+{
+    char* argv_repeat[] = { "a.out", "--repeat", "5" };
+    char* argv_until_fail[] = { "a.out", "-v", "--until-fail", "-t", "2" };
+    char* argv_bounded[] = { "a.out", "--until-fail", "--repeat=2" };
+    const char* passed_iteration = ""
+                                   "+ selftest_repeated_suite\n"
+                                   "  - selftest_passing_assert ok\n"
+                                   "  + selftest_nested_repeated_suite\n"
+                                   "     * selftest_passing_setup ok\n"
+                                   "     - selftest_every_third_call_fails ok\n"
+                                   "- selftest_after_repeated_case ok\n";
+    char expected[1024];
+    int exit_code;
+
+    /* All the iterations are executed, setup functions only once. */
+    selftest_every_third_call_calls = 0;
+    selftest_setup_calls = 0;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_repeat, NULL, selftest_repeated_suite);
+    assert(exit_code == EXIT_FAILURE);
+    assert(selftest_every_third_call_calls == 5);
+    assert(selftest_setup_calls == 1);
+    selftest_stream_eq(zt_mock_stdout, "");
+    selftest_stream_eq(
+        zt_mock_stderr,
+        "iterations executed: 5\n"
+        "first failure in iteration: 3\n"
+        "failure rate of selftest_nested_repeated_suite/selftest_every_third_call_fails: 1 of 5 (20.0%)\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* Repetition stops at the first failure, the rest of the iteration is not executed. */
+    selftest_every_third_call_calls = 0;
+    selftest_after_repeated_calls = 0;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(5, argv_until_fail, NULL, selftest_until_fail_suite);
+    assert(exit_code == EXIT_FAILURE);
+    assert(selftest_every_third_call_calls == 3);
+    assert(selftest_after_repeated_calls == 2);
+    snprintf(expected, sizeof expected, "%s%s"
+                                        "+ selftest_repeated_suite\n"
+                                        "  - selftest_passing_assert ok\n"
+                                        "  + selftest_nested_repeated_suite\n"
+                                        "     * selftest_passing_setup ok\n"
+                                        "     - selftest_every_third_call_fails failed\n"
+                                        "- selftest_after_repeated_case not executed\n",
+        passed_iteration, passed_iteration);
+    selftest_stream_eq(zt_mock_stdout, expected);
+    selftest_stream_eq(
+        zt_mock_stderr,
+        "iterations executed: 3\n"
+        "first failure in iteration: 3\n"
+        "failure rate of selftest_repeated_suite/selftest_nested_repeated_suite/selftest_every_third_call_fails: 1 of 3 (33.3%)\n"
+        "test cases not executed because of --until-fail: 1\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    selftest_every_third_call_calls = 0;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_bounded, NULL, selftest_repeated_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(zt_mock_stderr, "iterations executed: 2\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+static void test_parse_shuffle_options(void)
+{
+    char* argv_default[] = { "a.out", "--shuffle" };
+    char* argv_seed[] = { "a.out", "--shuffle=42" };
+    char* argv_empty[] = { "a.out", "--shuffle=" };
+    char* argv_garbage[] = { "a.out", "--shuffle=-1" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_default, NULL));
+    assert(!opts.shuffle);
+    assert(zt_parse_options(&opts, 2, argv_default, NULL));
+    assert(opts.shuffle);
+    assert(opts.seed <= 0xffffffffUL);
+    assert(zt_parse_options(&opts, 2, argv_seed, NULL));
+    assert(opts.shuffle);
+    assert(opts.seed == 42);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 2, argv_empty, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_garbage, stream_err));
+    selftest_stream_eq(stream_err,
+        "option --shuffle requires a number as the seed\n"
+        "option --shuffle requires a number as the seed\n");
+    fclose(stream_err);
+}
+
+static void selftest_nested_shuffled_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+    ZT_VISIT_SUITE_SETUP(v, selftest_passing_setup);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+}
+
+static void selftest_shuffled_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+    ZT_VISIT_TEST_SUITE(v, selftest_nested_shuffled_suite);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+}
+
+static void test_shuffle_test_table(void)
+{
+    zt_test_table table;
+    zt_test_table again;
+    bool orders[6];
+    size_t order;
+    int num_orders = 0;
+    unsigned long seed;
+    size_t i;
+
+    memset(orders, 0, sizeof orders);
+    for (seed = 0; seed < 100; seed++) {
+        size_t nested = 0;
+        size_t top = 0;
+        size_t top_pos[2] = { 0, 0 };
+        memset(&table, 0, sizeof table);
+        memset(&again, 0, sizeof again);
+        assert(zt_collect_tests_from(&table, selftest_shuffled_suite, NULL));
+        assert(zt_collect_tests_from(&again, selftest_shuffled_suite, NULL));
+        assert(zt_test_table_shuffle(&table, seed));
+        assert(zt_test_table_shuffle(&again, seed));
+        assert(table.len == 8);
+        for (i = 0; i < table.len; i++) {
+            const zt_test_entry* entry = &table.entries[i];
+            /* The same seed gives the same order. */
+            assert(entry->func == again.entries[i].func);
+            assert(strcmp(entry->name, again.entries[i].name) == 0);
+            if (entry->nesting == 0) {
+                assert(entry->parent == ZT_NO_PARENT);
+                if (entry->kind == ZT_ENTRY_SUITE) {
+                    nested = i;
+                } else if (top < 2) {
+                    top_pos[top++] = i;
+                }
+            } else {
+                assert(table.entries[entry->parent].kind == ZT_ENTRY_SUITE);
+                assert(table.entries[entry->parent].nesting == entry->nesting - 1);
+            }
+        }
+        /* The setup function still follows the first two test cases of its suite. */
+        assert(table.entries[nested].kind == ZT_ENTRY_SUITE);
+        assert(table.entries[nested + 3].kind == ZT_ENTRY_SETUP);
+        assert(table.entries[nested + 3].parent == nested);
+        assert(table.entries[nested + 1].kind == ZT_ENTRY_CASE);
+        assert(table.entries[nested + 2].kind == ZT_ENTRY_CASE);
+        assert(table.entries[nested + 1].func != table.entries[nested + 2].func);
+        assert(table.entries[nested + 4].func != table.entries[nested + 5].func);
+        /* The nested suite is the first, second or last top-level entry. */
+        order = (nested < 2 ? nested : 2) * 2 + (table.entries[top_pos[0]].func == selftest_passing_check);
+        if (!orders[order]) {
+            orders[order] = true;
+            num_orders++;
+        }
+        zt_test_table_free(&table);
+        zt_test_table_free(&again);
+    }
+    /* All the orders of top-level entries are used. */
+    assert(num_orders == 6);
+}
+
+static void test_main_shuffling_tests(void)
+{
+    char* argv_shuffle[] = { "a.out", "-v", "--shuffle=7" };
+    char* argv_repeat[] = { "a.out", "--shuffle=5", "--until-fail" };
+    char shuffled[1024];
+    int exit_code;
+
+    /* The same seed gives the same order in every run. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_shuffle, NULL, selftest_shuffled_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(zt_mock_stderr, "shuffling test cases with --shuffle=7\n");
+    assert(fseek(zt_mock_stdout, 0, SEEK_SET) == 0);
+    shuffled[fread(shuffled, 1, sizeof shuffled - 1, zt_mock_stdout)] = '\0';
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    assert(strstr(shuffled, "  * selftest_passing_setup ok\n") != NULL);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_shuffle, NULL, selftest_shuffled_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(zt_mock_stdout, shuffled);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* Each iteration uses the next seed, the failed one is reported. */
+    selftest_every_third_call_calls = 0;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_repeat, NULL, selftest_repeated_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stderr,
+        "shuffling test cases with --shuffle=5\n"
+        "iterations executed: 3\n"
+        "first failure in iteration: 3, with --shuffle=7\n"
+        "failure rate of selftest_nested_repeated_suite/selftest_every_third_call_fails: 1 of 3 (33.3%)\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+}
+
+#ifdef ZT_HAVE_POSIX
+static void test_parse_failed_state_options(void)
+{
+    char* argv_first[] = { "dir/a.out", "--failed-first" };
+    char* argv_only[] = { "a.out", "--only-failed=state" };
+    char* argv_empty[] = { "a.out", "--only-failed=" };
+    char* argv_typo[] = { "a.out", "--failed-firstx" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_first, NULL));
+    assert(opts.failed_state == NULL);
+    assert(strcmp(opts.program, "a.out") == 0);
+    assert(zt_parse_options(&opts, 2, argv_first, NULL));
+    assert(opts.failed_first);
+    assert(!opts.only_failed);
+    assert(strcmp(opts.failed_state, ".zt-failed") == 0);
+    assert(zt_parse_options(&opts, 2, argv_only, NULL));
+    assert(!opts.failed_first);
+    assert(opts.only_failed);
+    assert(strcmp(opts.failed_state, "state") == 0);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 2, argv_empty, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_typo, stream_err));
+    selftest_stream_eq(stream_err,
+        "option --only-failed requires a file name after =\n"
+        "unknown option: --failed-firstx\n");
+    fclose(stream_err);
+}
+
+static bool selftest_flaky_case_fails;
+static void selftest_flaky_case(zt_t t)
+{
+    zt_check(t, ZT_FALSE(selftest_flaky_case_fails));
+}
+
+static void selftest_nested_flaky_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+    ZT_VISIT_SUITE_SETUP(v, selftest_passing_setup);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+    ZT_VISIT_TEST_CASE(v, selftest_flaky_case);
+}
+
+static void selftest_flaky_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+    ZT_VISIT_TEST_SUITE(v, selftest_nested_flaky_suite);
+    ZT_VISIT_TEST_CASE(v, selftest_flaky_case);
+}
+
+static void selftest_file_eq(const char* path, const char* expected)
+{
+    FILE* f = fopen(path, "r");
+    assert(f != NULL);
+    selftest_stream_eq(f, expected);
+    fclose(f);
+}
+
+static void test_failed_state_save_and_load(void)
+{
+    char path[PATH_MAX];
+    zt_failed_state state;
+    zt_test_runner runner;
+    zt_test_table table;
+    FILE* f;
+
+    selftest_temporary_path(path, sizeof path);
+    f = fopen(path, "w");
+    assert(f != NULL);
+    fputs("other\tselftest_flaky_case\n", f);
+    fclose(f);
+    assert(zt_failed_state_load(&state, path, "a.out"));
+    assert(state.num_cases == 0);
+    zt_failed_state_free(&state);
+
+    memset(&runner, 0, sizeof runner);
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_flaky_suite, NULL));
+    selftest_flaky_case_fails = true;
+    zt_run_tests_in_process(&runner, &table);
+    assert(zt_failed_state_save(&table, path, "a.out", NULL));
+    /* Lines of other programs are kept. */
+    selftest_file_eq(path,
+        "other\tselftest_flaky_case\n"
+        "a.out\tselftest_nested_flaky_suite/selftest_flaky_case\n"
+        "a.out\tselftest_flaky_case\n");
+
+    assert(zt_failed_state_load(&state, path, "a.out"));
+    assert(state.num_cases == 2);
+    assert(zt_hashes_contain(state.cases, state.num_cases, table.entries[5].path_hash));
+    assert(zt_hashes_contain(state.cases, state.num_cases, table.entries[6].path_hash));
+    assert(state.num_suites == 1);
+    assert(zt_hashes_contain(state.suites, state.num_suites, table.entries[1].path_hash));
+
+    /* Failed test cases come first, but not before setup functions. */
+    assert(zt_test_table_failed_first(&table, &state));
+    assert(table.len == 7);
+    assert(table.entries[0].path_hash == zt_fnv1a(ZT_FNV1A_OFFSET, "selftest_nested_flaky_suite"));
+    assert(table.entries[0].parent == ZT_NO_PARENT);
+    assert(table.entries[1].func == selftest_passing_check);
+    assert(table.entries[2].func == selftest_passing_setup);
+    assert(table.entries[3].func == selftest_flaky_case);
+    assert(table.entries[3].parent == 0);
+    assert(table.entries[4].func == selftest_passing_assert);
+    assert(table.entries[4].parent == 0);
+    assert(table.entries[5].func == selftest_flaky_case);
+    assert(table.entries[5].parent == ZT_NO_PARENT);
+    assert(table.entries[6].func == selftest_passing_assert);
+    assert(table.entries[6].parent == ZT_NO_PARENT);
+    zt_failed_state_free(&state);
+    zt_test_table_free(&table);
+
+    /* Test cases that were not executed keep their state. */
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_flaky_suite, "selftest_flaky_case"));
+    selftest_flaky_case_fails = false;
+    zt_run_tests_in_process(&runner, &table);
+    assert(zt_failed_state_save(&table, path, "a.out", NULL));
+    selftest_file_eq(path,
+        "other\tselftest_flaky_case\n"
+        "a.out\tselftest_nested_flaky_suite/selftest_flaky_case\n");
+    zt_test_table_free(&table);
+    unlink(path);
+}
+
+static void test_main_running_failed_tests_first(void)
+{
+    char path[PATH_MAX];
+    char failed_first[PATH_MAX + 32];
+    char only_failed[PATH_MAX + 32];
+    char* argv_first[] = { "a.out", "-v", failed_first };
+    char* argv_first_jobs[] = { "a.out", "-v", failed_first, "-j", "2" };
+    char* argv_only[] = { "a.out", "-v", only_failed };
+    const char* all_tests = ""
+                            "- selftest_passing_assert ok\n"
+                            "+ selftest_nested_flaky_suite\n"
+                            "  - selftest_passing_check ok\n"
+                            "  * selftest_passing_setup ok\n"
+                            "  - selftest_passing_assert ok\n"
+                            "  - selftest_flaky_case %s\n"
+                            "- selftest_flaky_case %s\n";
+    const char* failed_tests_first = ""
+                                     "+ selftest_nested_flaky_suite\n"
+                                     "  - selftest_passing_check ok\n"
+                                     "  * selftest_passing_setup ok\n"
+                                     "  - selftest_flaky_case failed\n"
+                                     "  - selftest_passing_assert ok\n"
+                                     "- selftest_flaky_case failed\n"
+                                     "- selftest_passing_assert ok\n";
+    int exit_code;
+
+    selftest_temporary_path(path, sizeof path);
+    snprintf(failed_first, sizeof failed_first, "--failed-first=%s", path);
+    snprintf(only_failed, sizeof only_failed, "--only-failed=%s", path);
+    selftest_flaky_case_fails = true;
+
+    /* Without state, test cases run in the usual order. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_first, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq_at(zt_mock_stdout, __FILE__, __LINE__, all_tests, "failed", "failed");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_first, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(zt_mock_stdout, failed_tests_first);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(5, argv_first_jobs, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(zt_mock_stdout, failed_tests_first);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* Only failed test cases run, suites without them are not entered. */
+    selftest_flaky_case_fails = false;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_only, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "+ selftest_nested_flaky_suite\n"
+        "  * selftest_passing_setup ok\n"
+        "  - selftest_flaky_case ok\n"
+        "- selftest_flaky_case ok\n");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    selftest_file_eq(path, "");
+
+    /* Without failed test cases all of them run. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_only, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq_at(zt_mock_stdout, __FILE__, __LINE__, all_tests, "ok", "ok");
+    selftest_stream_eq(zt_mock_stderr, "");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+    unlink(path);
+}
+static void test_parse_journal_options(void)
+{
+    char* argv_journal[] = { "a.out", "--journal", "results" };
+    char* argv_resume[] = { "a.out", "--resume=results" };
+    char* argv_empty[] = { "a.out", "--resume=" };
+    char* argv_missing[] = { "a.out", "--journal" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_journal, NULL));
+    assert(opts.journal == NULL);
+    assert(zt_parse_options(&opts, 3, argv_journal, NULL));
+    assert(strcmp(opts.journal, "results") == 0);
+    assert(!opts.resume);
+    assert(zt_parse_options(&opts, 2, argv_resume, NULL));
+    assert(strcmp(opts.journal, "results") == 0);
+    assert(opts.resume);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 2, argv_empty, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_missing, stream_err));
+    selftest_stream_eq(stream_err,
+        "option --resume requires a file name\n"
+        "option --journal requires a file name\n");
+    fclose(stream_err);
+}
+
+static void test_journal_append_and_resume(void)
+{
+    char path[PATH_MAX];
+    zt_journal journal;
+    zt_test_entry entry;
+    zt_journal_record rec;
+    struct stat st;
+    uint64_t i;
+    int fd;
+
+    selftest_temporary_path(path, sizeof path);
+    memset(&entry, 0, sizeof entry);
+    assert(zt_journal_open(&journal, path, false));
+    assert(journal.len == 0);
+    /* The journal grows beyond the initial size of the file. */
+    for (i = 0; i < ZT_JOURNAL_GROWTH + 3; i++) {
+        entry.path_hash = i;
+        entry.outcome = i % 2 == 0 ? ZT_PASSED : ZT_FAILED;
+        zt_journal_append(&journal, &entry);
+    }
+    assert(journal.len == ZT_JOURNAL_GROWTH + 3);
+    zt_journal_close(&journal);
+    assert(stat(path, &st) == 0);
+    assert((size_t)st.st_size == sizeof(zt_journal_header) + (ZT_JOURNAL_GROWTH + 3) * sizeof rec);
+
+    /* A torn record ends the valid records. */
+    fd = open(path, O_WRONLY);
+    assert(fd >= 0);
+    memset(&rec, 0, sizeof rec);
+    rec.hash = 7;
+    assert(pwrite(fd, &rec, sizeof rec, (off_t)(sizeof(zt_journal_header) + 2 * sizeof rec)) == (ssize_t)sizeof rec);
+    close(fd);
+    assert(zt_journal_open(&journal, path, true));
+    assert(journal.len == 2);
+    assert(journal.records[1].hash == 1);
+    assert(journal.records[2].hash == 0);
+    zt_journal_close(&journal);
+
+    /* Without resume the journal starts empty. */
+    assert(zt_journal_open(&journal, path, false));
+    assert(journal.len == 0);
+    zt_journal_close(&journal);
+    unlink(path);
+}
+
+static void test_main_resuming_tests(void)
+{
+    char path[PATH_MAX];
+    char journal_opt[PATH_MAX + 32];
+    char resume_opt[PATH_MAX + 32];
+    char* argv_journal[] = { "a.out", "-v", journal_opt };
+    char* argv_resume[] = { "a.out", "-v", resume_opt };
+    char* argv_threads[] = { "a.out", journal_opt, "-t", "2" };
+    zt_journal journal;
+    int exit_code;
+
+    selftest_temporary_path(path, sizeof path);
+    snprintf(journal_opt, sizeof journal_opt, "--journal=%s", path);
+    snprintf(resume_opt, sizeof resume_opt, "--resume=%s", path);
+    selftest_flaky_case_fails = true;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_journal, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_FAILURE);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* Only test cases that did not pass are executed again. */
+    selftest_flaky_case_fails = false;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_resume, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "+ selftest_nested_flaky_suite\n"
+        "  * selftest_passing_setup ok\n"
+        "  - selftest_flaky_case ok\n"
+        "- selftest_flaky_case ok\n");
+    selftest_stream_eq(zt_mock_stderr, "test cases not executed because they passed before: 3\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_resume, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(zt_mock_stderr, "test cases not executed because they passed before: 5\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* Thread-safe test cases are journaled too. */
+    selftest_every_third_call_calls = 0;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(4, argv_threads, NULL, selftest_repeated_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+    assert(zt_journal_open(&journal, path, true));
+    assert(journal.len == 2);
+    zt_journal_close(&journal);
+    unlink(path);
+}
+#ifdef ZT_HAVE_CODE_HASH
+static void test_parse_code_cache_options(void)
+{
+    char* argv_default[] = { "a.out", "--skip-unchanged" };
+    char* argv_file[] = { "a.out", "--skip-unchanged=hashes" };
+    char* argv_empty[] = { "a.out", "--skip-unchanged=" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_default, NULL));
+    assert(opts.code_cache == NULL);
+    assert(zt_parse_options(&opts, 2, argv_default, NULL));
+    assert(strcmp(opts.code_cache, ".zt-code") == 0);
+    assert(zt_parse_options(&opts, 2, argv_file, NULL));
+    assert(strcmp(opts.code_cache, "hashes") == 0);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 2, argv_empty, stream_err));
+    selftest_stream_eq(stream_err, "option --skip-unchanged requires a file name after =\n");
+    fclose(stream_err);
+}
+
+static void test_code_map_hash(void)
+{
+    const char* line = "suite/case\t0123456789ABCDEF";
+    /* A note with another type, followed by a build ID. */
+    static const unsigned char notes[] = {
+        4, 0, 0, 0, 4, 0, 0, 0, 1, 0, 0, 0, 'G', 'N', 'U', 0, 1, 2, 3, 4,
+        4, 0, 0, 0, 3, 0, 0, 0, 3, 0, 0, 0, 'G', 'N', 'U', 0, 5, 6, 7, 0
+    };
+    const char* path_end;
+    uint64_t code_hash;
+    zt_code_map map;
+    uint64_t hash;
+    uint64_t other;
+
+    assert(zt_code_cache__split_line(line, line + strlen(line), &path_end, &code_hash));
+    assert(path_end == line + 10);
+    assert(code_hash == UINT64_C(0x0123456789abcdef));
+    assert(!zt_code_cache__split_line(line, line + 10, &path_end, &code_hash));
+    assert(!zt_code_cache__split_line(line, line + strlen(line) - 1, &path_end, &code_hash));
+
+    /* Only the descriptor of the build ID, without padding, is hashed. */
+    hash = other = ZT_FNV1A_OFFSET;
+    assert(zt_code_map__hash_build_id(&hash, notes, sizeof notes, 4));
+    assert(hash == zt_code_map__hash_bytes(ZT_FNV1A_OFFSET, notes + 36, 3));
+    assert(!zt_code_map__hash_build_id(&other, notes, 20, 4));
+    assert(!zt_code_map__hash_build_id(&other, notes, sizeof notes - 4, 4));
+    assert(other == ZT_FNV1A_OFFSET);
+
+    if (!zt_code_map_open(&map)) {
+        /* The self-test program was stripped. */
+        return;
+    }
+    /* The self-test program is linked with the C library, at least. */
+    assert(map.num_objects > 1);
+    assert(map.objects_hash != ZT_FNV1A_OFFSET);
+    hash = zt_code_map_hash(&map, selftest_passing_check);
+    assert(hash != 0);
+    assert(zt_code_map_hash(&map, selftest_passing_check) == hash);
+    assert(zt_code_map_hash(&map, selftest_passing_assert) != hash);
+    /* Addresses which are not the start of a function are unknown. */
+    assert(zt_code_map_hash(&map, (zt_test_case_func)((uintptr_t)selftest_passing_check + 1)) == 0);
+    zt_code_map_close(&map);
+}
+
+static void test_main_skipping_unchanged_tests(void)
+{
+    char path[PATH_MAX];
+    char skip_opt[PATH_MAX + 32];
+    char* argv_skip[] = { "a.out", "-v", skip_opt };
+    char buf[1024];
+    char* p;
+    size_t n;
+    FILE* f;
+    zt_code_map map;
+    int exit_code;
+
+    if (!zt_code_map_open(&map)) {
+        /* The self-test program was stripped. */
+        return;
+    }
+    zt_code_map_close(&map);
+    selftest_temporary_path(path, sizeof path);
+    snprintf(skip_opt, sizeof skip_opt, "--skip-unchanged=%s", path);
+    selftest_flaky_case_fails = true;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_skip, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_FAILURE);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* Test cases that passed with the same code are not executed. */
+    selftest_flaky_case_fails = false;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_skip, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "+ selftest_nested_flaky_suite\n"
+        "  * selftest_passing_setup ok\n"
+        "  - selftest_flaky_case ok\n"
+        "- selftest_flaky_case ok\n");
+    selftest_stream_eq(
+        zt_mock_stderr,
+        "test cases not executed because their code did not change since they passed: 3\n"
+        "test cases executed because they did not pass before: 2\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* A different hash stands for changed code. */
+    f = fopen(path, "r+");
+    assert(f != NULL);
+    n = fread(buf, 1, sizeof buf - 1, f);
+    buf[n] = '\0';
+    p = strstr(buf, "a.out\tselftest_passing_assert\t");
+    assert(p != NULL);
+    p += strlen("a.out\tselftest_passing_assert\t");
+    *p = *p == '0' ? '1' : '0';
+    assert(fseek(f, 0, SEEK_SET) == 0);
+    assert(fwrite(buf, 1, n, f) == n);
+    fclose(f);
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_skip, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    selftest_stream_eq(
+        zt_mock_stderr,
+        "test cases not executed because their code did not change since they passed: 4\n"
+        "test cases executed because their code changed: 1\n");
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+    unlink(path);
+}
+#endif
+#endif
+
+static int selftest_listed_mt_case_line;
+static int selftest_listed_case_with_line;
+static void selftest_nested_listed_suite(zt_visitor v)
+{
+    ZT_VISIT_SUITE_SETUP(v, selftest_passing_setup);
+    selftest_listed_mt_case_line = __LINE__ + 1;
+    ZT_VISIT_TEST_CASE_MT(v, selftest_passing_check);
+    selftest_listed_case_with_line = __LINE__ + 1;
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_failing_check, "port");
+    zt_visit_test_case_mt(v, selftest_passing_assert, "selftest_unlocated_case");
+}
+
+static int selftest_listed_case_line;
+static void selftest_listed_suite(zt_visitor v)
+{
+    selftest_listed_case_line = __LINE__ + 1;
+    ZT_VISIT_TEST_CASE(v, selftest_passing_assert);
+    ZT_VISIT_TEST_SUITE(v, selftest_nested_listed_suite);
+}
+
+static void test_parse_list_format_options(void)
+{
+    char* argv_json[] = { "a.out", "-l", "--format=json" };
+    char* argv_lines[] = { "a.out", "-l", "--format", "lines" };
+    char* argv_human[] = { "a.out", "-l", "--format=human" };
+    char* argv_bad[] = { "a.out", "-l", "--format=xml" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 2, argv_json, NULL));
+    assert(opts.format == ZT_LIST_HUMAN);
+    assert(zt_parse_options(&opts, 3, argv_json, NULL));
+    assert(opts.format == ZT_LIST_JSON);
+    assert(zt_parse_options(&opts, 4, argv_lines, NULL));
+    assert(opts.format == ZT_LIST_LINES);
+    assert(zt_parse_options(&opts, 3, argv_human, NULL));
+    assert(opts.format == ZT_LIST_HUMAN);
+
+    stream_err = selftest_temporary_file();
+    assert(!zt_parse_options(&opts, 3, argv_bad, stream_err));
+    selftest_stream_eq(stream_err, "option --format requires one of human, json or lines\n");
+    fclose(stream_err);
+}
+
+static void test_list_tests_in_machine_formats(void)
+{
+    zt_test_table table;
+    char expected[1024];
+    uint64_t hash_a;
+    uint64_t hash_b;
+    uint64_t hash_c;
+    uint64_t hash_d;
+    FILE* f;
+
+    /* Identifiers are path hashes, like those of collected test cases. */
+    memset(&table, 0, sizeof table);
+    assert(zt_collect_tests_from(&table, selftest_listed_suite, NULL));
+    assert(table.len == 6);
+    hash_a = table.entries[0].path_hash;
+    hash_b = table.entries[3].path_hash;
+    hash_c = table.entries[4].path_hash;
+    hash_d = table.entries[5].path_hash;
+    zt_test_table_free(&table);
+
+    /* Test cases visited without a location have a null file and line. */
+    f = selftest_temporary_file();
+    assert(zt_list_tests_from(f, selftest_listed_suite, NULL, ZT_LIST_JSON));
+    snprintf(expected, sizeof expected,
+        "[\n"
+        "{\"path\":\"selftest_passing_assert\",\"id\":\"%08lx%08lx\",\"depth\":0,\"file\":\"%s\",\"line\":%d},\n"
+        "{\"path\":\"selftest_nested_listed_suite/selftest_passing_check\",\"id\":\"%08lx%08lx\",\"depth\":1,\"file\":\"%s\",\"line\":%d},\n"
+        "{\"path\":\"selftest_nested_listed_suite/selftest_failing_check\",\"id\":\"%08lx%08lx\",\"depth\":1,\"file\":\"%s\",\"line\":%d},\n"
+        "{\"path\":\"selftest_nested_listed_suite/selftest_unlocated_case\",\"id\":\"%08lx%08lx\",\"depth\":1,\"file\":null,\"line\":null}\n"
+        "]\n",
+        (unsigned long)(hash_a >> 32), (unsigned long)(hash_a & 0xffffffffu), __FILE__, selftest_listed_case_line,
+        (unsigned long)(hash_b >> 32), (unsigned long)(hash_b & 0xffffffffu), __FILE__, selftest_listed_mt_case_line,
+        (unsigned long)(hash_c >> 32), (unsigned long)(hash_c & 0xffffffffu), __FILE__, selftest_listed_case_with_line,
+        (unsigned long)(hash_d >> 32), (unsigned long)(hash_d & 0xffffffffu));
+    selftest_stream_eq(f, expected);
+    fclose(f);
+
+    f = selftest_temporary_file();
+    assert(zt_list_tests_from(f, selftest_listed_suite, "*/*", ZT_LIST_LINES));
+    snprintf(expected, sizeof expected,
+        "selftest_nested_listed_suite/selftest_passing_check\t%08lx%08lx\t1\t%s\t%d\n"
+        "selftest_nested_listed_suite/selftest_failing_check\t%08lx%08lx\t1\t%s\t%d\n"
+        "selftest_nested_listed_suite/selftest_unlocated_case\t%08lx%08lx\t1\t\t\n",
+        (unsigned long)(hash_b >> 32), (unsigned long)(hash_b & 0xffffffffu), __FILE__, selftest_listed_mt_case_line,
+        (unsigned long)(hash_c >> 32), (unsigned long)(hash_c & 0xffffffffu), __FILE__, selftest_listed_case_with_line,
+        (unsigned long)(hash_d >> 32), (unsigned long)(hash_d & 0xffffffffu));
+    selftest_stream_eq(f, expected);
+    fclose(f);
+
+    f = selftest_temporary_file();
+    assert(zt_list_tests_from(f, selftest_listed_suite, "nothing", ZT_LIST_JSON));
+    selftest_stream_eq(f, "[]\n");
+    fclose(f);
+}
+
+static void test_quote_json(void)
+{
+    FILE* f = selftest_temporary_file();
+    zt_quote_json(f, "dir\\\"name\"\t\x01\xc5\xbc");
+    selftest_stream_eq(f, "\"dir\\\\\\\"name\\\"\\u0009\\u0001\xc5\xbc\"");
+    fclose(f);
+}
+
+#ifdef ZT_HAVE_CRASH_RECOVERY
+static int selftest_crash_line;
+static volatile uintptr_t selftest_fault_address = 16;
+static void selftest_faulting_case(zt_t t)
+{
+    selftest_crash_line = __LINE__ + 1;
+    zt_check(t, ZT_TRUE(true));
+    *(volatile int*)selftest_fault_address = 1;
+}
+
+/* The limit is never reached, the stack overflows first. */
+static volatile unsigned long selftest_recursion_limit = ULONG_MAX;
+static int selftest_recursion_depth(volatile char* prev)
+{
+    volatile char frame[256];
+    frame[0] = prev != NULL ? prev[0] : 0;
+    if (--selftest_recursion_limit == 0) {
+        return 0;
+    }
+    /* The addition after the call prevents turning recursion into a loop. */
+    return selftest_recursion_depth(frame) + frame[0];
+}
+
+static void selftest_overflowing_case(zt_t t)
+{
+    zt_check(t, ZT_CMP_INT(selftest_recursion_depth(NULL), ==, 0));
+}
+
+static void selftest_faulting_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_faulting_case);
+    ZT_VISIT_TEST_CASE(v, selftest_overflowing_case);
+    ZT_VISIT_TEST_CASE_MT(v, selftest_faulting_case);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+}
+
+static void test_main_recovering_from_crashes(void)
+{
+    char* argv_catch[] = { "a.out", "-v", "--catch-signals", "-t", "2" };
+    char expected[1024];
+    char buf[2048];
+    char* p;
+    struct sigaction sa;
+    zt_options opts;
+    int exit_code;
+
+    assert(zt_parse_options(&opts, 1, argv_catch, NULL));
+    assert(!opts.catch_signals);
+    assert(zt_parse_options(&opts, 3, argv_catch, NULL));
+    assert(opts.catch_signals);
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(5, argv_catch, NULL, selftest_faulting_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_faulting_case failed\n"
+        "- selftest_overflowing_case failed\n"
+        "- selftest_faulting_case failed\n"
+        "- selftest_passing_check ok\n");
+    /* The faulting address of a stack overflow is not known in advance. */
+    rewind(zt_mock_stderr);
+    memset(buf, 0, sizeof buf);
+    assert(fread(buf, 1, sizeof buf - 1, zt_mock_stderr) > 0);
+    snprintf(expected, sizeof expected, "%s:%d: test case crashed with SIGSEGV at address %p\n",
+        __FILE__, selftest_crash_line, (void*)(uintptr_t)16);
+    assert(strncmp(buf, expected, strlen(expected)) == 0);
+    p = buf + strlen(expected);
+    assert(strncmp(p, "test case crashed with SIGSEGV at address ", 42) == 0);
+    p = strchr(p, '\n') + 1;
+    assert(strcmp(p, expected) == 0);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+
+    /* Previous handlers are restored after the run. */
+    assert(sigaction(SIGSEGV, NULL, &sa) == 0);
+    assert((sa.sa_flags & SA_SIGINFO) == 0 || sa.sa_sigaction != zt_crash_handler);
+    assert(zt_guard.alt_stack == NULL);
+}
+#endif
+
+static void test_parse_timeout_options(void)
+{
+    char* argv_timeout[] = { "a.out", "--timeout", "5" };
+    char* argv_eq[] = { "a.out", "--timeout=7" };
+    char* argv_zero[] = { "a.out", "--timeout=0" };
+    char* argv_missing[] = { "a.out", "--timeout" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_timeout, NULL));
+    assert(opts.timeout == 0);
+    stream_err = selftest_temporary_file();
+#ifdef ZT_HAVE_POSIX
+    assert(zt_parse_options(&opts, 3, argv_timeout, NULL));
+    assert(opts.timeout == 5);
+    assert(zt_parse_options(&opts, 2, argv_eq, NULL));
+    assert(opts.timeout == 7);
+#else
+    /* Valid timeouts are rejected where test cases cannot be interrupted. */
+    assert(!zt_parse_options(&opts, 3, argv_timeout, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_eq, stream_err));
+    selftest_stream_eq(stream_err,
+        "option --timeout is not supported on this platform\n"
+        "option --timeout is not supported on this platform\n");
+    fclose(stream_err);
+    stream_err = selftest_temporary_file();
+#endif
+    assert(!zt_parse_options(&opts, 2, argv_zero, stream_err));
+    assert(!zt_parse_options(&opts, 2, argv_missing, stream_err));
+    selftest_stream_eq(stream_err,
+        "option --timeout requires a positive number of seconds\n"
+        "option --timeout requires a positive number of seconds\n");
+    fclose(stream_err);
+}
+
+#ifdef ZT_HAVE_WATCHDOG
+static int selftest_hang_line;
+
+static void selftest_hanging_case(zt_t t)
+{
+    selftest_hang_line = __LINE__ + 1;
+    zt_check(t, ZT_TRUE(true));
+    for (;;) {
+        pause();
+    }
+}
+
+/* Blocking the watchdog signal leaves the test case to be killed by the parent. */
+static void selftest_stubborn_case(zt_t t)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    zt_check(t, ZT_CMP_INT(pthread_sigmask(SIG_BLOCK, &set, NULL), ==, 0));
+    for (;;) {
+        pause();
+    }
+}
+
+static void selftest_hanging_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE(v, selftest_hanging_case);
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+}
+
+static void selftest_hanging_forked_suite(zt_visitor v)
+{
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_hanging_case, "timeout=1");
+    ZT_VISIT_TEST_CASE_WITH(v, selftest_stubborn_case, "timeout=1");
+    ZT_VISIT_TEST_CASE(v, selftest_passing_check);
+}
+
+static void test_main_interrupting_hung_tests(void)
+{
+    char* argv_serial[] = { "a.out", "-v", "--timeout=1" };
+    char* argv_forked[] = { "a.out", "-v", "-j", "2" };
+    char expected[256];
+    char buf[4096];
+    struct sigaction sa;
+    int exit_code;
+
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(3, argv_serial, NULL, selftest_hanging_suite);
+    assert(exit_code == EXIT_FAILURE);
+    selftest_stream_eq(
+        zt_mock_stdout,
+        "- selftest_hanging_case failed\n"
+        "- selftest_passing_check ok\n");
+    rewind(zt_mock_stderr);
+    memset(buf, 0, sizeof buf);
+    assert(fread(buf, 1, sizeof buf - 1, zt_mock_stderr) > 0);
+    snprintf(expected, sizeof expected, "%s:%d: test case selftest_hanging_case timed out after 1 second\n",
+        __FILE__, selftest_hang_line);
+    assert(strncmp(buf, expected, strlen(expected)) == 0);
+#ifdef ZT_HAVE_BACKTRACE
+    assert(strncmp(buf + strlen(expected), "backtrace of the interrupted test case:\n    ", 44) == 0);
+#endif
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+
+    /* The watchdog of the child interrupts the first test case, the parent kills the child of the second one. */
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(4, argv_forked, NULL, selftest_hanging_forked_suite);
+    assert(exit_code == EXIT_FAILURE);
+    rewind(zt_mock_stdout);
+    memset(buf, 0, sizeof buf);
+    assert(fread(buf, 1, sizeof buf - 1, zt_mock_stdout) > 0);
+    assert(strncmp(buf, "- selftest_hanging_case failed\n", 31) == 0);
+    assert(strstr(buf, "- selftest_stubborn_case failed\n") != NULL);
+    assert(strstr(buf, "- selftest_passing_check ok\n") != NULL);
+    rewind(zt_mock_stderr);
+    memset(buf, 0, sizeof buf);
+    assert(fread(buf, 1, sizeof buf - 1, zt_mock_stderr) > 0);
+#ifdef __SANITIZE_THREAD__
+    /* ThreadSanitizer defers signals in forked children, the parent kills the child instead. */
+    assert(strstr(buf, expected) != NULL
+        || strstr(buf, "test case selftest_hanging_case killed after exceeding the timeout of 1 second\n") != NULL);
+#else
+    assert(strstr(buf, expected) != NULL);
+#endif
+    assert(strstr(buf, "test case selftest_stubborn_case killed after exceeding the timeout of 1 second\n") != NULL);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+
+    /* The previous handler is restored after the run. */
+    assert(sigaction(SIGALRM, NULL, &sa) == 0);
+    assert((sa.sa_flags & SA_SIGINFO) == 0 || sa.sa_sigaction != zt_watchdog_handler);
+    assert(!zt_guard.has_timer);
+}
+#endif
+
+static void test_parse_coverage_map_options(void)
+{
+    char* argv_file[] = { "a.out", "--coverage-map", "coverage" };
+    char* argv_eq[] = { "a.out", "--coverage-map=coverage" };
+    zt_options opts;
+    FILE* stream_err;
+
+    assert(zt_parse_options(&opts, 1, argv_file, NULL));
+    assert(opts.coverage_map == NULL);
+    stream_err = selftest_temporary_file();
+#ifdef ZT_HAVE_COVERAGE
+    assert(zt_parse_options(&opts, 3, argv_file, NULL));
+    assert(strcmp(opts.coverage_map, "coverage") == 0);
+    assert(zt_parse_options(&opts, 2, argv_eq, NULL));
+    assert(strcmp(opts.coverage_map, "coverage") == 0);
+    assert(!zt_parse_options(&opts, 2, argv_file, stream_err));
+    selftest_stream_eq(stream_err, "option --coverage-map requires a file name\n");
+#else
+    assert(!zt_parse_options(&opts, 2, argv_eq, stream_err));
+    selftest_stream_eq(stream_err, "option --coverage-map requires a test program built with --coverage and ZT_WITH_GCOV\n");
+#endif
+    fclose(stream_err);
+}
+
+#ifdef ZT_HAVE_COVERAGE
+static void test_main_collecting_coverage(void)
+{
+    char path[PATH_MAX];
+    char map_opt[PATH_MAX + 32];
+    char* argv_map[] = { "a.out", map_opt };
+    const char* source = strrchr(__FILE__, '/') != NULL ? strrchr(__FILE__, '/') + 1 : __FILE__;
+    char line[256];
+    char* buf;
+    long size;
+    FILE* f;
+    int exit_code;
+
+    selftest_temporary_path(path, sizeof path);
+    snprintf(map_opt, sizeof map_opt, "--coverage-map=%s", path);
+    selftest_flaky_case_fails = false;
+    zt_mock_stdout = selftest_temporary_file();
+    zt_mock_stderr = selftest_temporary_file();
+    exit_code = zt_main(2, argv_map, NULL, selftest_flaky_suite);
+    assert(exit_code == EXIT_SUCCESS);
+    fclose(zt_mock_stdout);
+    fclose(zt_mock_stderr);
+    zt_mock_stdout = NULL;
+    zt_mock_stderr = NULL;
+
+    f = fopen(path, "r");
+    assert(f != NULL);
+    assert(fseek(f, 0, SEEK_END) == 0);
+    size = ftell(f);
+    assert(size > 0);
+    rewind(f);
+    buf = (char*)malloc((size_t)size + 1);
+    assert(buf != NULL);
+    assert(fread(buf, 1, (size_t)size, f) == (size_t)size);
+    buf[size] = '\0';
+    fclose(f);
+
+    /* Each test case covers its own function, but not those of other test cases.
+     * File symbols hold base names of source files. */
+    snprintf(line, sizeof line, "a.out\tselftest_passing_assert\t%s\tselftest_passing_assert\n", source);
+    assert(strstr(buf, line) != NULL);
+    snprintf(line, sizeof line, "a.out\tselftest_nested_flaky_suite/selftest_flaky_case\t%s\tselftest_flaky_case\n", source);
+    assert(strstr(buf, line) != NULL);
+    snprintf(line, sizeof line, "a.out\tselftest_passing_assert\t%s\tselftest_flaky_case\n", source);
+    assert(strstr(buf, line) == NULL);
+    free(buf);
+    unlink(path);
+}
+#endif
+
+static void test_stdout_stderr(void)
+{
+    assert(zt_stdout() == stdout);
+    assert(zt_stderr() == stderr);
+}
+
+int main(ZT_UNUSED int argc, ZT_UNUSED char** argv, ZT_UNUSED char** envp)
+{
+    (void)argc;
+    (void)argv;
+    (void)envp;
+    test_MAJOR_MINOR_VERSION();
+
+    test_pack_boolean();
+    test_pack_rune();
+    test_pack_integer();
+    test_pack_unsigned();
+    test_pack_string();
+    test_pack_pointer();
+    test_promote_value();
+
+    test_find_binary_relation();
+    test_invert_binary_relation();
+    test_binary_relation_as_text();
+    test_relation_code_holds();
+    test_claim_holds();
+
+    test_boolean_as_text();
+
+    test_verify_claim0();
+    test_verify_claim1();
+    test_verify_claim2();
+    test_verify_claim3();
+    test_verify_bogus_claim4();
+    test_verify_mismatch_claim1of1();
+    test_verify_mismatch_claim1of2();
+    test_verify_mismatch_claim2of2();
+    test_verify_mismatch_claim1of3();
+    test_verify_mismatch_claim2of3();
+    test_verify_mismatch_claim3of3();
+
+    test_verifier_for_true();
+    test_verify_true();
+
+    test_verifier_for_false();
+    test_verify_false();
+
+    test_verifier_for_boolean_relation();
+    test_verify_boolean_relation();
+
+    test_verifier_for_rune_relation();
+    test_verify_rune_relation();
+
+    test_verifier_for_integer_relation();
+    test_verify_integer_relation();
+
+    test_verifier_for_unsigned_relation();
+    test_verify_unsigned_relation();
+
+    test_verifier_for_string_relation();
+    test_verify_string_relation();
+
+    test_verifier_for_pointer_relation();
+    test_verify_pointer_relation();
+
+    test_verifier_for_null();
+    test_verify_null();
+
+    test_verifier_for_not_null();
+    test_verify_not_null();
+
+    test_ZT_TRUE();
+    test_ZT_FALSE();
+    test_ZT_CMP_BOOL();
+    test_ZT_CMP_RUNE();
+    test_ZT_CMP_INT();
+    test_zt_cmp_int_legacy();
+    test_ZT_CMP_UINT();
+    test_zt_cmp_uint_legacy();
+    test_ZT_RELATION();
+    test_zt_cmp();
+    test_zt_cmp_at();
+    test_ZT_CMP_CSTR();
+    test_ZT_CMP_PTR();
+    test_ZT_NULL();
+    test_ZT_NOT_NULL();
+
+    test_quote_string();
+    test_quote_rune();
+
+    test_list_tests_from();
+    test_run_tests_in_process();
+    test_run_test_case_outcome_pending();
+    test_run_test_case_outcome_passed();
+    test_run_test_case_outcome_failed();
+    test_run_test_case_outcome_bogus();
+
+    test_main_listing_tests();
+    test_main_running_passing_tests();
+    test_main_verbosely_running_passing_tests();
+    test_main_verbosely_running_failing_tests();
+    test_main_verbosely_running_mixed_tests();
+    test_parse_options();
+    test_main_with_unknown_option();
+    test_collect_tests_from();
+    test_collect_thread_safe_tests_from();
+    test_main_listing_thread_safe_tests();
+    test_main_verbosely_running_thread_safe_tests();
+    test_main_listing_tests_with_setup();
+    test_parse_list_format_options();
+    test_list_tests_in_machine_formats();
+    test_quote_json();
+    test_main_verbosely_running_tests_with_setup();
+#ifdef ZT_HAVE_POSIX
+    test_main_verbosely_running_tests_with_setup_in_parallel();
+    test_run_tests_in_threads();
+    test_main_verbosely_running_mixed_tests_in_parallel();
+    test_main_running_passing_tests_in_parallel();
+    test_main_running_crashing_tests_in_parallel();
+    test_main_verbosely_running_mixed_tests_in_workers();
+    test_main_running_crashing_tests_in_workers();
+    test_collect_path_hashes();
+    test_history_save_and_open();
+    test_history_estimate();
+    test_main_running_tests_longest_first();
+    test_shard_by_duration();
+    test_shard_independent_of_order();
+    test_main_parallel_output_is_ordered();
+    test_output_queue();
+    test_resource_pool();
+    test_main_running_tests_with_resources_in_parallel();
+    test_main_failing_fast_in_parallel();
+#endif
+#ifdef ZT_HAVE_AFFINITY
+    test_cpu_list_parse();
+    test_cpu_topology_read();
+    test_parse_cpu_options();
+    test_main_pinning_test_processes();
+#endif
+    test_shard_by_path_hash();
+    test_main_running_single_shard();
+    test_resources_valid();
+    test_parse_resource_options();
+    test_collect_tests_with_resources();
+    test_main_verbosely_running_tests_with_resources();
+    test_main_running_tests_with_runtime_names();
+    test_parse_fail_fast_options();
+    test_main_failing_fast();
+    test_glob_match();
+    test_main_filtering_tests();
+    test_main_running_setup_before_its_test_cases();
+    test_main_reporting_name_before_messages();
+#ifdef ZT_TEST
+    test_collect_registered_tests();
+    test_main_running_registered_tests();
+#endif
+#ifdef ZT_HAVE_POSIX
+    test_parse_failed_state_options();
+    test_failed_state_save_and_load();
+    test_main_running_failed_tests_first();
+    test_parse_journal_options();
+    test_journal_append_and_resume();
+    test_main_resuming_tests();
+#endif
+#ifdef ZT_HAVE_CODE_HASH
+    test_parse_code_cache_options();
+    test_code_map_hash();
+    test_main_skipping_unchanged_tests();
+#endif
+    test_parse_repeat_options();
+    test_main_repeating_tests();
+    test_parse_shuffle_options();
+    test_shuffle_test_table();
+    test_main_shuffling_tests();
+#ifdef ZT_HAVE_CRASH_RECOVERY
+    test_main_recovering_from_crashes();
+#endif
+    test_parse_timeout_options();
+#ifdef ZT_HAVE_WATCHDOG
+    test_main_interrupting_hung_tests();
+#endif
+    test_parse_coverage_map_options();
+#ifdef ZT_HAVE_COVERAGE
+    test_main_collecting_coverage();
+#endif
 
     test_stdout_stderr();
 
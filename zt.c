@@ -17,15 +17,84 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with Libzt.  If not, see <https://www.gnu.org/licenses/>. */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "zt.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+/* Parallel execution of test cases relies on POSIX processes and threads. */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__WATCOMC__)
+#define ZT_HAVE_POSIX
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/* Pinning test processes to CPUs relies on Linux affinity and CPU topology in sysfs. */
+#if defined(ZT_HAVE_POSIX) && defined(__linux__)
+#define ZT_HAVE_AFFINITY
+#include <sched.h>
+#endif
+
+/* Hashing machine code of test cases relies on ELF symbol tables and decoding x86-64 calls. */
+#if defined(ZT_HAVE_POSIX) && defined(__linux__) && defined(__ELF__) && defined(__x86_64__)
+#define ZT_HAVE_CODE_HASH
+#include <elf.h>
+#include <link.h>
+#endif
+
+/*
+ * Collecting coverage of each test case relies on gcov. The program must be
+ * built with --coverage and ZT_WITH_GCOV, as gcov functions are only linked
+ * in when they are referenced.
+ */
+#if defined(ZT_HAVE_CODE_HASH) && defined(ZT_WITH_GCOV)
+#define ZT_HAVE_COVERAGE
+extern void __gcov_reset(void);
+extern void __gcov_dump(void);
+#endif
+
+/* Recovering from crashes relies on thread-local state and alternate signal stacks. */
+#if defined(ZT_HAVE_POSIX) && (defined(__GNUC__) || defined(__clang__))
+#define ZT_HAVE_CRASH_RECOVERY
+#endif
+
+/* Interrupting test cases that run out of time relies on per-thread timers of Linux. */
+#if defined(ZT_HAVE_CRASH_RECOVERY) && defined(__linux__)
+#define ZT_HAVE_WATCHDOG
+#include <sys/syscall.h>
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+/* Backtraces of interrupted test cases rely on glibc. */
+#if defined(ZT_HAVE_WATCHDOG) && defined(__GLIBC__)
+#define ZT_HAVE_BACKTRACE
+#include <execinfo.h>
+
+/** ZT_MAX_FRAMES is the maximum number of frames in the backtrace of an interrupted test case. */
+#define ZT_MAX_FRAMES 32
+#endif
 
 #if !defined(__GNUC__) && !defined(__clang__)
 #define ZT_UNUSED
@@ -38,14 +107,40 @@
 static void zt_logv(FILE* stream, zt_location loc, const char* fmt, va_list ap);
 static void zt_logf(FILE* stream, zt_location loc, const char* fmt, ...) ZT_FORMAT_PRINTF(3, 4);
 
+/**
+ * zt_lock_stream locks a stream for exclusive use by the calling thread.
+ *
+ * Thread-safe test cases may fail concurrently. Locking the stream keeps
+ * each multi-part message on a single line.
+ **/
+static void zt_lock_stream(FILE* stream)
+{
+#ifdef ZT_HAVE_POSIX
+    flockfile(stream);
+#else
+    (void)stream;
+#endif
+}
+
+static void zt_unlock_stream(FILE* stream)
+{
+#ifdef ZT_HAVE_POSIX
+    funlockfile(stream);
+#else
+    (void)stream;
+#endif
+}
+
 static void zt_logv(FILE* stream, zt_location loc, const char* fmt, va_list ap)
 {
     if (stream != NULL) {
+        zt_lock_stream(stream);
         if (loc.fname != NULL && loc.lineno != 0) {
             fprintf(stream, "%s:%d: ", loc.fname, loc.lineno);
         }
         vfprintf(stream, fmt, ap);
         fprintf(stream, "\n");
+        zt_unlock_stream(stream);
     }
 }
 
@@ -120,28 +215,32 @@ typedef enum zt_binary_relation {
     ZT_REL_GT
 } zt_binary_relation;
 
-/** zt_find_binary_relation finds a binary relation given operator name. */
+/**
+ * zt_find_binary_relation finds a binary relation given operator name.
+ *
+ * Operators are decoded character by character, as this is done for every
+ * verified claim.
+ **/
 static zt_binary_relation zt_find_binary_relation(const char* rel)
 {
-    if (strcmp(rel, "==") == 0) {
-        return ZT_REL_EQ;
-    }
-    if (strcmp(rel, "!=") == 0) {
-        return ZT_REL_NE;
-    }
-    if (strcmp(rel, "<=") == 0) {
-        return ZT_REL_LE;
-    }
-    if (strcmp(rel, ">=") == 0) {
-        return ZT_REL_GE;
-    }
-    if (strcmp(rel, "<") == 0) {
-        return ZT_REL_LT;
-    }
-    if (strcmp(rel, ">") == 0) {
-        return ZT_REL_GT;
+    switch (rel[0]) {
+    case '=':
+        return rel[1] == '=' && rel[2] == '\0' ? ZT_REL_EQ : ZT_REL_INVALID;
+    case '!':
+        return rel[1] == '=' && rel[2] == '\0' ? ZT_REL_NE : ZT_REL_INVALID;
+    case '<':
+        if (rel[1] == '\0') {
+            return ZT_REL_LT;
+        }
+        return rel[1] == '=' && rel[2] == '\0' ? ZT_REL_LE : ZT_REL_INVALID;
+    case '>':
+        if (rel[1] == '\0') {
+            return ZT_REL_GT;
+        }
+        return rel[1] == '=' && rel[2] == '\0' ? ZT_REL_GE : ZT_REL_INVALID;
+    default:
+        return ZT_REL_INVALID;
     }
-    return ZT_REL_INVALID;
 }
 
 /** zt_invert_binary_relation returns the inverted relation. */
@@ -188,9 +287,66 @@ static const char* zt_binary_relation_as_text(zt_binary_relation rel)
     }
 }
 
+/**
+ * zt_relation_texts holds the text of each relation encoded by ZT_RELATION.
+ *
+ * The code is the set of outcomes of a comparison for which the relation
+ * holds: 1 for equal, 2 for less and 4 for greater. Claims of a relation
+ * given by its code carry a pointer into this table, from which the code
+ * is recovered without decoding the text.
+ **/
+static const char zt_relation_texts[7][3] = { "", "==", "<", "<=", ">", ">=", "!=" };
+
+/** zt_relation_text returns the text of a relation code, which is stored in zt_relation_texts. */
+static const char* zt_relation_text(int code)
+{
+    return code >= 1 && code <= 6 ? zt_relation_texts[code] : "invalid";
+}
+
+/** zt_relation_code returns the code of a relation text returned by zt_relation_text, or zero. */
+static int zt_relation_code(const char* text)
+{
+    uintptr_t offset = (uintptr_t)text - (uintptr_t)zt_relation_texts;
+    if (offset >= sizeof zt_relation_texts || offset % sizeof zt_relation_texts[0] != 0) {
+        return 0;
+    }
+    return (int)(offset / sizeof zt_relation_texts[0]);
+}
+
+/**
+ * zt_relation_code_holds returns true if a relation given by its code holds.
+ *
+ * The argument is the result of comparing the left hand side with the
+ * right hand side, negative, zero or positive, like for strcmp.
+ **/
+static bool zt_relation_code_holds(int code, int cmp)
+{
+    switch (code) {
+    case 1:
+        return cmp == 0;
+    case 2:
+        return cmp < 0;
+    case 3:
+        return cmp <= 0;
+    case 4:
+        return cmp > 0;
+    case 5:
+        return cmp >= 0;
+    case 6:
+        return cmp != 0;
+    default:
+        return false;
+    }
+}
+
+/**
+ * zt_relation_inconsistent returns true if a relation differs from its source.
+ *
+ * Both are usually the same string literal, which avoids comparing them.
+ **/
 static bool zt_relation_inconsistent(zt_value rel)
 {
-    return strcmp(rel.as.string, zt_source_of(rel)) != 0;
+    return rel.as.string != zt_source_of(rel) && strcmp(rel.as.string, zt_source_of(rel)) != 0;
 }
 
 static void zt_quote_rune_inner(FILE* stream, int c, int quote)
@@ -265,27 +421,250 @@ typedef struct zt_test {
     FILE* stream;
     zt_location location; /** location of the last verified claim. */
     zt_outcome outcome;
+    int crash_signal; /**< crash signal recovered from, or zero. */
+    void* fault_address; /**< address that caused the crash signal. */
+    bool timed_out; /**< test case was interrupted by the watchdog. */
+#ifdef ZT_HAVE_BACKTRACE
+    int num_frames; /**< number of return addresses in frames. */
+    void* frames[ZT_MAX_FRAMES]; /**< backtrace of the test case when it was interrupted. */
+#endif
 } zt_test;
 
 typedef struct zt_visitor_vtab {
-    void (*visit_case)(void*, zt_test_case_func, const char* name);
+    void (*visit_case)(void*, zt_test_case_func, const char* name, zt_location location);
     void (*visit_suite)(void*, zt_test_suite_func, const char* name);
+    void (*visit_case_mt)(void*, zt_test_case_func, const char* name, zt_location location);
+    void (*visit_setup)(void*, zt_test_case_func, const char* name);
+    void (*visit_case_with)(void*, zt_test_case_func, const char* name, const char* resources,
+        zt_location location);
 } zt_visitor_vtab;
 
-typedef struct zt_test_lister {
-    FILE* stream;
-    int nesting;
-} zt_test_lister;
+/**
+ * zt_setup_state tracks failure of suite setup functions.
+ *
+ * When a setup function fails, test cases visited afterwards, at the same
+ * or deeper nesting level, are not executed. The state is cleared when
+ * the suite containing the failed setup function is left.
+ **/
+typedef struct zt_setup_state {
+    const char* failed_name; /**< name of the failed setup function or NULL. */
+    int failed_nesting;
+} zt_setup_state;
+
+/**
+ * zt_resource_item is one item of a resource descriptor.
+ *
+ * Resource descriptors are comma-separated lists of items NAME or
+ * NAME=WEIGHT, for example "memory=8,port". The weight defaults to one.
+ * The special item "exclusive" requests that nothing else runs at the
+ * same time. The special item "timeout=SECONDS" limits the time the test
+ * case may take.
+ **/
+typedef struct zt_resource_item {
+    const char* name; /**< name of the resource, not terminated. */
+    size_t name_len;
+    int weight;
+} zt_resource_item;
+
+/** zt_buffer is a growable array of bytes. */
+typedef struct zt_buffer {
+    char* data;
+    size_t len;
+    size_t cap;
+} zt_buffer;
+
+/** zt_arena_block is a block of memory holding strings, followed by its data. */
+typedef struct zt_arena_block {
+    struct zt_arena_block* next;
+    size_t len;
+    size_t cap;
+} zt_arena_block;
+
+/**
+ * zt_arena holds copies of strings that live as long as the arena.
+ *
+ * Strings are packed into large blocks, which are never moved, so that
+ * copying many short strings does not allocate memory for each of them.
+ **/
+typedef struct zt_arena {
+    zt_arena_block* head;
+} zt_arena;
+
+/**
+ * zt_filter selects test cases by matching their path with a glob pattern.
+ *
+ * The path of a test case is made of the names of enclosing suites and the
+ * name of the test case, separated by slashes. Suites that cannot contain
+ * any matching test case are not entered at all.
+ **/
+typedef struct zt_filter {
+    const char* pattern; /**< glob pattern, or NULL to select all the test cases. */
+    zt_buffer path; /**< path of the current suite, with trailing slash. */
+    size_t selected_len; /**< length of the enclosing path of the suite selected as a whole. */
+    bool selected; /**< the current suite is inside a suite selected as a whole. */
+} zt_filter;
+
+/** zt_cpu describes one logical CPU. */
+typedef struct zt_cpu {
+    int id;
+    int package; /**< physical package, usually a socket and a NUMA node. */
+    int core; /**< core within the package. */
+    int thread; /**< rank of the CPU among the hardware threads of its core. */
+} zt_cpu;
+
+/**
+ * zt_cpu_topology lists CPUs available to test processes, in order of use.
+ *
+ * The first hardware thread of each core comes before any SMT sibling and,
+ * within each rank, CPUs are grouped by package. A small number of
+ * processes stays on one package and does not share cores.
+ **/
+typedef struct zt_cpu_topology {
+    zt_cpu* cpus;
+    size_t len;
+} zt_cpu_topology;
+
+struct zt_output_queue;
+struct zt_coverage;
 
 typedef struct zt_test_runner {
     FILE* stream_out;
     FILE* stream_err;
-    int nesting;
+    struct zt_output_queue* output; /**< queue of output written by another thread, or NULL. */
+    const zt_cpu_topology* cpus; /**< CPUs that test processes are pinned to, or NULL. */
+    struct zt_coverage* coverage; /**< collector of coverage of each test case, or NULL. */
+    zt_buffer pending; /**< output not yet given to the output queue. */
+    FILE* pending_stream; /**< stream of pending output. */
     int num_passed;
     int num_failed;
+    int num_cancelled; /**< number of test cases not executed because of fail-fast. */
     bool verbose;
 } zt_test_runner;
 
+/** zt_entry_kind describes the kind of a test table entry. */
+typedef enum zt_entry_kind {
+    ZT_ENTRY_SUITE,
+    ZT_ENTRY_CASE,
+    ZT_ENTRY_SETUP
+} zt_entry_kind;
+
+/** ZT_NO_PARENT is the parent index of top-level entries. */
+#define ZT_NO_PARENT ((size_t)-1)
+
+/** zt_test_entry describes one test suite or test case found by traversal. */
+typedef struct zt_test_entry {
+    const char* name; /**< name given by the visit macro, not copied. */
+    const char* failed_setup; /**< name of the failed setup that prevented execution. */
+    zt_test_case_func func; /**< test case or setup function, NULL for suites. */
+    zt_buffer output; /**< messages written while executing, reported with the outcome. */
+    const char* resources; /**< resource descriptor of a test case, or NULL. */
+    uint64_t path_hash; /**< hash of the slash-separated path of suite names. */
+    uint64_t code_hash; /**< hash of the code of the test case and its setup functions, zero if unknown. */
+    size_t parent; /**< index of the enclosing suite, or ZT_NO_PARENT. */
+    uint32_t expected; /**< expected wall time in microseconds. */
+    uint32_t elapsed; /**< measured wall time in microseconds. */
+    uint32_t num_runs; /**< number of repeated executions of the test case. */
+    uint32_t num_failures; /**< number of repeated executions that failed. */
+    uint32_t timeout; /**< time limit of the test case or setup in seconds, zero for none. */
+    int nesting;
+    int cpu; /**< CPU the test case was pinned to, if pinned is set. */
+    zt_entry_kind kind;
+    zt_outcome outcome;
+    bool done; /**< outcome is known and can be reported. */
+    bool thread_safe; /**< test case can run concurrently in one process. */
+    bool timed; /**< test case was executed and elapsed is known. */
+    bool excluded; /**< test case belongs to another shard or passed before, it is neither executed nor reported. */
+    bool cancelled; /**< test case or setup was not executed because of fail-fast or failed setup. */
+    bool announced; /**< name of the test case was reported before it was executed. */
+    bool pinned; /**< test case was executed in a process pinned to a CPU. */
+    bool journaled; /**< outcome of the test case was appended to the journal. */
+    bool unchanged; /**< test case was excluded because its code did not change since it passed. */
+} zt_test_entry;
+
+/**
+ * zt_test_table is a flat list of test suites and test cases.
+ *
+ * The suite tree is traversed once, into a table which is then listed or
+ * executed, serially or in parallel. Entries are stored in the order in
+ * which they were visited, so that results computed out of order can be
+ * reported exactly like serial execution would report them.
+ **/
+typedef struct zt_test_table {
+    zt_test_entry* entries;
+    size_t len;
+    size_t cap;
+    size_t reported; /**< number of leading entries already reported. */
+    size_t limit; /**< number of leading entries that may be executed now, zero for all. */
+    int num_failed; /**< number of failed entries, including those not yet reported. */
+    int max_failures; /**< number of failures that stops execution, zero never stops. */
+    bool oom; /**< memory allocation failed while adding entries. */
+    bool longest_first; /**< schedule test cases by decreasing expected duration. */
+    struct zt_journal* journal; /**< journal of outcomes of test cases, or NULL. */
+    zt_arena strings; /**< copies of names and resource descriptors of entries. */
+} zt_test_table;
+
+/**
+ * zt_failed_state lists test cases that failed in previous runs.
+ *
+ * The state file is a text file with one line per failed test case: the
+ * name of the test program, a tab and the slash-separated path of the
+ * test case. Several test programs can share one state file.
+ **/
+typedef struct zt_failed_state {
+    uint64_t* cases; /**< sorted path hashes of failed test cases of this program. */
+    size_t num_cases;
+    uint64_t* suites; /**< sorted path hashes of suites containing failed test cases. */
+    size_t num_suites;
+} zt_failed_state;
+
+typedef struct zt_test_collector {
+    zt_test_table* table;
+    const zt_failed_state* only_failed; /**< test cases to select, or NULL for all. */
+    uint64_t path_hash; /**< hash of the path of the current suite, with trailing slash. */
+    size_t parent; /**< index of the current suite, or ZT_NO_PARENT. */
+    int nesting;
+    zt_filter filter;
+} zt_test_collector;
+
+/** zt_list_format selects the format of the test listing. */
+typedef enum zt_list_format {
+    ZT_LIST_HUMAN, /**< indented tree of suites and test cases. */
+    ZT_LIST_JSON, /**< array of objects describing test cases. */
+    ZT_LIST_LINES /**< one line of tab-separated fields per test case. */
+} zt_list_format;
+
+/** zt_options describes command line options of zt_main. */
+typedef struct zt_options {
+    int jobs; /**< number of test processes to use, zero runs tests in-process. */
+    int threads; /**< number of threads for thread-safe test cases. */
+    int batch; /**< number of test cases per batch of a persistent worker process. */
+    const char* history; /**< file with durations of test cases, or NULL. */
+    int shard; /**< zero-based index of the shard to execute. */
+    int num_shards; /**< number of shards, zero executes all the test cases. */
+    const char* resources; /**< capacities of resources used by test cases, or NULL. */
+    int max_failures; /**< number of failures that stops execution, zero never stops. */
+    const char* cpus; /**< list of CPUs to pin test processes to, or NULL. */
+    bool no_smt; /**< pin test processes only to the first hardware thread of each core. */
+    const char* pattern; /**< glob pattern selecting test cases by path, or NULL. */
+    const char* failed_state; /**< file listing test cases that failed, or NULL. */
+    const char* program; /**< name of the test program in the failed state file. */
+    bool failed_first; /**< execute test cases that failed in the previous run first. */
+    bool only_failed; /**< execute only test cases that failed in the previous run. */
+    int repeat; /**< number of times to execute test cases, zero executes them once. */
+    bool until_fail; /**< repeat execution until a test case fails. */
+    const char* journal; /**< file to journal outcomes of test cases to, or NULL. */
+    bool resume; /**< skip test cases that passed according to the journal. */
+    const char* code_cache; /**< file with code hashes of test cases that passed, or NULL. */
+    const char* coverage_map; /**< file to write functions covered by each test case to, or NULL. */
+    bool shuffle; /**< execute test cases in random order. */
+    unsigned long seed; /**< seed of the random order of the first iteration. */
+    zt_list_format format; /**< format of the test listing. */
+    bool catch_signals; /**< fail test cases that crash instead of terminating. */
+    int timeout; /**< time limit of test cases without their own limit in seconds, zero for none. */
+    bool list;
+    bool verbose;
+} zt_options;
+
 /** zt_verify0_func is a type of verification function with no arguments. */
 typedef bool (*zt_verify0_func)(struct zt_test*);
 
@@ -342,142 +721,5781 @@ void zt_visit_test_suite(zt_visitor v, zt_test_suite_func func,
 void zt_visit_test_case(zt_visitor v, zt_test_case_func func,
     const char* name)
 {
-    v.vtab->visit_case(v.id, func, name);
+    v.vtab->visit_case(v.id, func, name, zt_location_at(NULL, 0));
 }
 
-/* Lister visitor */
-
-static zt_visitor zt_visitor_from_test_lister(zt_test_lister* lister);
+void zt_visit_test_case_at(zt_visitor v, zt_test_case_func func,
+    const char* name, zt_location location)
+{
+    v.vtab->visit_case(v.id, func, name, location);
+}
 
-static void zt_test_lister__visit_suite(void* id, zt_test_suite_func func,
+void zt_visit_test_case_mt(zt_visitor v, zt_test_case_func func,
     const char* name)
 {
-    zt_test_lister* lister = (zt_test_lister*)id;
-    (void)func;
-    fprintf(lister->stream, "%*c %s\n", lister->nesting * 3, '-', name);
-    lister->nesting++;
-    func(zt_visitor_from_test_lister(lister));
-    lister->nesting--;
+    v.vtab->visit_case_mt(v.id, func, name, zt_location_at(NULL, 0));
+}
+
+void zt_visit_test_case_mt_at(zt_visitor v, zt_test_case_func func,
+    const char* name, zt_location location)
+{
+    v.vtab->visit_case_mt(v.id, func, name, location);
 }
 
-static void zt_test_lister__visit_case(void* id, ZT_UNUSED zt_test_case_func func,
+void zt_visit_suite_setup(zt_visitor v, zt_test_case_func func,
     const char* name)
 {
-    zt_test_lister* lister = (zt_test_lister*)id;
-    (void)func;
-    fprintf(lister->stream, "%*c %s\n", lister->nesting * 3, '-', name);
+    v.vtab->visit_setup(v.id, func, name);
 }
 
-static const zt_visitor_vtab zt_test_lister__visitor_vtab = {
-    /* .visit_case = */ zt_test_lister__visit_case,
-    /* .visit_suite = */ zt_test_lister__visit_suite,
-};
+void zt_visit_test_case_with(zt_visitor v, zt_test_case_func func,
+    const char* name, const char* resources)
+{
+    v.vtab->visit_case_with(v.id, func, name, resources, zt_location_at(NULL, 0));
+}
 
-static zt_visitor zt_visitor_from_test_lister(zt_test_lister* lister)
+void zt_visit_test_case_with_at(zt_visitor v, zt_test_case_func func,
+    const char* name, const char* resources, zt_location location)
 {
-    zt_visitor visitor;
-    memset(&visitor, 0, sizeof visitor);
-    visitor.id = lister;
-    visitor.vtab = &zt_test_lister__visitor_vtab;
-    return visitor;
+    v.vtab->visit_case_with(v.id, func, name, resources, location);
 }
 
-/** zt_list_tests_from lists tests from given suite to a given file. */
-static void zt_list_tests_from(FILE* stream, zt_test_suite_func tsuite)
+/** zt_compare_registrations orders test cases registered in one file by line. */
+static int zt_compare_registrations(const void* a, const void* b)
 {
-    zt_test_lister lister;
-    memset(&lister, 0, sizeof lister);
-    lister.stream = stream;
-    tsuite(zt_visitor_from_test_lister(&lister));
+    const zt_test_registration* reg_a = *(const zt_test_registration* const*)a;
+    const zt_test_registration* reg_b = *(const zt_test_registration* const*)b;
+    if (reg_a->lineno != reg_b->lineno) {
+        return reg_a->lineno < reg_b->lineno ? -1 : 1;
+    }
+    return reg_a < reg_b ? -1 : reg_a > reg_b;
+}
+
+/**
+ * zt_visit_registered_tests visits test cases defined with ZT_TEST.
+ *
+ * The linker keeps registrations of each file together, but compilers do
+ * not always emit them in the order of definition. Test cases of each file
+ * are visited in the order of definition, files in the order of linking.
+ **/
+void zt_visit_registered_tests(zt_visitor v, const zt_test_registration* begin,
+    const zt_test_registration* end)
+{
+    const zt_test_registration** sorted;
+    size_t len;
+    size_t i;
+    size_t j;
+
+    /* Both bounds are null in programs without registered test cases. */
+    if (begin == NULL || begin >= end) {
+        return;
+    }
+    len = (size_t)(end - begin);
+    sorted = (const zt_test_registration**)malloc(len * sizeof *sorted);
+    if (sorted == NULL) {
+        /* Without memory test cases are visited in the order of the section. */
+        for (i = 0; i < len; i++) {
+            v.vtab->visit_case(v.id, begin[i].func, begin[i].name,
+                zt_location_at(begin[i].fname, begin[i].lineno));
+        }
+        return;
+    }
+    for (i = 0; i < len; i = j) {
+        for (j = i; j < len && strcmp(begin[j].fname, begin[i].fname) == 0; j++) {
+            sorted[j] = &begin[j];
+        }
+        qsort(&sorted[i], j - i, sizeof *sorted, zt_compare_registrations);
+    }
+    for (i = 0; i < len; i++) {
+        v.vtab->visit_case(v.id, sorted[i]->func, sorted[i]->name,
+            zt_location_at(sorted[i]->fname, sorted[i]->lineno));
+    }
+    free(sorted);
 }
 
-/* Runner visitor */
+/* Suite setup state */
 
-static zt_visitor zt_visitor_from_test_runner(zt_test_runner* runner);
+static bool zt_setup_state__failed(const zt_setup_state* setup, int nesting)
+{
+    return setup->failed_name != NULL && nesting >= setup->failed_nesting;
+}
 
-static void zt_runner_visitor__visit_suite(void* id, zt_test_suite_func func,
-    const char* name)
+static void zt_setup_state__record(zt_setup_state* setup, int nesting,
+    const char* name, zt_outcome outcome)
 {
-    zt_test_runner* runner = (zt_test_runner*)id;
-    if (runner->verbose && runner->stream_out) {
-        fprintf(runner->stream_out, "%*c %s\n", runner->nesting * 3, '+', name);
+    if (outcome != ZT_PENDING && outcome != ZT_PASSED && setup->failed_name == NULL) {
+        setup->failed_name = name;
+        setup->failed_nesting = nesting;
     }
+}
 
-    runner->nesting++;
-    func(zt_visitor_from_test_runner(runner));
-    runner->nesting--;
+/** zt_setup_state__leave_suite must be called after leaving a suite. */
+static void zt_setup_state__leave_suite(zt_setup_state* setup, int nesting)
+{
+    if (setup->failed_name != NULL && nesting < setup->failed_nesting) {
+        setup->failed_name = NULL;
+        setup->failed_nesting = 0;
+    }
 }
 
-static void zt_runner_visitor__visit_case(void* id, zt_test_case_func func,
-    const char* name)
+/* Resource descriptors */
+
+/**
+ * zt_resources_next parses the next item of a resource descriptor.
+ *
+ * Returns false at the end of the descriptor, or on a syntax error, in
+ * which case the cursor does not point to the terminating NUL.
+ **/
+static bool zt_resources_next(const char** cursor, zt_resource_item* item)
 {
-    zt_test_runner* runner = (zt_test_runner*)id;
-    zt_test test;
-    int jump_result;
-    memset(&test, 0, sizeof test);
-    test.stream = runner->stream_err;
-    test.outcome = ZT_PENDING;
-#if defined(_WIN32) || defined(__WATCOMC__)
-    jump_result = setjmp(test.jump_buffer);
-#else
-    jump_result = sigsetjmp(test.jump_buffer, 1);
-#endif
-    if (jump_result == 0) {
-        if (runner->verbose && runner->stream_out) {
-            fprintf(runner->stream_out, "%*c %s", runner->nesting * 3, '-', name);
+    const char* p = *cursor;
+    long weight = 1;
+
+    item->name = p;
+    while (isalnum((unsigned char)*p) || *p == '_' || *p == '-' || *p == '.') {
+        p++;
+    }
+    item->name_len = (size_t)(p - item->name);
+    if (item->name_len == 0) {
+        return false;
+    }
+    if (*p == '=') {
+        char* end = NULL;
+        if (!isdigit((unsigned char)p[1])) {
+            return false;
+        }
+        errno = 0;
+        weight = strtol(p + 1, &end, 10);
+        if (errno != 0 || weight < 1 || weight > INT_MAX) {
+            return false;
+        }
+        p = end;
+    }
+    if (*p != '\0' && *p != ',') {
+        return false;
+    }
+    item->weight = (int)weight;
+    /* A trailing comma is left in place, to fail parsing of the next item. */
+    *cursor = *p == ',' && p[1] != '\0' ? p + 1 : p;
+    return true;
+}
+
+/** zt_resource_item__is_exclusive returns true for the special item "exclusive". */
+static bool zt_resource_item__is_exclusive(const zt_resource_item* item)
+{
+    return item->name_len == 9 && strncmp(item->name, "exclusive", 9) == 0;
+}
+
+/** zt_resource_item__is_timeout returns true for the special item "timeout", whose weight is in seconds. */
+static bool zt_resource_item__is_timeout(const zt_resource_item* item)
+{
+    return item->name_len == 7 && strncmp(item->name, "timeout", 7) == 0;
+}
+
+/**
+ * zt_resources_valid checks the syntax of a resource descriptor.
+ *
+ * Capacities of resources are described with the same syntax, except that
+ * the special items "exclusive" and "timeout" are not allowed there. The
+ * item "timeout" requires a number of seconds.
+ **/
+static bool zt_resources_valid(const char* resources, bool allow_special)
+{
+    zt_resource_item item;
+    const char* cursor = resources;
+
+    if (resources == NULL) {
+        return true;
+    }
+    while (zt_resources_next(&cursor, &item)) {
+        if (zt_resource_item__is_exclusive(&item) && (!allow_special || item.name[9] == '=')) {
+            return false;
+        }
+        if (zt_resource_item__is_timeout(&item) && (!allow_special || item.name[7] != '=')) {
+            return false;
+        }
+    }
+    return *cursor == '\0';
+}
+
+/** zt_resources_timeout returns the time limit in seconds given by a valid resource descriptor, or zero. */
+static uint32_t zt_resources_timeout(const char* resources)
+{
+    zt_resource_item item;
+    const char* cursor = resources;
+    uint32_t timeout = 0;
+
+    while (zt_resources_next(&cursor, &item)) {
+        if (zt_resource_item__is_timeout(&item)) {
+            timeout = (uint32_t)item.weight;
+        }
+    }
+    return timeout;
+}
+
+/* Buffers */
+
+/** zt_buffer_reserve ensures there is space for appending len bytes. */
+static bool zt_buffer_reserve(zt_buffer* buf, size_t len)
+{
+    size_t cap = buf->cap != 0 ? buf->cap : 256;
+    char* data;
+
+    if (len <= buf->cap - buf->len) {
+        return true;
+    }
+    while (cap - buf->len < len) {
+        if (cap > SIZE_MAX / 2) {
+            return false;
+        }
+        cap *= 2;
+    }
+    data = (char*)realloc(buf->data, cap);
+    if (data == NULL) {
+        return false;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return true;
+}
+
+/** zt_buffer_append appends bytes to a buffer. */
+static bool zt_buffer_append(zt_buffer* buf, const void* data, size_t len)
+{
+    if (len == 0) {
+        return true;
+    }
+    if (!zt_buffer_reserve(buf, len)) {
+        return false;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return true;
+}
+
+/** zt_buffer_vprintf appends formatted text to a buffer. */
+static bool zt_buffer_vprintf(zt_buffer* buf, const char* fmt, va_list ap)
+{
+    va_list ap2;
+    int len;
+
+    va_copy(ap2, ap);
+    len = vsnprintf(NULL, 0, fmt, ap2);
+    va_end(ap2);
+    if (len < 0 || !zt_buffer_reserve(buf, (size_t)len + 1)) {
+        return false;
+    }
+    vsnprintf(buf->data + buf->len, (size_t)len + 1, fmt, ap);
+    buf->len += (size_t)len;
+    return true;
+}
+
+static bool zt_buffer_printf(zt_buffer* buf, const char* fmt, ...) ZT_FORMAT_PRINTF(2, 3);
+
+static bool zt_buffer_printf(zt_buffer* buf, const char* fmt, ...)
+{
+    va_list ap;
+    bool ok;
+    va_start(ap, fmt);
+    ok = zt_buffer_vprintf(buf, fmt, ap);
+    va_end(ap);
+    return ok;
+}
+
+#ifdef ZT_HAVE_POSIX
+/** zt_buffer_move transfers contents of one buffer to another, empty one. */
+static void zt_buffer_move(zt_buffer* dst, zt_buffer* src)
+{
+    *dst = *src;
+    memset(src, 0, sizeof *src);
+}
+#endif
+
+static void zt_buffer_free(zt_buffer* buf)
+{
+    free(buf->data);
+    memset(buf, 0, sizeof *buf);
+}
+
+/* Arenas */
+
+#define ZT_ARENA_BLOCK_SIZE 4096
+
+/** zt_arena_strdup copies a string into an arena, returning NULL if memory cannot be allocated. */
+static const char* zt_arena_strdup(zt_arena* arena, const char* str)
+{
+    size_t size = strlen(str) + 1;
+    zt_arena_block* block = arena->head;
+    char* copy;
+
+    if (block == NULL || block->cap - block->len < size) {
+        size_t cap = size > ZT_ARENA_BLOCK_SIZE ? size : ZT_ARENA_BLOCK_SIZE;
+        block = (zt_arena_block*)malloc(sizeof *block + cap);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena->head;
+        block->len = 0;
+        block->cap = cap;
+        arena->head = block;
+    }
+    copy = (char*)(block + 1) + block->len;
+    memcpy(copy, str, size);
+    block->len += size;
+    return copy;
+}
+
+static void zt_arena_free(zt_arena* arena)
+{
+    while (arena->head != NULL) {
+        zt_arena_block* next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+}
+
+/* Filter */
+
+/**
+ * zt_glob_match_char matches one character with the next element of a pattern.
+ *
+ * Elements are "?", bracket expressions like "[a-z]" or "[!0-9]", or
+ * literal characters, optionally escaped with a backslash. Only literal
+ * characters match a slash. The pattern is advanced past the element.
+ **/
+static bool zt_glob_match_char(const char** pattern, char c)
+{
+    const char* p = *pattern;
+
+    if (*p == '?') {
+        *pattern = p + 1;
+        return c != '/';
+    }
+    if (*p == '[') {
+        const char* q = p + 1;
+        const char* first;
+        bool negate = false;
+        bool found = false;
+        if (*q == '!' || *q == '^') {
+            negate = true;
+            q++;
+        }
+        for (first = q; *q != '\0' && (*q != ']' || q == first);) {
+            unsigned char lo = (unsigned char)*q;
+            unsigned char hi = lo;
+            if (q[1] == '-' && q[2] != '\0' && q[2] != ']') {
+                hi = (unsigned char)q[2];
+                q += 3;
+            } else {
+                q++;
+            }
+            if (lo <= (unsigned char)c && (unsigned char)c <= hi) {
+                found = true;
+            }
+        }
+        if (*q == ']') {
+            *pattern = q + 1;
+            return c != '/' && found != negate;
+        }
+        /* An unterminated bracket expression is a literal bracket. */
+    } else if (*p == '\\' && p[1] != '\0') {
+        p++;
+    }
+    *pattern = p + 1;
+    return *p == c;
+}
+
+/**
+ * zt_glob_match matches a string with a glob pattern.
+ *
+ * A "*" matches any sequence of characters other than slash, "**" matches
+ * any sequence of characters. In prefix mode the function returns true
+ * also if the string is a prefix of some string matching the pattern.
+ **/
+static bool zt_glob_match(const char* pattern, const char* str, const char* end, bool prefix)
+{
+    while (*pattern != '\0') {
+        if (str == end && prefix) {
+            return true;
+        }
+        if (*pattern == '*') {
+            bool any = pattern[1] == '*';
+            pattern += any ? 2 : 1;
+            for (;; str++) {
+                if (zt_glob_match(pattern, str, end, prefix)) {
+                    return true;
+                }
+                if (str == end || (*str == '/' && !any)) {
+                    return false;
+                }
+            }
+        }
+        if (str == end || !zt_glob_match_char(&pattern, *str)) {
+            return false;
+        }
+        str++;
+    }
+    return str == end;
+}
+
+/**
+ * zt_filter__enter_suite decides if a suite is entered and extends the path.
+ *
+ * A suite is entered if its path matches the pattern, which selects all the
+ * test cases inside, or if the path of some test case inside could match.
+ * The length of the enclosing path is stored in saved_len, to be passed to
+ * zt_filter__leave_suite after leaving an entered suite.
+ **/
+static bool zt_filter__enter_suite(zt_filter* filter, const char* name, size_t* saved_len)
+{
+    size_t len = filter->path.len;
+
+    *saved_len = len;
+    if (filter->pattern == NULL || filter->selected) {
+        return true;
+    }
+    if (zt_buffer_append(&filter->path, name, strlen(name))
+        && zt_glob_match(filter->pattern, filter->path.data, filter->path.data + filter->path.len, false)) {
+        filter->selected = true;
+    }
+    if (!zt_buffer_append(&filter->path, "/", 1)) {
+        /* Without the path nothing can be matched, select everything. */
+        filter->selected = true;
+    }
+    if (filter->selected) {
+        filter->selected_len = len;
+        return true;
+    }
+    if (zt_glob_match(filter->pattern, filter->path.data, filter->path.data + filter->path.len, true)) {
+        return true;
+    }
+    filter->path.len = len;
+    return false;
+}
+
+static void zt_filter__leave_suite(zt_filter* filter, size_t saved_len)
+{
+    if (filter->selected && filter->selected_len == saved_len) {
+        filter->selected = false;
+    }
+    if (!filter->selected) {
+        filter->path.len = saved_len;
+    }
+}
+
+/** zt_filter__select_case returns true if a test case of the current suite is selected. */
+static bool zt_filter__select_case(zt_filter* filter, const char* name)
+{
+    size_t len = filter->path.len;
+    bool match;
+
+    if (filter->pattern == NULL || filter->selected) {
+        return true;
+    }
+    if (!zt_buffer_append(&filter->path, name, strlen(name))) {
+        return true;
+    }
+    match = zt_glob_match(filter->pattern, filter->path.data, filter->path.data + filter->path.len, false);
+    filter->path.len = len;
+    return match;
+}
+
+#ifdef ZT_HAVE_POSIX
+/** zt_write_all writes exactly size bytes, returning false on error. */
+static bool zt_write_all(int fd, const void* buf, size_t size)
+{
+    const char* p = (const char*)buf;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+/* Output queue */
+
+/** zt_output_chunk is a piece of output waiting to be written to a stream. */
+typedef struct zt_output_chunk {
+    struct zt_output_chunk* next;
+    FILE* stream;
+    zt_buffer buf;
+} zt_output_chunk;
+
+/**
+ * zt_output_queue writes output of the runner in a separate thread.
+ *
+ * The runner appends output to the queue and continues immediately, so a
+ * slow reader of the output never stalls the execution of test cases.
+ * Output is written in the order in which it was queued, across streams.
+ *
+ * Output is written to file descriptors of the streams, bypassing stdio.
+ * The writing thread never holds locks of streams, which would otherwise
+ * be inherited in a locked state by processes forked by the runner.
+ **/
+typedef struct zt_output_queue {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    zt_output_chunk* head;
+    zt_output_chunk** tail;
+    bool closed; /**< no more output is going to be queued. */
+} zt_output_queue;
+
+static void* zt_output_queue_main(void* arg)
+{
+    zt_output_queue* queue = (zt_output_queue*)arg;
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+        zt_output_chunk* chunk;
+        while (queue->head == NULL && !queue->closed) {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        }
+        if (queue->head == NULL) {
+            break;
+        }
+        /* Take all the queued chunks and write them without holding the lock. */
+        chunk = queue->head;
+        queue->head = NULL;
+        queue->tail = &queue->head;
+        pthread_mutex_unlock(&queue->lock);
+        while (chunk != NULL) {
+            zt_output_chunk* next = chunk->next;
+            /* There is nobody to report failures to. */
+            (void)zt_write_all(fileno(chunk->stream), chunk->buf.data, chunk->buf.len);
+            zt_buffer_free(&chunk->buf);
+            free(chunk);
+            chunk = next;
+        }
+        pthread_mutex_lock(&queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+/**
+ * zt_output_queue_start starts the thread writing queued output to given streams.
+ *
+ * The streams are flushed, as the queue writes directly to their file
+ * descriptors. Streams without file descriptors cannot be used.
+ **/
+static bool zt_output_queue_start(zt_output_queue* queue, FILE* stream_out, FILE* stream_err)
+{
+    if ((stream_out != NULL && (fflush(stream_out) != 0 || fileno(stream_out) < 0))
+        || (stream_err != NULL && (fflush(stream_err) != 0 || fileno(stream_err) < 0))) {
+        return false;
+    }
+    memset(queue, 0, sizeof *queue);
+    queue->tail = &queue->head;
+    if (pthread_mutex_init(&queue->lock, NULL) != 0) {
+        return false;
+    }
+    if (pthread_cond_init(&queue->cond, NULL) != 0) {
+        pthread_mutex_destroy(&queue->lock);
+        return false;
+    }
+    if (pthread_create(&queue->thread, NULL, zt_output_queue_main, queue) != 0) {
+        pthread_cond_destroy(&queue->cond);
+        pthread_mutex_destroy(&queue->lock);
+        return false;
+    }
+    return true;
+}
+
+/** zt_output_queue_stop waits until all the queued output is written. */
+static void zt_output_queue_stop(zt_output_queue* queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->thread, NULL);
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+}
+
+/**
+ * zt_output_queue_put queues output for writing to a stream.
+ *
+ * Output is taken from the buffer, which is left empty. When memory is
+ * exhausted the output is written directly, possibly out of order.
+ **/
+static void zt_output_queue_put(zt_output_queue* queue, FILE* stream, zt_buffer* buf)
+{
+    zt_output_chunk* chunk = (zt_output_chunk*)calloc(1, sizeof *chunk);
+    if (chunk == NULL) {
+        (void)zt_write_all(fileno(stream), buf->data, buf->len);
+        zt_buffer_free(buf);
+        return;
+    }
+    chunk->stream = stream;
+    zt_buffer_move(&chunk->buf, buf);
+    pthread_mutex_lock(&queue->lock);
+    *queue->tail = chunk;
+    queue->tail = &chunk->next;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+#endif
+
+/* Runner output */
+
+/**
+ * zt_test_runner__flush gives pending output to the output queue.
+ *
+ * Output is accumulated per stream, so that the output queue receives few
+ * large pieces of output instead of one piece per line.
+ **/
+static void zt_test_runner__flush(zt_test_runner* runner)
+{
+#ifdef ZT_HAVE_POSIX
+    if (runner->pending.len > 0) {
+        zt_output_queue_put(runner->output, runner->pending_stream, &runner->pending);
+    }
+#else
+    (void)runner;
+#endif
+}
+
+/**
+ * zt_test_runner__pending returns the buffer for pending output to a stream.
+ *
+ * Returns NULL if output is written directly.
+ **/
+static zt_buffer* zt_test_runner__pending(zt_test_runner* runner, FILE* stream)
+{
+    if (runner->output == NULL) {
+        return NULL;
+    }
+    if (runner->pending_stream != stream) {
+        zt_test_runner__flush(runner);
+        runner->pending_stream = stream;
+    }
+    return &runner->pending;
+}
+
+/** zt_test_runner__write writes output of the runner to a stream. */
+/**
+ * zt_test_runner__flush_before flushes output of the runner before writing directly to a stream.
+ *
+ * Standard output is buffered while standard error usually is not. Flushing
+ * the former before writing to the latter keeps both in order when they
+ * write to one file, like the output queue of parallel runs does.
+ **/
+static void zt_test_runner__flush_before(zt_test_runner* runner, FILE* stream)
+{
+    if (stream != runner->stream_out && runner->stream_out) {
+        fflush(runner->stream_out);
+    }
+}
+
+static void zt_test_runner__write(zt_test_runner* runner, FILE* stream,
+    const char* data, size_t len)
+{
+    zt_buffer* pending = zt_test_runner__pending(runner, stream);
+    if (pending == NULL || !zt_buffer_append(pending, data, len)) {
+        zt_test_runner__flush_before(runner, stream);
+        fwrite(data, 1, len, stream);
+    }
+}
+
+static void zt_test_runner__printf(zt_test_runner* runner, FILE* stream,
+    const char* fmt, ...) ZT_FORMAT_PRINTF(3, 4);
+
+/** zt_test_runner__printf writes formatted output of the runner to a stream. */
+static void zt_test_runner__printf(zt_test_runner* runner, FILE* stream,
+    const char* fmt, ...)
+{
+    zt_buffer* pending = zt_test_runner__pending(runner, stream);
+    va_list ap;
+    va_start(ap, fmt);
+    if (pending == NULL || !zt_buffer_vprintf(pending, fmt, ap)) {
+        zt_test_runner__flush_before(runner, stream);
+        vfprintf(stream, fmt, ap);
+    }
+    va_end(ap);
+}
+
+#ifdef ZT_HAVE_CRASH_RECOVERY
+/* Crash recovery */
+
+/** ZT_ALT_STACK_SIZE is the size of the alternate signal stack of each thread. */
+#define ZT_ALT_STACK_SIZE 65536
+
+/** zt_crash_signals lists signals that fail the executing test case in crash recovery mode. */
+static const int zt_crash_signals[] = { SIGSEGV, SIGBUS, SIGFPE };
+
+#define ZT_NUM_CRASH_SIGNALS (sizeof zt_crash_signals / sizeof zt_crash_signals[0])
+
+static struct sigaction zt_crash_old_actions[ZT_NUM_CRASH_SIGNALS];
+static bool zt_crash_recovery; /**< crash handlers are installed. */
+static __thread zt_test* zt_current_test; /**< test case executing in this thread, or NULL. */
+
+/**
+ * zt_thread_guard holds resources of a thread for crash recovery and timeouts.
+ *
+ * Resources are created when the thread first needs them and released when
+ * the thread exits, or by zt_thread_guard_release for the main thread.
+ **/
+typedef struct zt_thread_guard {
+    void* alt_stack; /**< alternate signal stack, or NULL. */
+#ifdef ZT_HAVE_WATCHDOG
+    timer_t timer; /**< watchdog timer signalling the thread, valid if has_timer is set. */
+    bool has_timer;
+#endif
+} zt_thread_guard;
+
+static __thread zt_thread_guard zt_guard;
+static pthread_key_t zt_guard_key;
+static pthread_once_t zt_guard_once = PTHREAD_ONCE_INIT;
+
+/** zt_thread_guard__free releases resources held by the guard of the calling thread. */
+static void zt_thread_guard__free(void* data)
+{
+    zt_thread_guard* guard = (zt_thread_guard*)data;
+    if (guard->alt_stack != NULL) {
+        stack_t ss;
+        memset(&ss, 0, sizeof ss);
+        ss.ss_flags = SS_DISABLE;
+        sigaltstack(&ss, NULL);
+        free(guard->alt_stack);
+        guard->alt_stack = NULL;
+    }
+#ifdef ZT_HAVE_WATCHDOG
+    if (guard->has_timer) {
+        timer_delete(guard->timer);
+        guard->has_timer = false;
+    }
+#endif
+}
+
+#ifdef ZT_HAVE_WATCHDOG
+/** zt_thread_guard__after_fork forgets the timer of the parent, timers are not inherited by children. */
+static void zt_thread_guard__after_fork(void)
+{
+    zt_guard.has_timer = false;
+}
+#endif
+
+static void zt_thread_guard__create_key(void)
+{
+    (void)pthread_key_create(&zt_guard_key, zt_thread_guard__free);
+#ifdef ZT_HAVE_WATCHDOG
+    (void)pthread_atfork(NULL, NULL, zt_thread_guard__after_fork);
+#endif
+}
+
+/** zt_thread_guard__register arranges for the guard of the calling thread to be released when it exits. */
+static void zt_thread_guard__register(void)
+{
+    pthread_once(&zt_guard_once, zt_thread_guard__create_key);
+    (void)pthread_setspecific(zt_guard_key, &zt_guard);
+}
+
+/** zt_thread_guard_release releases resources of the calling thread, if any. */
+static void zt_thread_guard_release(void)
+{
+    pthread_once(&zt_guard_once, zt_thread_guard__create_key);
+    (void)pthread_setspecific(zt_guard_key, NULL);
+    zt_thread_guard__free(&zt_guard);
+}
+
+/**
+ * zt_alt_stack_install gives the calling thread an alternate signal stack.
+ *
+ * Crash handlers run on it, so that a test case which overflowed its own
+ * stack can still be recovered. The stack of a thread other than the main
+ * thread is freed when the thread exits. Without memory crashes are still
+ * recovered, except for stack overflows.
+ **/
+static void zt_alt_stack_install(void)
+{
+    stack_t ss;
+
+    if (zt_guard.alt_stack != NULL) {
+        return;
+    }
+    memset(&ss, 0, sizeof ss);
+    ss.ss_sp = malloc(ZT_ALT_STACK_SIZE);
+    ss.ss_size = ZT_ALT_STACK_SIZE;
+    if (ss.ss_sp == NULL) {
+        return;
+    }
+    if (sigaltstack(&ss, NULL) < 0) {
+        free(ss.ss_sp);
+        return;
+    }
+    zt_guard.alt_stack = ss.ss_sp;
+    zt_thread_guard__register();
+}
+
+/**
+ * zt_crash_handler fails the test case executing in the crashing thread.
+ *
+ * The signal and the faulting address are stored in the test and execution
+ * jumps back to zt_run_test_case, which restores the signal mask. A crash
+ * outside of any test case terminates the process as usual.
+ **/
+static void zt_crash_handler(int sig, siginfo_t* info, void* context)
+{
+    zt_test* test = zt_current_test;
+
+    (void)context;
+    if (test == NULL) {
+        signal(sig, SIG_DFL);
+        raise(sig);
+        return;
+    }
+    zt_current_test = NULL;
+    test->outcome = ZT_FAILED;
+    test->crash_signal = sig;
+    test->fault_address = info->si_addr;
+    siglongjmp(test->jump_buffer, 1);
+}
+
+/** zt_crash_signal_name returns the name of a signal handled by zt_crash_handler. */
+static const char* zt_crash_signal_name(int sig)
+{
+    switch (sig) {
+    case SIGSEGV:
+        return "SIGSEGV";
+    case SIGBUS:
+        return "SIGBUS";
+    case SIGFPE:
+        return "SIGFPE";
+    default:
+        return "signal";
+    }
+}
+
+/**
+ * zt_crash_recovery_start installs handlers of crash signals.
+ *
+ * Returns false and restores the previous handlers if any of them cannot
+ * be installed.
+ **/
+static bool zt_crash_recovery_start(void)
+{
+    struct sigaction sa;
+    size_t i;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_sigaction = zt_crash_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0; i < ZT_NUM_CRASH_SIGNALS; i++) {
+        if (sigaction(zt_crash_signals[i], &sa, &zt_crash_old_actions[i]) < 0) {
+            int saved_errno = errno;
+            while (i-- > 0) {
+                sigaction(zt_crash_signals[i], &zt_crash_old_actions[i], NULL);
+            }
+            errno = saved_errno;
+            return false;
+        }
+    }
+    zt_crash_recovery = true;
+    return true;
+}
+
+/** zt_crash_recovery_stop restores previous handlers of crash signals. */
+static void zt_crash_recovery_stop(void)
+{
+    size_t i;
+
+    for (i = 0; i < ZT_NUM_CRASH_SIGNALS; i++) {
+        sigaction(zt_crash_signals[i], &zt_crash_old_actions[i], NULL);
+    }
+    zt_crash_recovery = false;
+}
+#endif
+
+#ifdef ZT_HAVE_WATCHDOG
+/* Watchdog */
+
+/** ZT_WATCHDOG_SIGNAL is the signal sent by the timer of a test case that ran out of time. */
+#define ZT_WATCHDOG_SIGNAL SIGALRM
+
+static struct sigaction zt_watchdog_old_action;
+static bool zt_watchdog; /**< the watchdog handler is installed. */
+
+/**
+ * zt_watchdog_handler interrupts the test case that ran out of time.
+ *
+ * Each thread has its own timer, so the handler runs in the thread of the
+ * test case. The backtrace of the test case is stored in the test and
+ * execution jumps back to zt_run_test_case. A signal arriving after the
+ * test case finished is ignored.
+ **/
+static void zt_watchdog_handler(int sig, siginfo_t* info, void* context)
+{
+    zt_test* test = zt_current_test;
+
+    (void)sig;
+    (void)info;
+    (void)context;
+    if (test == NULL) {
+        return;
+    }
+    zt_current_test = NULL;
+    test->outcome = ZT_FAILED;
+    test->timed_out = true;
+#ifdef ZT_HAVE_BACKTRACE
+    test->num_frames = backtrace(test->frames, ZT_MAX_FRAMES);
+#endif
+    siglongjmp(test->jump_buffer, 1);
+}
+
+/**
+ * zt_watchdog_arm starts the watchdog timer of the calling thread.
+ *
+ * The time left to an enclosing test case, if any, is stored in saved, to
+ * be restored with zt_watchdog_set. Returns false if the timer cannot be
+ * created, the test case then runs without a time limit.
+ **/
+static bool zt_watchdog_arm(uint32_t timeout, struct itimerspec* saved)
+{
+    struct itimerspec its;
+
+    if (!zt_guard.has_timer) {
+        struct sigevent sev;
+        memset(&sev, 0, sizeof sev);
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = ZT_WATCHDOG_SIGNAL;
+        sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+        if (timer_create(CLOCK_MONOTONIC, &sev, &zt_guard.timer) < 0) {
+            return false;
+        }
+        zt_guard.has_timer = true;
+        zt_thread_guard__register();
+    }
+    memset(&its, 0, sizeof its);
+    its.it_value.tv_sec = (time_t)timeout;
+    return timer_settime(zt_guard.timer, 0, &its, saved) == 0;
+}
+
+/** zt_watchdog_set sets the watchdog timer of the calling thread, a zero value stops it. */
+static void zt_watchdog_set(const struct itimerspec* its)
+{
+    timer_settime(zt_guard.timer, 0, its, NULL);
+}
+
+#ifdef ZT_HAVE_BACKTRACE
+/** zt_watchdog_report writes the backtrace of an interrupted test case, innermost frame first. */
+static void zt_watchdog_report(FILE* stream, const zt_test* test)
+{
+    char** symbols;
+    int i;
+
+    if (stream == NULL || test->num_frames <= 1) {
+        return;
+    }
+    symbols = backtrace_symbols(test->frames, test->num_frames);
+    fprintf(stream, "backtrace of the interrupted test case:\n");
+    /* The first frame belongs to the signal handler. */
+    for (i = 1; i < test->num_frames; i++) {
+        if (symbols != NULL) {
+            fprintf(stream, "    %s\n", symbols[i]);
+        } else {
+            fprintf(stream, "    %p\n", test->frames[i]);
+        }
+    }
+    free(symbols);
+}
+#endif
+
+/**
+ * zt_watchdog_start installs the handler interrupting test cases that run out of time.
+ *
+ * Returns false if the handler cannot be installed.
+ **/
+static bool zt_watchdog_start(void)
+{
+    struct sigaction sa;
+#ifdef ZT_HAVE_BACKTRACE
+    void* frame;
+    /* The first backtrace loads the unwinder, which cannot be done in a signal handler. */
+    (void)backtrace(&frame, 1);
+#endif
+    memset(&sa, 0, sizeof sa);
+    sa.sa_sigaction = zt_watchdog_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(ZT_WATCHDOG_SIGNAL, &sa, &zt_watchdog_old_action) < 0) {
+        return false;
+    }
+    zt_watchdog = true;
+    return true;
+}
+
+/** zt_watchdog_stop restores the previous handler of the watchdog signal. */
+static void zt_watchdog_stop(void)
+{
+    sigaction(ZT_WATCHDOG_SIGNAL, &zt_watchdog_old_action, NULL);
+    zt_watchdog = false;
+}
+#endif
+
+/* Runner */
+
+/**
+ * zt_run_test_case runs a single test case and returns the outcome.
+ *
+ * In crash recovery mode a test case that crashes fails with a message
+ * naming the signal and the faulting address, prefixed by the location of
+ * the last verified claim. A test case running longer than a non-zero
+ * timeout, in seconds, is interrupted by the watchdog and fails with a
+ * similar message and a backtrace, where supported.
+ **/
+static zt_outcome zt_run_test_case(FILE* stream_err, zt_test_case_func func,
+    const char* name, uint32_t timeout)
+{
+    zt_test test;
+    int jump_result;
+#ifdef ZT_HAVE_WATCHDOG
+    struct itimerspec saved;
+    struct itimerspec stopped;
+    bool watched;
+#endif
+#ifdef ZT_HAVE_CRASH_RECOVERY
+    zt_test* outer = zt_current_test;
+    if (zt_crash_recovery) {
+        zt_alt_stack_install();
+    }
+#endif
+#ifdef ZT_HAVE_WATCHDOG
+    memset(&stopped, 0, sizeof stopped);
+    watched = timeout > 0 && zt_watchdog && zt_watchdog_arm(timeout, &saved);
+#else
+    (void)name;
+    (void)timeout;
+#endif
+    memset(&test, 0, sizeof test);
+    test.stream = stream_err;
+    test.outcome = ZT_PENDING;
+#if defined(_WIN32) || defined(__WATCOMC__)
+    jump_result = setjmp(test.jump_buffer);
+#else
+    jump_result = sigsetjmp(test.jump_buffer, 1);
+#endif
+    if (jump_result == 0) {
+#ifdef ZT_HAVE_CRASH_RECOVERY
+        zt_current_test = &test;
+#endif
+        func(&test);
+    }
+#ifdef ZT_HAVE_WATCHDOG
+    /* The timer is stopped before the test case is forgotten, so that a
+     * late signal cannot interrupt an enclosing test case. */
+    if (watched) {
+        zt_watchdog_set(&stopped);
+    }
+#endif
+#ifdef ZT_HAVE_CRASH_RECOVERY
+    zt_current_test = outer;
+    if (test.crash_signal != 0) {
+        zt_logf(stream_err, test.location, "test case crashed with %s at address %p",
+            zt_crash_signal_name(test.crash_signal), test.fault_address);
+    }
+#endif
+#ifdef ZT_HAVE_WATCHDOG
+    if (watched) {
+        zt_watchdog_set(&saved);
+    }
+    if (test.timed_out) {
+        zt_logf(stream_err, test.location, "test case %s timed out after %lu second%s",
+            name, (unsigned long)timeout, timeout == 1 ? "" : "s");
+#ifdef ZT_HAVE_BACKTRACE
+        zt_watchdog_report(stream_err, &test);
+#endif
+    }
+#endif
+    return test.outcome;
+}
+
+/** zt_clock_usec returns a monotonic time stamp in microseconds. */
+static uint64_t zt_clock_usec(void)
+{
+#ifdef ZT_HAVE_POSIX
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+    }
+#endif
+    return (uint64_t)clock() * 1000000u / (uint64_t)CLOCKS_PER_SEC;
+}
+
+/**
+ * zt_run_timed_test_case runs a single test case and measures its wall time.
+ *
+ * The elapsed time, in microseconds, saturates at UINT32_MAX.
+ **/
+static zt_outcome zt_run_timed_test_case(FILE* stream_err, zt_test_case_func func,
+    const char* name, uint32_t timeout, uint32_t* elapsed)
+{
+    uint64_t start = zt_clock_usec();
+    zt_outcome outcome = zt_run_test_case(stream_err, func, name, timeout);
+    uint64_t delta = zt_clock_usec() - start;
+    *elapsed = delta < UINT32_MAX ? (uint32_t)delta : UINT32_MAX;
+    return outcome;
+}
+
+/**
+ * zt_run_captured_test_case runs a test case, keeping its messages in a buffer.
+ *
+ * Captured messages are reported later, in the order of test cases rather
+ * than in the order of execution. Messages that cannot be captured are
+ * written directly to stream_err.
+ **/
+static zt_outcome zt_run_captured_test_case(FILE* stream_err, zt_test_case_func func,
+    const char* name, uint32_t timeout, uint32_t* elapsed, zt_buffer* output)
+{
+#ifdef ZT_HAVE_POSIX
+    char* data = NULL;
+    size_t len = 0;
+    FILE* stream = stream_err != NULL ? open_memstream(&data, &len) : NULL;
+    if (stream != NULL) {
+        zt_outcome outcome = zt_run_timed_test_case(stream, func, name, timeout, elapsed);
+        fclose(stream);
+        if (!zt_buffer_append(output, data, len)) {
+            fwrite(data, 1, len, stream_err);
+        }
+        free(data);
+        return outcome;
+    }
+#else
+    (void)output;
+#endif
+    return zt_run_timed_test_case(stream_err, func, name, timeout, elapsed);
+}
+
+/**
+ * zt_test_runner__record_outcome counts and reports the outcome of a test case.
+ *
+ * In verbose mode the name of the test case is expected to be already
+ * printed, only the outcome is appended to the same line.
+ **/
+static void zt_test_runner__record_outcome(zt_test_runner* runner, int nesting,
+    const char* name, zt_outcome outcome)
+{
+    switch (outcome) {
+    case ZT_PENDING:
+    case ZT_PASSED:
+        if (runner->verbose && runner->stream_out) {
+            zt_test_runner__printf(runner, runner->stream_out, " ok\n");
+        }
+        runner->num_passed++;
+        break;
+    case ZT_FAILED:
+        if (runner->verbose && runner->stream_out) {
+            zt_test_runner__printf(runner, runner->stream_out, " failed\n");
+        }
+        runner->num_failed++;
+        break;
+    default:
+        if (runner->verbose && runner->stream_out) {
+            zt_test_runner__printf(runner, runner->stream_out, " outcome code %d (?)\n", outcome);
+        }
+        if (runner->stream_err) {
+            zt_test_runner__printf(runner, runner->stream_err, "%*c %s - unexpected outcome code %d\n",
+                nesting * 3, '-', name, outcome);
+        }
+        runner->num_failed++;
+        break;
+    }
+}
+
+/**
+ * zt_test_runner__record_setup counts and reports the outcome of a setup function.
+ *
+ * Only failing setup functions are counted, as failures.
+ **/
+static void zt_test_runner__record_setup(zt_test_runner* runner, int nesting,
+    const char* name, zt_outcome outcome)
+{
+    bool ok = outcome == ZT_PENDING || outcome == ZT_PASSED;
+    if (runner->verbose && runner->stream_out) {
+        zt_test_runner__printf(runner, runner->stream_out, "%*c %s %s\n", nesting * 3, '*', name, ok ? "ok" : "failed");
+    }
+    if (!ok) {
+        runner->num_failed++;
+    }
+}
+
+/** zt_test_runner__record_skipped counts a test case not executed because of failed setup. */
+static void zt_test_runner__record_skipped(zt_test_runner* runner, int nesting,
+    const char* name, const char* setup_name)
+{
+    if (runner->verbose && runner->stream_out) {
+        zt_test_runner__printf(runner, runner->stream_out, " failed\n");
+    }
+    if (runner->stream_err) {
+        zt_test_runner__printf(runner, runner->stream_err, "%*c %s - not executed because %s failed\n",
+            nesting * 3, '-', name, setup_name);
+    }
+    runner->num_failed++;
+}
+
+/** zt_test_runner__record_cancelled counts a test case not executed because of fail-fast. */
+static void zt_test_runner__record_cancelled(zt_test_runner* runner)
+{
+    if (runner->verbose && runner->stream_out) {
+        zt_test_runner__printf(runner, runner->stream_out, " not executed\n");
+    }
+    runner->num_cancelled++;
+}
+
+/* Test table and collector visitor */
+
+/** zt_test_table_append adds a new, zero-initialized entry to the table. */
+static zt_test_entry* zt_test_table_append(zt_test_table* table)
+{
+    zt_test_entry* entry;
+    if (table->len == table->cap) {
+        size_t cap = table->cap != 0 ? table->cap * 2 : 64;
+        zt_test_entry* entries = (zt_test_entry*)realloc(table->entries, cap * sizeof *entries);
+        if (entries == NULL) {
+            table->oom = true;
+            return NULL;
+        }
+        table->entries = entries;
+        table->cap = cap;
+    }
+    entry = &table->entries[table->len++];
+    memset(entry, 0, sizeof *entry);
+    return entry;
+}
+
+static void zt_test_table_free(zt_test_table* table)
+{
+    size_t i;
+    for (i = 0; i < table->len; i++) {
+        zt_buffer_free(&table->entries[i].output);
+    }
+    free(table->entries);
+    zt_arena_free(&table->strings);
+    memset(table, 0, sizeof *table);
+}
+
+/** zt_test_entry__failed returns true for an entry that is known to have failed. */
+static bool zt_test_entry__failed(const zt_test_entry* entry)
+{
+    return entry->done && !entry->excluded && !entry->cancelled
+        && entry->outcome != ZT_PENDING && entry->outcome != ZT_PASSED;
+}
+
+#ifdef ZT_HAVE_POSIX
+static void zt_journal_append(struct zt_journal* journal, const zt_test_entry* entry);
+#endif
+#ifdef ZT_HAVE_COVERAGE
+static void zt_coverage_record(const struct zt_coverage* coverage, size_t index);
+#endif
+
+/**
+ * zt_test_table_finish marks an entry as done.
+ *
+ * Failures are counted as soon as they are known, before they are
+ * reported in table order, so that fail-fast mode stops without delay.
+ * Outcomes of test cases are journaled at the same time.
+ **/
+static void zt_test_table_finish(zt_test_table* table, zt_test_entry* entry)
+{
+    entry->done = true;
+    if (zt_test_entry__failed(entry)) {
+        table->num_failed++;
+    }
+#ifdef ZT_HAVE_POSIX
+    if (table->journal != NULL && entry->kind == ZT_ENTRY_CASE && !entry->journaled) {
+        zt_journal_append(table->journal, entry);
+        entry->journaled = true;
+    }
+#endif
+}
+
+/** zt_test_table_stopped returns true when fail-fast mode stops execution. */
+static bool zt_test_table_stopped(const zt_test_table* table)
+{
+    return table->max_failures > 0 && table->num_failed >= table->max_failures;
+}
+
+/** zt_test_entry__cancel records a test case that is not executed because of fail-fast. */
+static void zt_test_entry__cancel(zt_test_entry* entry)
+{
+    zt_buffer_free(&entry->output);
+    entry->outcome = ZT_PENDING;
+    entry->cancelled = true;
+    entry->done = true;
+}
+
+/** zt_test_table_append_path appends the slash-separated path of an entry to a buffer. */
+static bool zt_test_table_append_path(const zt_test_table* table, size_t index, zt_buffer* buf)
+{
+    const zt_test_entry* entry = &table->entries[index];
+    if (entry->parent != ZT_NO_PARENT
+        && (!zt_test_table_append_path(table, entry->parent, buf) || !zt_buffer_append(buf, "/", 1))) {
+        return false;
+    }
+    return zt_buffer_append(buf, entry->name, strlen(entry->name));
+}
+
+/**
+ * zt_test_table_rewind prepares test cases of a table to be executed again.
+ *
+ * Only the test cases at the given indices are reset. Suites and setup
+ * functions keep their state, setup functions are not executed again.
+ **/
+static void zt_test_table_rewind(zt_test_table* table, const size_t* items, size_t num_items)
+{
+    size_t i;
+    for (i = 0; i < num_items; i++) {
+        zt_test_entry* entry = &table->entries[items[i]];
+        zt_buffer_free(&entry->output);
+        entry->failed_setup = NULL;
+        entry->outcome = ZT_PENDING;
+        entry->elapsed = 0;
+        entry->done = false;
+        entry->timed = false;
+        entry->cancelled = false;
+        entry->announced = false;
+        entry->pinned = false;
+        entry->journaled = false;
+    }
+    table->reported = 0;
+    table->num_failed = 0;
+}
+
+/** ZT_FNV1A_OFFSET is the initial value of the 64 bit FNV-1a hash. */
+#define ZT_FNV1A_OFFSET UINT64_C(14695981039346656037)
+
+/** zt_fnv1a continues computing the 64 bit FNV-1a hash of a string. */
+static uint64_t zt_fnv1a(uint64_t hash, const char* str)
+{
+    for (; *str != '\0'; str++) {
+        hash ^= (unsigned char)*str;
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+/** zt_hashes_contain looks up a hash in a sorted array of hashes. */
+static bool zt_hashes_contain(const uint64_t* hashes, size_t len, uint64_t hash)
+{
+    size_t lo = 0;
+    size_t hi = len;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (hashes[mid] < hash) {
+            lo = mid + 1;
+        } else if (hashes[mid] > hash) {
+            hi = mid;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+static zt_visitor zt_visitor_from_test_collector(zt_test_collector* collector);
+
+/**
+ * zt_test_collector__append adds an entry at the current position in the suite tree.
+ *
+ * The name is copied into the table, as it may be built at runtime and
+ * reused for other entries before the table is executed.
+ **/
+static zt_test_entry* zt_test_collector__append(zt_test_collector* collector, const char* name)
+{
+    zt_test_table* table = collector->table;
+    zt_test_entry* entry;
+    const char* copy = zt_arena_strdup(&table->strings, name);
+    if (copy == NULL) {
+        table->oom = true;
+        return NULL;
+    }
+    entry = zt_test_table_append(table);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->name = copy;
+    entry->path_hash = zt_fnv1a(collector->path_hash, name);
+    entry->parent = collector->parent;
+    entry->nesting = collector->nesting;
+    return entry;
+}
+
+static void zt_test_collector__visit_suite(void* id, zt_test_suite_func func,
+    const char* name)
+{
+    zt_test_collector* collector = (zt_test_collector*)id;
+    zt_test_entry* entry;
+    uint64_t path_hash = collector->path_hash;
+    size_t parent = collector->parent;
+    size_t saved_len;
+    /* Suites without selected test cases are not even entered. */
+    if (collector->only_failed != NULL
+        && !zt_hashes_contain(collector->only_failed->suites, collector->only_failed->num_suites,
+            zt_fnv1a(path_hash, name))) {
+        return;
+    }
+    if (!zt_filter__enter_suite(&collector->filter, name, &saved_len)) {
+        return;
+    }
+    entry = zt_test_collector__append(collector, name);
+    if (entry == NULL) {
+        zt_filter__leave_suite(&collector->filter, saved_len);
+        return;
+    }
+    entry->kind = ZT_ENTRY_SUITE;
+    collector->path_hash = zt_fnv1a(entry->path_hash, "/");
+    collector->parent = collector->table->len - 1;
+    collector->nesting++;
+    func(zt_visitor_from_test_collector(collector));
+    collector->nesting--;
+    collector->parent = parent;
+    collector->path_hash = path_hash;
+    zt_filter__leave_suite(&collector->filter, saved_len);
+}
+
+/**
+ * zt_test_collector__append_case adds a selected test case to the table.
+ *
+ * Returns the new entry, or NULL if the test case is not selected or
+ * memory cannot be allocated.
+ **/
+static zt_test_entry* zt_test_collector__append_case(zt_test_collector* collector,
+    zt_test_case_func func, const char* name)
+{
+    zt_test_entry* entry;
+    if (collector->only_failed != NULL
+        && !zt_hashes_contain(collector->only_failed->cases, collector->only_failed->num_cases,
+            zt_fnv1a(collector->path_hash, name))) {
+        return NULL;
+    }
+    if (!zt_filter__select_case(&collector->filter, name)) {
+        return NULL;
+    }
+    entry = zt_test_collector__append(collector, name);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->func = func;
+    entry->kind = ZT_ENTRY_CASE;
+    entry->outcome = ZT_PENDING;
+    return entry;
+}
+
+static void zt_test_collector__visit_case(void* id, zt_test_case_func func,
+    const char* name, zt_location location)
+{
+    (void)location;
+    zt_test_collector__append_case((zt_test_collector*)id, func, name);
+}
+
+static void zt_test_collector__visit_case_mt(void* id, zt_test_case_func func,
+    const char* name, zt_location location)
+{
+    zt_test_entry* entry = zt_test_collector__append_case((zt_test_collector*)id, func, name);
+    (void)location;
+    if (entry != NULL) {
+        entry->thread_safe = true;
+    }
+}
+
+static void zt_test_collector__visit_case_with(void* id, zt_test_case_func func,
+    const char* name, const char* resources, zt_location location)
+{
+    zt_test_collector* collector = (zt_test_collector*)id;
+    zt_test_entry* entry = zt_test_collector__append_case(collector, func, name);
+    (void)location;
+    if (entry == NULL || entry->done) {
+        return;
+    }
+    if (!zt_resources_valid(resources, true)) {
+        zt_buffer_printf(&entry->output, "test case %s has invalid resources: %s\n",
+            entry->name, resources);
+        entry->outcome = ZT_FAILED;
+        entry->done = true;
+    } else if (resources != NULL && *resources != '\0') {
+        entry->resources = zt_arena_strdup(&collector->table->strings, resources);
+        if (entry->resources == NULL) {
+            collector->table->oom = true;
+        }
+        entry->timeout = zt_resources_timeout(resources);
+    }
+}
+
+/**
+ * zt_test_collector__visit_setup records a suite setup function.
+ *
+ * Setup functions are not executed while the table is collected, so that
+ * listing never executes them. See zt_test_table_run_setups.
+ **/
+static void zt_test_collector__visit_setup(void* id, zt_test_case_func func,
+    const char* name)
+{
+    zt_test_entry* entry = zt_test_collector__append((zt_test_collector*)id, name);
+    if (entry != NULL) {
+        entry->func = func;
+        entry->kind = ZT_ENTRY_SETUP;
+        entry->outcome = ZT_PENDING;
+    }
+}
+
+static const zt_visitor_vtab zt_test_collector__visitor_vtab = {
+    /* .visit_case = */ zt_test_collector__visit_case,
+    /* .visit_suite = */ zt_test_collector__visit_suite,
+    /* .visit_case_mt = */ zt_test_collector__visit_case_mt,
+    /* .visit_setup = */ zt_test_collector__visit_setup,
+    /* .visit_case_with = */ zt_test_collector__visit_case_with,
+};
+
+static zt_visitor zt_visitor_from_test_collector(zt_test_collector* collector)
+{
+    zt_visitor visitor;
+    visitor.id = collector;
+    visitor.vtab = &zt_test_collector__visitor_vtab;
+    return visitor;
+}
+
+/**
+ * zt_collect_selected_tests_from stores selected suites and cases in a table.
+ *
+ * Only test cases with path matching the pattern, unless the pattern is
+ * NULL, and listed as failed, unless only_failed is NULL, are stored.
+ * Suites without such test cases are not entered. Suite setup functions
+ * are stored but not executed.
+ **/
+static bool zt_collect_selected_tests_from(zt_test_table* table, zt_test_suite_func tsuite,
+    const char* pattern, const zt_failed_state* only_failed)
+{
+    zt_test_collector collector;
+    memset(&collector, 0, sizeof collector);
+    collector.table = table;
+    collector.only_failed = only_failed;
+    collector.path_hash = ZT_FNV1A_OFFSET;
+    collector.parent = ZT_NO_PARENT;
+    collector.filter.pattern = pattern;
+    tsuite(zt_visitor_from_test_collector(&collector));
+    zt_buffer_free(&collector.filter.path);
+    return !table->oom;
+}
+
+#ifdef ZT_SELF_TEST_BUILD
+/** zt_collect_tests_from stores suites and cases with path matching a pattern in a table. */
+static bool zt_collect_tests_from(zt_test_table* table, zt_test_suite_func tsuite,
+    const char* pattern)
+{
+    return zt_collect_selected_tests_from(table, tsuite, pattern, NULL);
+}
+#endif
+
+/* Test lister visitor */
+
+/**
+ * zt_test_lister writes suites and test cases to a stream as they are visited.
+ *
+ * Listing does not build a test table, so that the output of large test
+ * programs is streamed in constant memory, apart from the current path.
+ **/
+typedef struct zt_test_lister {
+    FILE* stream;
+    zt_list_format format;
+    zt_buffer path; /**< slash-separated path of the current suite, with trailing slash. */
+    uint64_t path_hash; /**< hash of the path of the current suite, with trailing slash. */
+    int nesting;
+    size_t num_cases; /**< number of test cases listed so far. */
+    zt_filter filter;
+    bool oom; /**< memory allocation failed while building a path. */
+} zt_test_lister;
+
+static zt_visitor zt_visitor_from_test_lister(zt_test_lister* lister);
+
+/** zt_quote_json writes a string as a JSON string literal, leaving non-ASCII bytes intact. */
+static void zt_quote_json(FILE* stream, const char* str)
+{
+    fputc('"', stream);
+    for (; *str != '\0'; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            fputc('\\', stream);
+            fputc(c, stream);
+        } else if (c < 0x20) {
+            fprintf(stream, "\\u%04x", c);
+        } else {
+            fputc(c, stream);
+        }
+    }
+    fputc('"', stream);
+}
+
+/**
+ * zt_test_lister__list_case writes one selected test case.
+ *
+ * Machine-readable formats carry the full path, the path hash which
+ * identifies the test case across runs, like in the state files, the
+ * nesting depth and the location of the visit, if it is known.
+ **/
+static void zt_test_lister__list_case(zt_test_lister* lister, const char* name,
+    zt_location location)
+{
+    size_t len = lister->path.len;
+    uint64_t hash;
+
+    if (lister->format == ZT_LIST_HUMAN) {
+        fprintf(lister->stream, "%*c %s\n", lister->nesting * 3, '-', name);
+        return;
+    }
+    if (!zt_buffer_append(&lister->path, name, strlen(name) + 1)) {
+        lister->oom = true;
+        return;
+    }
+    hash = zt_fnv1a(lister->path_hash, name);
+    if (lister->format == ZT_LIST_JSON) {
+        fputs(lister->num_cases == 0 ? "[\n{\"path\":" : ",\n{\"path\":", lister->stream);
+        zt_quote_json(lister->stream, lister->path.data);
+        fprintf(lister->stream, ",\"id\":\"%08lx%08lx\",\"depth\":%d,\"file\":",
+            (unsigned long)(hash >> 32), (unsigned long)(hash & 0xffffffffu), lister->nesting);
+        if (location.fname != NULL) {
+            zt_quote_json(lister->stream, location.fname);
+            fprintf(lister->stream, ",\"line\":%d}", location.lineno);
+        } else {
+            fputs("null,\"line\":null}", lister->stream);
+        }
+    } else {
+        fprintf(lister->stream, "%s\t%08lx%08lx\t%d\t", lister->path.data,
+            (unsigned long)(hash >> 32), (unsigned long)(hash & 0xffffffffu), lister->nesting);
+        if (location.fname != NULL) {
+            fprintf(lister->stream, "%s\t%d\n", location.fname, location.lineno);
+        } else {
+            fputs("\t\n", lister->stream);
+        }
+    }
+    lister->path.len = len;
+    lister->num_cases++;
+}
+
+static void zt_test_lister__visit_suite(void* id, zt_test_suite_func func,
+    const char* name)
+{
+    zt_test_lister* lister = (zt_test_lister*)id;
+    uint64_t path_hash = lister->path_hash;
+    size_t len = lister->path.len;
+    size_t saved_len;
+
+    if (!zt_filter__enter_suite(&lister->filter, name, &saved_len)) {
+        return;
+    }
+    if (lister->format == ZT_LIST_HUMAN) {
+        fprintf(lister->stream, "%*c %s\n", lister->nesting * 3, '-', name);
+    } else if (!zt_buffer_append(&lister->path, name, strlen(name))
+        || !zt_buffer_append(&lister->path, "/", 1)) {
+        lister->oom = true;
+        lister->path.len = len;
+        zt_filter__leave_suite(&lister->filter, saved_len);
+        return;
+    }
+    lister->path_hash = zt_fnv1a(zt_fnv1a(path_hash, name), "/");
+    lister->nesting++;
+    func(zt_visitor_from_test_lister(lister));
+    lister->nesting--;
+    lister->path_hash = path_hash;
+    lister->path.len = len;
+    zt_filter__leave_suite(&lister->filter, saved_len);
+}
+
+static void zt_test_lister__visit_case(void* id, zt_test_case_func func,
+    const char* name, zt_location location)
+{
+    zt_test_lister* lister = (zt_test_lister*)id;
+    (void)func;
+    if (zt_filter__select_case(&lister->filter, name)) {
+        zt_test_lister__list_case(lister, name, location);
+    }
+}
+
+static void zt_test_lister__visit_case_mt(void* id, zt_test_case_func func,
+    const char* name, zt_location location)
+{
+    zt_test_lister__visit_case(id, func, name, location);
+}
+
+static void zt_test_lister__visit_case_with(void* id, zt_test_case_func func,
+    const char* name, const char* resources, zt_location location)
+{
+    (void)resources;
+    zt_test_lister__visit_case(id, func, name, location);
+}
+
+/** zt_test_lister__visit_setup ignores suite setup functions, which are neither listed nor executed. */
+static void zt_test_lister__visit_setup(void* id, zt_test_case_func func, const char* name)
+{
+    (void)id;
+    (void)func;
+    (void)name;
+}
+
+static const zt_visitor_vtab zt_test_lister__visitor_vtab = {
+    /* .visit_case = */ zt_test_lister__visit_case,
+    /* .visit_suite = */ zt_test_lister__visit_suite,
+    /* .visit_case_mt = */ zt_test_lister__visit_case_mt,
+    /* .visit_setup = */ zt_test_lister__visit_setup,
+    /* .visit_case_with = */ zt_test_lister__visit_case_with,
+};
+
+static zt_visitor zt_visitor_from_test_lister(zt_test_lister* lister)
+{
+    zt_visitor visitor;
+    visitor.id = lister;
+    visitor.vtab = &zt_test_lister__visitor_vtab;
+    return visitor;
+}
+
+/**
+ * zt_list_tests_from lists tests from given suite to a given file.
+ *
+ * Only test cases with path matching the pattern are listed, unless the
+ * pattern is NULL. The human format is an indented tree of suites and test
+ * cases, the other formats list test cases only. Returns false if memory
+ * cannot be allocated.
+ **/
+static bool zt_list_tests_from(FILE* stream, zt_test_suite_func tsuite, const char* pattern,
+    zt_list_format format)
+{
+    zt_test_lister lister;
+    memset(&lister, 0, sizeof lister);
+    lister.stream = stream;
+    lister.format = format;
+    lister.path_hash = ZT_FNV1A_OFFSET;
+    lister.filter.pattern = pattern;
+    tsuite(zt_visitor_from_test_lister(&lister));
+    if (format == ZT_LIST_JSON) {
+        fputs(lister.num_cases == 0 ? "[]\n" : "\n]\n", stream);
+    }
+    zt_buffer_free(&lister.path);
+    zt_buffer_free(&lister.filter.path);
+    return !lister.oom;
+}
+
+/**
+ * zt_test_table_check_setup applies outcomes of setup functions to an entry.
+ *
+ * Entries must be checked in table order. Test cases following a failed
+ * setup function of an enclosing suite fail without being executed,
+ * setup functions following it, or following a fail-fast stop, are not
+ * executed at all. Returns true if the entry is a test case or a setup
+ * function that still needs to be executed.
+ **/
+static bool zt_test_table_check_setup(zt_test_table* table, zt_setup_state* setup,
+    zt_test_entry* entry)
+{
+    zt_setup_state__leave_suite(setup, entry->nesting);
+    if (entry->done) {
+        return false;
+    }
+    switch (entry->kind) {
+    case ZT_ENTRY_SETUP:
+        if (zt_setup_state__failed(setup, entry->nesting) || zt_test_table_stopped(table)) {
+            entry->cancelled = true;
+            entry->done = true;
+            return false;
+        }
+        return true;
+    case ZT_ENTRY_CASE:
+        if (zt_setup_state__failed(setup, entry->nesting)) {
+            entry->failed_setup = setup->failed_name;
+            entry->outcome = ZT_FAILED;
+            zt_test_table_finish(table, entry);
+            return false;
+        }
+        return true;
+    case ZT_ENTRY_SUITE:
+    default:
+        return false;
+    }
+}
+
+/**
+ * zt_test_table_apply_timeout gives the default timeout to entries without their own.
+ *
+ * Returns true if any test case or setup has a timeout.
+ **/
+static bool zt_test_table_apply_timeout(zt_test_table* table, uint32_t timeout)
+{
+    bool any = false;
+    size_t i;
+    for (i = 0; i < table->len; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        if (entry->kind != ZT_ENTRY_SUITE && entry->timeout == 0) {
+            entry->timeout = timeout;
+        }
+        any = any || entry->timeout > 0;
+    }
+    return any;
+}
+
+/** zt_test_table_limit returns the number of leading entries that may be executed now. */
+static size_t zt_test_table_limit(const zt_test_table* table)
+{
+    return table->limit != 0 ? table->limit : table->len;
+}
+
+#ifdef ZT_HAVE_POSIX
+/**
+ * zt_test_table_run_setups runs the suite setup functions of the next segment.
+ *
+ * The segment starts at the given entry and ends before the first setup
+ * function that follows a test case still to be executed. Setup functions
+ * of the segment run before any of its test cases is executed in another
+ * process or thread, and after all the test cases of earlier segments,
+ * so that every test case observes the state prepared by exactly the
+ * setup functions preceding it, as in serial execution. Test cases
+ * executed in child processes inherit that state without repeating the
+ * work. Messages are captured and reported in table order.
+ *
+ * The limit of the table is set to the end of the segment, which is
+ * returned.
+ **/
+static size_t zt_test_table_run_setups(zt_test_table* table, zt_setup_state* setup,
+    size_t begin, FILE* stream_err)
+{
+    bool pending = false;
+    size_t i;
+    for (i = begin; i < table->len; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        if (entry->kind == ZT_ENTRY_SETUP && pending) {
+            break;
+        }
+        if (!zt_test_table_check_setup(table, setup, entry)) {
+            continue;
+        }
+        if (entry->kind == ZT_ENTRY_SETUP) {
+            entry->outcome = zt_run_captured_test_case(stream_err, entry->func,
+                entry->name, entry->timeout, &entry->elapsed, &entry->output);
+            zt_test_table_finish(table, entry);
+            zt_setup_state__record(setup, entry->nesting, entry->name, entry->outcome);
+        } else {
+            pending = true;
+        }
+    }
+    table->limit = i;
+    return i;
+}
+#endif
+
+/** zt_test_runner__report_output reports messages captured while executing an entry. */
+static void zt_test_runner__report_output(zt_test_runner* runner, zt_test_entry* entry)
+{
+    if (entry->output.len > 0 && runner->stream_err) {
+        zt_test_runner__write(runner, runner->stream_err, entry->output.data, entry->output.len);
+    }
+    zt_buffer_free(&entry->output);
+}
+
+/** zt_test_runner__report_name reports the name of a test case, in verbose mode. */
+static void zt_test_runner__report_name(zt_test_runner* runner, const zt_test_entry* entry)
+{
+    if (runner->verbose && runner->stream_out && entry->pinned) {
+        zt_test_runner__printf(runner, runner->stream_out, "%*c %s (cpu %d)", entry->nesting * 3, '-', entry->name, entry->cpu);
+    } else if (runner->verbose && runner->stream_out) {
+        zt_test_runner__printf(runner, runner->stream_out, "%*c %s", entry->nesting * 3, '-', entry->name);
+    }
+}
+
+/**
+ * zt_test_runner__report_entries reports entries with known outcome.
+ *
+ * Entries are reported strictly in table order, up to the first entry
+ * with unknown outcome. Together with messages captured while executing
+ * each entry, this makes the output identical to that of the serial
+ * runner, regardless of the order of execution.
+ **/
+static void zt_test_runner__report_entries(zt_test_runner* runner,
+    zt_test_table* table)
+{
+    while (table->reported < table->len && table->entries[table->reported].done) {
+        zt_test_entry* entry = &table->entries[table->reported];
+        switch (entry->kind) {
+        case ZT_ENTRY_SUITE:
+            if (runner->verbose && runner->stream_out) {
+                zt_test_runner__printf(runner, runner->stream_out, "%*c %s\n", entry->nesting * 3, '+', entry->name);
+            }
+            break;
+        case ZT_ENTRY_SETUP:
+            if (!entry->cancelled) {
+                zt_test_runner__report_output(runner, entry);
+                zt_test_runner__record_setup(runner, entry->nesting, entry->name, entry->outcome);
+            }
+            break;
+        case ZT_ENTRY_CASE:
+        default:
+            if (entry->excluded) {
+                break;
+            }
+            if (!entry->announced) {
+                zt_test_runner__report_name(runner, entry);
+            }
+            zt_test_runner__report_output(runner, entry);
+            if (entry->failed_setup != NULL) {
+                zt_test_runner__record_skipped(runner, entry->nesting, entry->name, entry->failed_setup);
+            } else if (entry->cancelled) {
+                zt_test_runner__record_cancelled(runner);
+            } else {
+                zt_test_runner__record_outcome(runner, entry->nesting, entry->name, entry->outcome);
+            }
+            break;
+        }
+        table->reported++;
+    }
+    zt_test_runner__flush(runner);
+}
+
+/**
+ * zt_test_runner__run_entry runs a test case or setup function in-process.
+ *
+ * Without an output queue messages are written directly, after the name of
+ * a test case was reported and flushed, see zt_test_runner__flush_before.
+ * Otherwise they are captured and reported in table order.
+ **/
+static void zt_test_runner__run_entry(zt_test_runner* runner, zt_test_table* table,
+    zt_test_entry* entry)
+{
+    if (runner->output != NULL) {
+        entry->outcome = zt_run_captured_test_case(runner->stream_err, entry->func,
+            entry->name, entry->timeout, &entry->elapsed, &entry->output);
+    } else {
+        if (entry->kind == ZT_ENTRY_CASE && table->reported == (size_t)(entry - table->entries)) {
+            zt_test_runner__report_name(runner, entry);
+            entry->announced = true;
+        }
+        zt_test_runner__flush_before(runner, runner->stream_err);
+        entry->outcome = zt_run_timed_test_case(runner->stream_err, entry->func,
+            entry->name, entry->timeout, &entry->elapsed);
+    }
+    zt_test_table_finish(table, entry);
+}
+
+/**
+ * zt_run_tests_in_process runs test cases from a table sequentially.
+ *
+ * Setup functions not executed yet are executed when reached, just before
+ * the test cases that follow them.
+ **/
+static void zt_run_tests_in_process(zt_test_runner* runner, zt_test_table* table)
+{
+    zt_setup_state setup;
+    size_t limit = zt_test_table_limit(table);
+    size_t i;
+
+    memset(&setup, 0, sizeof setup);
+    for (i = 0; i < limit; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        if (!zt_test_table_check_setup(table, &setup, entry)) {
+            /* Suites and entries with known outcome are only reported. */
+        } else if (entry->kind == ZT_ENTRY_SETUP) {
+            zt_test_runner__run_entry(runner, table, entry);
+            zt_setup_state__record(&setup, entry->nesting, entry->name, entry->outcome);
+        } else if (zt_test_table_stopped(table)) {
+            zt_test_entry__cancel(entry);
+        } else {
+            zt_test_runner__run_entry(runner, table, entry);
+            entry->timed = true;
+        }
+        entry->done = true;
+        zt_test_runner__report_entries(runner, table);
+    }
+}
+
+#ifdef ZT_HAVE_POSIX
+/** zt_compare_longest_first orders test entries by decreasing expected duration. */
+static int zt_compare_longest_first(const void* a, const void* b)
+{
+    const zt_test_entry* entry_a = *(const zt_test_entry* const*)a;
+    const zt_test_entry* entry_b = *(const zt_test_entry* const*)b;
+    if (entry_a->expected != entry_b->expected) {
+        return entry_a->expected > entry_b->expected ? -1 : 1;
+    }
+    /* Entries with equal expected duration keep the table order. */
+    return entry_a < entry_b ? -1 : entry_a > entry_b;
+}
+
+/**
+ * zt_test_table_sort_longest_first sorts test table indices for scheduling.
+ *
+ * When the table is scheduled longest first, indices are sorted by
+ * decreasing expected duration, so that a long test case does not start
+ * last and delay the end of a parallel run. Otherwise the order is kept.
+ **/
+static void zt_test_table_sort_longest_first(const zt_test_table* table, size_t* items,
+    size_t num_items)
+{
+    const zt_test_entry** sorted;
+    size_t i;
+
+    if (!table->longest_first || num_items < 2) {
+        return;
+    }
+    sorted = (const zt_test_entry**)calloc(num_items, sizeof *sorted);
+    if (sorted == NULL) {
+        /* The order of execution is only an optimization. */
+        return;
+    }
+    for (i = 0; i < num_items; i++) {
+        sorted[i] = &table->entries[items[i]];
+    }
+    qsort(sorted, num_items, sizeof *sorted, zt_compare_longest_first);
+    for (i = 0; i < num_items; i++) {
+        items[i] = (size_t)(sorted[i] - table->entries);
+    }
+    free(sorted);
+}
+#endif
+
+/**
+ * zt_compare_shard_order orders test entries for assignment to shards.
+ *
+ * Entries are ordered by decreasing expected duration, like for scheduling,
+ * but ties are broken by path hash, which does not depend on the order of
+ * the table.
+ **/
+static int zt_compare_shard_order(const void* a, const void* b)
+{
+    const zt_test_entry* entry_a = *(const zt_test_entry* const*)a;
+    const zt_test_entry* entry_b = *(const zt_test_entry* const*)b;
+    if (entry_a->expected != entry_b->expected) {
+        return entry_a->expected > entry_b->expected ? -1 : 1;
+    }
+    if (entry_a->path_hash != entry_b->path_hash) {
+        return entry_a->path_hash < entry_b->path_hash ? -1 : 1;
+    }
+    return entry_a < entry_b ? -1 : entry_a > entry_b;
+}
+
+/**
+ * zt_test_table_shard excludes test cases that belong to other shards.
+ *
+ * Without duration history each test case is assigned to a shard by its
+ * path hash. With history, test cases are assigned longest first, each to
+ * the shard with the smallest total expected duration so far. Either way
+ * the assignment only depends on the collected test cases and on the
+ * history, so that separate machines agree on it without coordination. The
+ * table must be sharded before it is reordered.
+ **/
+static bool zt_test_table_shard(zt_test_table* table, int shard, int num_shards)
+{
+    uint64_t* loads;
+    zt_test_entry** sorted;
+    size_t num_items = 0;
+    size_t i;
+
+    if (!table->longest_first) {
+        for (i = 0; i < table->len; i++) {
+            zt_test_entry* entry = &table->entries[i];
+            if (entry->kind == ZT_ENTRY_CASE && entry->path_hash % (uint64_t)num_shards != (uint64_t)shard) {
+                entry->excluded = true;
+                entry->done = true;
+            }
+        }
+        return true;
+    }
+    loads = (uint64_t*)calloc((size_t)num_shards, sizeof *loads);
+    sorted = (zt_test_entry**)calloc(table->len + 1, sizeof *sorted);
+    if (loads == NULL || sorted == NULL) {
+        free(loads);
+        free(sorted);
+        return false;
+    }
+    for (i = 0; i < table->len; i++) {
+        if (table->entries[i].kind == ZT_ENTRY_CASE) {
+            sorted[num_items++] = &table->entries[i];
+        }
+    }
+    qsort(sorted, num_items, sizeof *sorted, zt_compare_shard_order);
+    for (i = 0; i < num_items; i++) {
+        zt_test_entry* entry = sorted[i];
+        int lightest = 0;
+        int s;
+        for (s = 1; s < num_shards; s++) {
+            if (loads[s] < loads[lightest]) {
+                lightest = s;
+            }
+        }
+        loads[lightest] += entry->expected;
+        if (lightest != shard) {
+            entry->excluded = true;
+            entry->done = true;
+        }
+    }
+    free(loads);
+    free(sorted);
+    return true;
+}
+
+/* Shuffling */
+
+/**
+ * zt_test_table__group_end returns the end of a group of siblings.
+ *
+ * Siblings start at begin and end before end. The group starting at group
+ * ends before the next setup function among the siblings, which is never
+ * moved when the table is reordered.
+ **/
+static size_t zt_test_table__group_end(const zt_test_entry* src, size_t begin, size_t end,
+    size_t group)
+{
+    while (group < end && !(src[group].kind == ZT_ENTRY_SETUP && src[group].nesting == src[begin].nesting)) {
+        group++;
+    }
+    return group;
+}
+
+/** zt_test_table__subtree_end returns the end of an entry and all the entries inside it. */
+static size_t zt_test_table__subtree_end(const zt_test_entry* src, size_t index, size_t end)
+{
+    size_t i = index + 1;
+    while (i < end && src[i].nesting > src[index].nesting) {
+        i++;
+    }
+    return i;
+}
+
+/** zt_test_table__link_parents finds parent indices again after the table was reordered. */
+static void zt_test_table__link_parents(zt_test_table* table)
+{
+    size_t i;
+    for (i = 0; i < table->len; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        size_t parent = i - 1;
+        if (entry->nesting == 0) {
+            entry->parent = ZT_NO_PARENT;
+            continue;
+        }
+        while (table->entries[parent].nesting >= entry->nesting) {
+            parent = table->entries[parent].parent;
+        }
+        entry->parent = parent;
+    }
+}
+
+/** zt_random_next returns the next number of the splitmix64 pseudo-random sequence. */
+static uint64_t zt_random_next(uint64_t* state)
+{
+    uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+/**
+ * zt_test_table__copy_shuffled copies siblings in random order.
+ *
+ * The siblings start at begin and end before end. Like with failed test
+ * cases first, siblings only move within the group between two setup
+ * functions, and entries inside suites are shuffled recursively. Indices of
+ * siblings are kept in order, which must have room for all the entries
+ * between begin and end. Returns the number of copied entries.
+ **/
+static size_t zt_test_table__copy_shuffled(const zt_test_entry* src, size_t begin, size_t end,
+    zt_test_entry* dst, size_t* order, uint64_t* random)
+{
+    size_t out = 0;
+    size_t group;
+    size_t i;
+
+    for (group = begin; group < end;) {
+        size_t group_end = zt_test_table__group_end(src, begin, end, group);
+        size_t num_siblings = 0;
+        for (i = group; i < group_end; i = zt_test_table__subtree_end(src, i, group_end)) {
+            order[num_siblings++] = i;
+        }
+        /* Fisher-Yates shuffle, the modulo bias is negligible for small counts. */
+        for (i = num_siblings; i > 1; i--) {
+            size_t j = (size_t)(zt_random_next(random) % i);
+            size_t tmp = order[i - 1];
+            order[i - 1] = order[j];
+            order[j] = tmp;
+        }
+        for (i = 0; i < num_siblings; i++) {
+            size_t first = order[i];
+            dst[out++] = src[first];
+            out += zt_test_table__copy_shuffled(src, first + 1, zt_test_table__subtree_end(src, first, group_end),
+                dst + out, order + num_siblings, random);
+        }
+        if (group_end < end) {
+            dst[out++] = src[group_end++];
+        }
+        group = group_end;
+    }
+    return out;
+}
+
+/**
+ * zt_test_table_shuffle reorders the table randomly, reproducibly for a given seed.
+ *
+ * The structure of suites is preserved and setup functions still precede
+ * the test cases that depend on them. Returns false if memory cannot be
+ * allocated.
+ **/
+static bool zt_test_table_shuffle(zt_test_table* table, unsigned long seed)
+{
+    zt_test_entry* entries;
+    size_t* order;
+    uint64_t random = seed;
+
+    if (table->len == 0) {
+        return true;
+    }
+    entries = (zt_test_entry*)malloc(table->cap * sizeof *entries);
+    order = (size_t*)malloc(table->len * sizeof *order);
+    if (entries == NULL || order == NULL) {
+        free(entries);
+        free(order);
+        return false;
+    }
+    zt_test_table__copy_shuffled(table->entries, 0, table->len, entries, order, &random);
+    free(order);
+    free(table->entries);
+    table->entries = entries;
+    zt_test_table__link_parents(table);
+    return true;
+}
+
+#ifdef ZT_HAVE_POSIX
+/**
+ * zt_test_table_pending_cases stores indices of test cases that were not executed.
+ *
+ * All the other entries are marked as done. Indices are sorted for
+ * scheduling and the number of stored indices is returned.
+ **/
+static size_t zt_test_table_pending_cases(zt_test_table* table, size_t* items)
+{
+    size_t limit = zt_test_table_limit(table);
+    size_t num_items = 0;
+    size_t i;
+
+    for (i = 0; i < limit; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        if (entry->kind == ZT_ENTRY_CASE && !entry->done) {
+            items[num_items++] = i;
+        } else {
+            entry->done = true;
+        }
+    }
+    zt_test_table_sort_longest_first(table, items, num_items);
+    return num_items;
+}
+
+/* Thread pool */
+
+struct zt_thread_pool;
+
+/**
+ * zt_worker is a thread executing thread-safe test cases.
+ *
+ * Each worker owns a double-ended queue of work, represented as a range
+ * [top, bottom) of the work items shared by the pool. The owner takes work
+ * from the bottom while idle workers steal work from the top. Each queue is
+ * guarded by its own lock, the only lock shared by all the workers counts
+ * failures in fail-fast mode.
+ **/
+typedef struct zt_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    size_t top;
+    size_t bottom;
+    struct zt_thread_pool* pool;
+} zt_worker;
+
+typedef struct zt_thread_pool {
+    zt_worker* workers;
+    int num_workers;
+    size_t* items; /**< indices of thread-safe test table entries. */
+    zt_test_table* table;
+    FILE* stream_err;
+    pthread_mutex_t lock; /**< guards the number of failures and the journal. */
+    int num_failed; /**< number of failures, including those before the pool started. */
+} zt_thread_pool;
+
+/** zt_worker_pop takes a work item from the bottom of the own queue. */
+static bool zt_worker_pop(zt_worker* worker, size_t* item)
+{
+    bool found = false;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->top < worker->bottom) {
+        worker->bottom--;
+        *item = worker->pool->items[worker->bottom];
+        found = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+/** zt_worker_steal takes a work item from the top of the queue of another worker. */
+static bool zt_worker_steal(zt_worker* victim, size_t* item)
+{
+    bool found = false;
+    pthread_mutex_lock(&victim->lock);
+    if (victim->top < victim->bottom) {
+        *item = victim->pool->items[victim->top];
+        victim->top++;
+        found = true;
+    }
+    pthread_mutex_unlock(&victim->lock);
+    return found;
+}
+
+/**
+ * zt_thread_pool_stopped returns true when fail-fast mode stops execution.
+ *
+ * A failure given as argument is counted first. The lock is only used in
+ * fail-fast mode.
+ **/
+static bool zt_thread_pool_stopped(zt_thread_pool* pool, bool failed)
+{
+    bool stopped;
+    if (pool->table->max_failures == 0) {
+        return false;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (failed) {
+        pool->num_failed++;
+    }
+    stopped = pool->table->max_failures > 0 && pool->num_failed >= pool->table->max_failures;
+    pthread_mutex_unlock(&pool->lock);
+    return stopped;
+}
+
+/**
+ * zt_worker_main executes test cases until there is no more work.
+ *
+ * Each test case gets a zt_test instance on the stack of the executing
+ * thread, so the jump buffer used by zt_assert() never crosses threads.
+ * Outcomes are stored in distinct table entries and need no locking,
+ * only appending them to the journal is serialized. Test cases left when
+ * fail-fast mode stops execution are never timed.
+ **/
+static void* zt_worker_main(void* arg)
+{
+    zt_worker* worker = (zt_worker*)arg;
+    zt_thread_pool* pool = worker->pool;
+    int self = (int)(worker - pool->workers);
+    zt_test_entry* entry;
+    bool failed = false;
+    size_t item;
+
+    for (;;) {
+        if (zt_thread_pool_stopped(pool, failed)) {
+            break;
+        }
+        if (!zt_worker_pop(worker, &item)) {
+            bool stolen = false;
+            int i;
+            /* No work is added once the pool is running, if all the queues
+             * are empty then the work is done. */
+            for (i = 1; i < pool->num_workers && !stolen; i++) {
+                stolen = zt_worker_steal(&pool->workers[(self + i) % pool->num_workers], &item);
+            }
+            if (!stolen) {
+                break;
+            }
+        }
+        entry = &pool->table->entries[item];
+        entry->outcome = zt_run_captured_test_case(pool->stream_err, entry->func,
+            entry->name, entry->timeout, &entry->elapsed, &entry->output);
+        entry->timed = true;
+        failed = entry->outcome != ZT_PENDING && entry->outcome != ZT_PASSED;
+        if (pool->table->journal != NULL) {
+            /* The outcome is journaled now, not when the pool is finished. */
+            pthread_mutex_lock(&pool->lock);
+            zt_journal_append(pool->table->journal, entry);
+            pthread_mutex_unlock(&pool->lock);
+            entry->journaled = true;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * zt_thread_pool_deal distributes work sorted longest first among workers.
+ *
+ * Work is dealt like cards, so that each worker gets a similar share of
+ * long test cases. Each queue is stored in reverse order, as the owner
+ * takes work from the bottom, longest first, and thieves steal the
+ * shortest work from the top.
+ **/
+static void zt_thread_pool_deal(zt_thread_pool* pool, size_t num_items)
+{
+    size_t n = (size_t)pool->num_workers;
+    size_t* dealt = (size_t*)calloc(num_items, sizeof *dealt);
+    size_t pos = 0;
+    size_t w;
+
+    for (w = 0; w < n; w++) {
+        size_t count = w < num_items ? (num_items - w + n - 1) / n : 0;
+        size_t k;
+        pool->workers[w].top = pos;
+        for (k = 0; k < count && dealt != NULL; k++) {
+            dealt[pos + count - 1 - k] = pool->items[w + k * n];
+        }
+        pos += count;
+        pool->workers[w].bottom = pos;
+    }
+    if (dealt != NULL) {
+        memcpy(pool->items, dealt, num_items * sizeof *dealt);
+        free(dealt);
+    }
+}
+
+/**
+ * zt_run_tests_in_threads runs thread-safe test cases from a table.
+ *
+ * The calling thread participates as the first worker. Work of any worker
+ * that failed to start is eventually stolen by the remaining workers.
+ * Outcomes are only marked as done after all the workers are joined, the
+ * caller is responsible for reporting them.
+ **/
+static void zt_run_tests_in_threads(zt_test_runner* runner, zt_test_table* table,
+    int num_threads)
+{
+    zt_thread_pool pool;
+    bool* started;
+    size_t limit = zt_test_table_limit(table);
+    size_t num_items = 0;
+    size_t i;
+    int w;
+
+    memset(&pool, 0, sizeof pool);
+    for (i = 0; i < limit; i++) {
+        const zt_test_entry* entry = &table->entries[i];
+        if (entry->kind == ZT_ENTRY_CASE && entry->thread_safe && !entry->done) {
+            num_items++;
+        }
+    }
+    if (num_items == 0) {
+        return;
+    }
+    pool.items = (size_t*)calloc(num_items, sizeof *pool.items);
+    pool.workers = (zt_worker*)calloc((size_t)num_threads, sizeof *pool.workers);
+    started = (bool*)calloc((size_t)num_threads, sizeof *started);
+    if (pool.items == NULL || pool.workers == NULL || started == NULL) {
+        /* Thread-safe test cases are executed like all the other ones. */
+        free(pool.items);
+        free(pool.workers);
+        free(started);
+        return;
+    }
+    pool.num_workers = num_threads;
+    pool.table = table;
+    pool.stream_err = runner->stream_err;
+    pool.num_failed = table->num_failed;
+    pthread_mutex_init(&pool.lock, NULL);
+    num_items = 0;
+    for (i = 0; i < limit; i++) {
+        const zt_test_entry* entry = &table->entries[i];
+        if (entry->kind == ZT_ENTRY_CASE && entry->thread_safe && !entry->done) {
+            pool.items[num_items++] = i;
+        }
+    }
+    zt_test_table_sort_longest_first(table, pool.items, num_items);
+    if (table->longest_first) {
+        zt_thread_pool_deal(&pool, num_items);
+    } else {
+        for (w = 0; w < num_threads; w++) {
+            zt_worker* worker = &pool.workers[w];
+            worker->top = num_items * (size_t)w / (size_t)num_threads;
+            worker->bottom = num_items * (size_t)(w + 1) / (size_t)num_threads;
+        }
+    }
+    for (w = 0; w < num_threads; w++) {
+        zt_worker* worker = &pool.workers[w];
+        worker->pool = &pool;
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+    for (w = 1; w < num_threads; w++) {
+        started[w] = pthread_create(&pool.workers[w].thread, NULL, zt_worker_main, &pool.workers[w]) == 0;
+    }
+    zt_worker_main(&pool.workers[0]);
+    for (w = 1; w < num_threads; w++) {
+        if (started[w]) {
+            pthread_join(pool.workers[w].thread, NULL);
+        }
+    }
+    for (w = 0; w < num_threads; w++) {
+        pthread_mutex_destroy(&pool.workers[w].lock);
+    }
+    pthread_mutex_destroy(&pool.lock);
+    for (i = 0; i < num_items; i++) {
+        zt_test_entry* entry = &table->entries[pool.items[i]];
+        if (entry->timed) {
+            zt_test_table_finish(table, entry);
+        } else {
+            zt_test_entry__cancel(entry);
+        }
+    }
+    free(pool.items);
+    free(pool.workers);
+    free(started);
+}
+
+/* Resource pool */
+
+/** zt_resource tracks the use of one resource by running test cases. */
+typedef struct zt_resource {
+    const char* name; /**< name of the resource, not terminated. */
+    size_t name_len;
+    int capacity;
+    int usage; /**< sum of weights of running test cases. */
+} zt_resource;
+
+/**
+ * zt_resource_pool limits the resources used by concurrently running test cases.
+ *
+ * A test case can start if each resource it needs has enough spare capacity
+ * for its weight, or is not used at all. The latter allows test cases with
+ * weight above the capacity to run, alone. An exclusive test case starts
+ * only when nothing else runs and blocks starting anything else.
+ **/
+typedef struct zt_resource_pool {
+    zt_resource* resources;
+    size_t len;
+    size_t cap;
+    int running; /**< number of running test cases. */
+    bool exclusive; /**< an exclusive test case is running. */
+} zt_resource_pool;
+
+static zt_resource* zt_resource_pool_find(const zt_resource_pool* pool,
+    const zt_resource_item* item)
+{
+    size_t i;
+    for (i = 0; i < pool->len; i++) {
+        zt_resource* res = &pool->resources[i];
+        if (res->name_len == item->name_len && strncmp(res->name, item->name, item->name_len) == 0) {
+            return res;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * zt_resource_pool_add adds all the resources from a descriptor to the pool.
+ *
+ * Capacities of new resources are equal to their weight, if given as
+ * capacities, or one otherwise. Existing resources are not changed.
+ **/
+static bool zt_resource_pool_add(zt_resource_pool* pool, const char* resources,
+    bool capacities)
+{
+    zt_resource_item item;
+    const char* cursor = resources;
+
+    while (zt_resources_next(&cursor, &item)) {
+        zt_resource* res;
+        if (zt_resource_item__is_exclusive(&item) || zt_resource_item__is_timeout(&item)
+            || zt_resource_pool_find(pool, &item) != NULL) {
+            continue;
+        }
+        if (pool->len == pool->cap) {
+            size_t cap = pool->cap != 0 ? pool->cap * 2 : 8;
+            res = (zt_resource*)realloc(pool->resources, cap * sizeof *res);
+            if (res == NULL) {
+                return false;
+            }
+            pool->resources = res;
+            pool->cap = cap;
+        }
+        res = &pool->resources[pool->len++];
+        res->name = item.name;
+        res->name_len = item.name_len;
+        res->capacity = capacities ? item.weight : 1;
+        res->usage = 0;
+    }
+    return true;
+}
+
+/**
+ * zt_resource_pool_init prepares a pool for test cases from a table.
+ *
+ * Capacities are described like resources of a test case. Resources
+ * without declared capacity have capacity of one.
+ **/
+static bool zt_resource_pool_init(zt_resource_pool* pool, const char* capacities,
+    const zt_test_table* table)
+{
+    size_t i;
+
+    memset(pool, 0, sizeof *pool);
+    if (capacities != NULL && !zt_resource_pool_add(pool, capacities, true)) {
+        return false;
+    }
+    for (i = 0; i < table->len; i++) {
+        const zt_test_entry* entry = &table->entries[i];
+        if (entry->resources != NULL && !zt_resource_pool_add(pool, entry->resources, false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void zt_resource_pool_free(zt_resource_pool* pool)
+{
+    free(pool->resources);
+    memset(pool, 0, sizeof *pool);
+}
+
+/** zt_resource_pool_fits returns true if a test case using given resources can start now. */
+static bool zt_resource_pool_fits(const zt_resource_pool* pool, const char* resources)
+{
+    zt_resource_item item;
+    const char* cursor = resources;
+
+    if (pool->exclusive) {
+        return false;
+    }
+    if (resources == NULL) {
+        return true;
+    }
+    while (zt_resources_next(&cursor, &item)) {
+        const zt_resource* res = zt_resource_pool_find(pool, &item);
+        if (zt_resource_item__is_exclusive(&item)) {
+            if (pool->running > 0) {
+                return false;
+            }
+        } else if (res != NULL && res->usage > 0 && item.weight > res->capacity - res->usage) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * zt_resource_pool_update acquires or releases resources of a test case.
+ *
+ * The sign of the argument selects the direction, it is one when a test
+ * case starts and minus one when it finishes.
+ **/
+static void zt_resource_pool_update(zt_resource_pool* pool, const char* resources, int sign)
+{
+    zt_resource_item item;
+    const char* cursor = resources;
+
+    pool->running += sign;
+    if (resources == NULL) {
+        return;
+    }
+    while (zt_resources_next(&cursor, &item)) {
+        zt_resource* res = zt_resource_pool_find(pool, &item);
+        if (zt_resource_item__is_exclusive(&item)) {
+            pool->exclusive = sign > 0;
+        } else if (res != NULL) {
+            res->usage += sign * item.weight;
+        }
+    }
+}
+
+/* CPU topology */
+
+#ifdef ZT_HAVE_AFFINITY
+/**
+ * zt_cpu_list_next parses the next range of a CPU list, like "0-3,8".
+ *
+ * Returns false at the end of the list, or on a syntax error, in which
+ * case the cursor does not point to the terminating NUL.
+ **/
+static bool zt_cpu_list_next(const char** cursor, int* first, int* last)
+{
+    const char* p = *cursor;
+    char* end = NULL;
+    long lo;
+    long hi;
+
+    if (!isdigit((unsigned char)*p)) {
+        return false;
+    }
+    errno = 0;
+    lo = hi = strtol(p, &end, 10);
+    if (*end == '-') {
+        if (!isdigit((unsigned char)end[1])) {
+            return false;
+        }
+        hi = strtol(end + 1, &end, 10);
+    }
+    if (errno != 0 || lo > hi || hi >= CPU_SETSIZE || (*end != '\0' && *end != ',')) {
+        return false;
+    }
+    *first = (int)lo;
+    *last = (int)hi;
+    /* A trailing comma is left in place, to fail parsing of the next range. */
+    *cursor = *end == ',' && end[1] != '\0' ? end + 1 : end;
+    return true;
+}
+
+/** zt_cpu_list_parse stores CPUs from a list, or all the CPUs for "all", in a set. */
+static bool zt_cpu_list_parse(const char* text, cpu_set_t* set)
+{
+    const char* cursor = text;
+    int first;
+    int last;
+
+    CPU_ZERO(set);
+    if (strcmp(text, "all") == 0) {
+        for (first = 0; first < CPU_SETSIZE; first++) {
+            CPU_SET((size_t)first, set);
+        }
+        return true;
+    }
+    while (zt_cpu_list_next(&cursor, &first, &last)) {
+        for (; first <= last; first++) {
+            CPU_SET((size_t)first, set);
+        }
+    }
+    return cursor != text && *cursor == '\0';
+}
+
+/** zt_read_cpu_attribute reads a topology attribute of a CPU from sysfs. */
+static int zt_read_cpu_attribute(const char* root, int cpu, const char* name, int fallback)
+{
+    char path[PATH_MAX];
+    FILE* file;
+    int value;
+
+    snprintf(path, sizeof path, "%s/cpu%d/topology/%s", root, cpu, name);
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return fallback;
+    }
+    if (fscanf(file, "%d", &value) != 1) {
+        value = fallback;
+    }
+    fclose(file);
+    return value;
+}
+
+static int zt_compare_cpus(const void* a, const void* b)
+{
+    const zt_cpu* cpu_a = (const zt_cpu*)a;
+    const zt_cpu* cpu_b = (const zt_cpu*)b;
+    if (cpu_a->thread != cpu_b->thread) {
+        return cpu_a->thread < cpu_b->thread ? -1 : 1;
+    }
+    if (cpu_a->package != cpu_b->package) {
+        return cpu_a->package < cpu_b->package ? -1 : 1;
+    }
+    if (cpu_a->core != cpu_b->core) {
+        return cpu_a->core < cpu_b->core ? -1 : 1;
+    }
+    return cpu_a->id < cpu_b->id ? -1 : cpu_a->id > cpu_b->id;
+}
+
+/**
+ * zt_cpu_topology_read describes selected CPUs using topology from sysfs.
+ *
+ * The root is normally /sys/devices/system/cpu. CPUs without topology
+ * information are treated as distinct cores of one package. With no_smt
+ * only the first hardware thread of each core is used.
+ **/
+static bool zt_cpu_topology_read(zt_cpu_topology* topo, const char* root,
+    const cpu_set_t* selected, bool no_smt)
+{
+    size_t i;
+    size_t n;
+    int id;
+
+    memset(topo, 0, sizeof *topo);
+    topo->cpus = (zt_cpu*)calloc((size_t)CPU_COUNT(selected) + 1, sizeof *topo->cpus);
+    if (topo->cpus == NULL) {
+        return false;
+    }
+    for (id = 0; id < CPU_SETSIZE; id++) {
+        if (CPU_ISSET((size_t)id, selected)) {
+            zt_cpu* cpu = &topo->cpus[topo->len++];
+            cpu->id = id;
+            cpu->package = zt_read_cpu_attribute(root, id, "physical_package_id", 0);
+            cpu->core = zt_read_cpu_attribute(root, id, "core_id", id);
+        }
+    }
+    /* Sorted by package and core, SMT siblings are adjacent. */
+    qsort(topo->cpus, topo->len, sizeof *topo->cpus, zt_compare_cpus);
+    for (i = 1, n = topo->len > 0; i < topo->len; i++) {
+        zt_cpu* prev = &topo->cpus[n - 1];
+        zt_cpu cpu = topo->cpus[i];
+        if (cpu.package == prev->package && cpu.core == prev->core) {
+            if (no_smt) {
+                continue;
+            }
+            cpu.thread = prev->thread + 1;
+        }
+        topo->cpus[n++] = cpu;
+    }
+    topo->len = n;
+    qsort(topo->cpus, topo->len, sizeof *topo->cpus, zt_compare_cpus);
+    return topo->len > 0;
+}
+
+/** zt_cpu_topology_init describes CPUs from a list that the process may use. */
+static bool zt_cpu_topology_init(zt_cpu_topology* topo, const char* list, bool no_smt)
+{
+    cpu_set_t selected;
+    cpu_set_t allowed;
+
+    memset(topo, 0, sizeof *topo);
+    if (!zt_cpu_list_parse(list, &selected) || sched_getaffinity(0, sizeof allowed, &allowed) < 0) {
+        return false;
+    }
+    CPU_AND(&selected, &selected, &allowed);
+    return zt_cpu_topology_read(topo, "/sys/devices/system/cpu", &selected, no_smt);
+}
+#endif
+
+static void zt_cpu_topology_free(zt_cpu_topology* topo)
+{
+    free(topo->cpus);
+    memset(topo, 0, sizeof *topo);
+}
+
+/**
+ * zt_test_runner__cpu returns the CPU for a slot of a test process, or -1.
+ *
+ * Slots are job slots of child processes or indices of worker processes.
+ **/
+static int zt_test_runner__cpu(const zt_test_runner* runner, size_t slot)
+{
+    if (runner->cpus == NULL || runner->cpus->len == 0) {
+        return -1;
+    }
+    return runner->cpus->cpus[slot % runner->cpus->len].id;
+}
+
+/** zt_cpu_pin pins the calling process to a CPU, unless the CPU is -1. */
+static void zt_cpu_pin(int cpu)
+{
+#ifdef ZT_HAVE_AFFINITY
+    cpu_set_t set;
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET((size_t)cpu, &set);
+        /* Test cases execute correctly, if more slowly, without pinning. */
+        (void)sched_setaffinity(0, sizeof set, &set);
+    }
+#else
+    (void)cpu;
+#endif
+}
+
+/** zt_test_entry__place records the CPU used to execute a test case. */
+static void zt_test_entry__place(zt_test_entry* entry, int cpu)
+{
+    entry->cpu = cpu;
+    entry->pinned = cpu >= 0;
+}
+
+/* Parallel runner */
+
+/** zt_result is sent by a child process after executing a test case. */
+typedef struct zt_result {
+    size_t index; /**< index of the test table entry. */
+    zt_outcome outcome;
+    uint32_t elapsed; /**< wall time of the test case in microseconds. */
+    uint64_t output_end; /**< size of the message file of a worker process after the test case. */
+} zt_result;
+
+/** zt_job describes a test case executing in a child process. */
+typedef struct zt_job {
+    pid_t pid; /**< process ID of the child, zero if the slot is free. */
+    int fd; /**< read end of the pipe carrying the result. */
+    int out_fd; /**< read end of the pipe carrying messages of the test case. */
+    size_t index; /**< index of the executing test table entry. */
+    uint64_t deadline; /**< time stamp in microseconds after which the child is killed, zero for none. */
+} zt_job;
+
+/**
+ * ZT_KILL_GRACE is the time in microseconds a child gets past the timeout of
+ * its test case before it is killed. With the watchdog the child reports the
+ * timeout itself, with a backtrace.
+ **/
+#ifdef ZT_HAVE_WATCHDOG
+#define ZT_KILL_GRACE 1000000u
+#else
+#define ZT_KILL_GRACE 0u
+#endif
+
+/**
+ * zt_read_available appends data available in a pipe to a buffer.
+ *
+ * Returns the number of bytes read, zero at the end of input or negative
+ * on error.
+ **/
+static ssize_t zt_read_available(int fd, zt_buffer* buf)
+{
+    ssize_t n;
+
+    if (!zt_buffer_reserve(buf, 4096)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    do {
+        n = read(fd, buf->data + buf->len, buf->cap - buf->len);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        buf->len += (size_t)n;
+    }
+    return n;
+}
+
+/**
+ * zt_open_output_stream returns a stream for messages of test cases in a child process.
+ *
+ * Messages are line buffered, so that the parent receives messages
+ * written before a crash. Falls back to stream_err.
+ **/
+static FILE* zt_open_output_stream(int fd, FILE* stream_err)
+{
+    FILE* stream = fdopen(fd, "w");
+    if (stream == NULL) {
+        return stream_err;
+    }
+    setvbuf(stream, NULL, _IOLBF, BUFSIZ);
+    return stream;
+}
+
+/**
+ * zt_job_start forks a child process executing one test case.
+ *
+ * The child runs the test case exactly like the serial runner would and
+ * writes the result to a pipe before exiting. A child that dies without
+ * writing the outcome has crashed. Messages written by the test case are
+ * sent over another pipe, so that they can be reported in order. The child
+ * is pinned to a CPU, unless the CPU is -1. A child running longer than
+ * the timeout of the test case, in seconds, is killed by the parent.
+ **/
+static bool zt_job_start(zt_job* job, zt_test_runner* runner, size_t index,
+    zt_test_case_func func, const char* name, uint32_t timeout, int cpu)
+{
+    int fds[2];
+    int out_fds[2];
+    pid_t pid;
+
+    if (pipe(fds) < 0) {
+        return false;
+    }
+    if (pipe(out_fds) < 0) {
+        int saved_errno = errno;
+        close(fds[0]);
+        close(fds[1]);
+        errno = saved_errno;
+        return false;
+    }
+    /* Flush all streams so that buffered output is not duplicated. */
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0) {
+        int saved_errno = errno;
+        close(fds[0]);
+        close(fds[1]);
+        close(out_fds[0]);
+        close(out_fds[1]);
+        errno = saved_errno;
+        return false;
+    }
+    if (pid == 0) {
+        zt_result result;
+        FILE* stream;
+        close(fds[0]);
+        close(out_fds[0]);
+        zt_cpu_pin(cpu);
+        stream = zt_open_output_stream(out_fds[1], runner->stream_err);
+        memset(&result, 0, sizeof result);
+        result.index = index;
+#ifdef ZT_HAVE_COVERAGE
+        if (runner->coverage != NULL) {
+            __gcov_reset();
+        }
+#endif
+        result.outcome = zt_run_timed_test_case(stream, func, name, timeout, &result.elapsed);
+        fflush(NULL);
+#ifdef ZT_HAVE_COVERAGE
+        if (runner->coverage != NULL) {
+            zt_coverage_record(runner->coverage, index);
+        }
+#endif
+        if (write(fds[1], &result, sizeof result) != (ssize_t)sizeof result) {
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    close(out_fds[1]);
+    job->pid = pid;
+    job->fd = fds[0];
+    job->out_fd = out_fds[0];
+    job->index = index;
+    job->deadline = timeout > 0 ? zt_clock_usec() + timeout * (uint64_t)1000000u + ZT_KILL_GRACE : 0;
+    return true;
+}
+
+/**
+ * zt_test_entry__record_crash records a test case that terminated its process.
+ *
+ * The message is reported like other messages of the test case, between
+ * its name and its outcome.
+ **/
+static void zt_test_entry__record_crash(zt_test_entry* entry, int status)
+{
+    if (WIFSIGNALED(status)) {
+        zt_buffer_printf(&entry->output, "test case %s killed by signal %d\n",
+            entry->name, WTERMSIG(status));
+    } else {
+        zt_buffer_printf(&entry->output, "test case %s exited with status %d\n",
+            entry->name, WEXITSTATUS(status));
+    }
+    entry->outcome = ZT_FAILED;
+}
+
+/**
+ * zt_job_finish waits for a child that closed its output and reads the result.
+ *
+ * The entry is expected to hold all the messages written by the child.
+ **/
+static void zt_job_finish(zt_job* job, zt_test_entry* entry)
+{
+    zt_result result;
+    ssize_t n;
+    int status = 0;
+
+    close(job->out_fd);
+    while (waitpid(job->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    do {
+        n = read(job->fd, &result, sizeof result);
+    } while (n < 0 && errno == EINTR);
+    close(job->fd);
+    job->pid = 0;
+    job->fd = -1;
+    job->out_fd = -1;
+    if (n == (ssize_t)sizeof result) {
+        entry->outcome = result.outcome;
+        entry->elapsed = result.elapsed;
+        entry->timed = true;
+    } else {
+        zt_test_entry__record_crash(entry, status);
+    }
+}
+
+/** zt_job_cancel kills a child executing a test case that is no longer needed. */
+static void zt_job_cancel(zt_job* job)
+{
+    int status;
+
+    kill(job->pid, SIGKILL);
+    close(job->out_fd);
+    close(job->fd);
+    while (waitpid(job->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    job->pid = 0;
+    job->fd = -1;
+    job->out_fd = -1;
+}
+
+/**
+ * zt_job_expire kills a child whose test case exceeded its timeout.
+ *
+ * Messages the child wrote before it was killed are kept.
+ **/
+static void zt_job_expire(zt_job* job, zt_test_entry* entry)
+{
+    struct pollfd pfd;
+
+    pfd.fd = job->out_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    while (poll(&pfd, 1, 0) > 0 && zt_read_available(job->out_fd, &entry->output) > 0) {
+    }
+    zt_job_cancel(job);
+    zt_buffer_printf(&entry->output, "test case %s killed after exceeding the timeout of %lu second%s\n",
+        entry->name, (unsigned long)entry->timeout, entry->timeout == 1 ? "" : "s");
+    entry->outcome = ZT_FAILED;
+}
+
+/**
+ * zt_job_timeout returns the poll timeout in milliseconds until the nearest deadline of a job.
+ *
+ * Returns -1 if no job has a deadline.
+ **/
+static int zt_job_timeout(const zt_job* jobs, int max_jobs, uint64_t now)
+{
+    uint64_t nearest = 0;
+    uint64_t left;
+    int i;
+
+    for (i = 0; i < max_jobs; i++) {
+        if (jobs[i].pid != 0 && jobs[i].deadline != 0 && (nearest == 0 || jobs[i].deadline < nearest)) {
+            nearest = jobs[i].deadline;
+        }
+    }
+    if (nearest == 0) {
+        return -1;
+    }
+    left = nearest > now ? (nearest - now + 999u) / 1000u : 0;
+    return left < INT_MAX ? (int)left : INT_MAX;
+}
+
+/**
+ * zt_run_tests_in_parallel runs test cases from a table in child processes.
+ *
+ * At most max_jobs children run at any time. Each test case is executed in
+ * a separate child so that a crash only affects the crashing test case.
+ * Test cases using resources start only when the resources are available,
+ * in the meantime the next test cases that fit are started instead.
+ * Children exceeding the timeout of their test case are killed. Outcomes
+ * are reported in table order.
+ **/
+static void zt_run_tests_in_parallel(zt_test_runner* runner, zt_test_table* table,
+    int max_jobs, const char* capacities)
+{
+    zt_resource_pool pool;
+    zt_job* jobs;
+    struct pollfd* pfds;
+    size_t* items;
+    size_t num_items;
+    size_t next = 0;
+    uint64_t now;
+    int running = 0;
+    int i;
+
+    memset(&pool, 0, sizeof pool);
+    jobs = (zt_job*)calloc((size_t)max_jobs, sizeof *jobs);
+    pfds = (struct pollfd*)calloc((size_t)max_jobs, sizeof *pfds);
+    items = (size_t*)calloc(table->len + 1, sizeof *items);
+    if (jobs == NULL || pfds == NULL || items == NULL || !zt_resource_pool_init(&pool, capacities, table)) {
+        if (runner->stream_err) {
+            zt_test_runner__printf(runner, runner->stream_err, "cannot allocate memory for %d jobs\n", max_jobs);
+        }
+        runner->num_failed++;
+        zt_resource_pool_free(&pool);
+        free(jobs);
+        free(pfds);
+        free(items);
+        return;
+    }
+    num_items = zt_test_table_pending_cases(table, items);
+    for (;;) {
+        int num_pfds = 0;
+
+        if (zt_test_table_stopped(table)) {
+            /* Fail fast, cancelling test cases in flight and not yet started. */
+            for (i = 0; i < max_jobs; i++) {
+                if (jobs[i].pid != 0) {
+                    zt_job_cancel(&jobs[i]);
+                    zt_test_entry__cancel(&table->entries[jobs[i].index]);
+                    running--;
+                }
+            }
+            for (; next < num_items; next++) {
+                zt_test_entry__cancel(&table->entries[items[next]]);
+            }
+        }
+        while (next < num_items && running < max_jobs && !pool.exclusive) {
+            zt_test_entry* entry;
+            size_t item;
+            size_t k;
+            /* Pick the first test case whose resources are available. */
+            for (k = next; k < num_items && !zt_resource_pool_fits(&pool, table->entries[items[k]].resources); k++) {
+            }
+            if (k == num_items) {
+                break;
+            }
+            item = items[k];
+            memmove(&items[next + 1], &items[next], (k - next) * sizeof *items);
+            items[next] = item;
+            entry = &table->entries[item];
+            for (i = 0; jobs[i].pid != 0; i++) {
+            }
+            if (zt_job_start(&jobs[i], runner, item, entry->func, entry->name, entry->timeout,
+                    zt_test_runner__cpu(runner, (size_t)i))) {
+                zt_test_entry__place(entry, zt_test_runner__cpu(runner, (size_t)i));
+                zt_resource_pool_update(&pool, entry->resources, 1);
+                running++;
+            } else {
+                zt_buffer_printf(&entry->output, "%*c %s - cannot start: %s\n",
+                    entry->nesting * 3, '-', entry->name, strerror(errno));
+                entry->outcome = ZT_FAILED;
+                zt_test_table_finish(table, entry);
+            }
+            next++;
+        }
+        zt_test_runner__report_entries(runner, table);
+        if (running == 0) {
+            break;
+        }
+        for (i = 0; i < max_jobs; i++) {
+            if (jobs[i].pid != 0) {
+                pfds[num_pfds].fd = jobs[i].out_fd;
+                pfds[num_pfds].events = POLLIN;
+                pfds[num_pfds].revents = 0;
+                num_pfds++;
+            }
+        }
+        if (poll(pfds, (nfds_t)num_pfds, zt_job_timeout(jobs, max_jobs, zt_clock_usec())) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        num_pfds = 0;
+        for (i = 0; i < max_jobs; i++) {
+            zt_test_entry* entry;
+            if (jobs[i].pid == 0 || pfds[num_pfds++].revents == 0) {
+                continue;
+            }
+            entry = &table->entries[jobs[i].index];
+            /* The end of output means that the child has finished. */
+            if (zt_read_available(jobs[i].out_fd, &entry->output) <= 0) {
+                zt_job_finish(&jobs[i], entry);
+                zt_test_table_finish(table, entry);
+                zt_resource_pool_update(&pool, entry->resources, -1);
+                running--;
+            }
+        }
+        now = zt_clock_usec();
+        for (i = 0; i < max_jobs; i++) {
+            zt_test_entry* entry;
+            if (jobs[i].pid == 0 || jobs[i].deadline == 0 || jobs[i].deadline > now) {
+                continue;
+            }
+            entry = &table->entries[jobs[i].index];
+            zt_job_expire(&jobs[i], entry);
+            zt_test_table_finish(table, entry);
+            zt_resource_pool_update(&pool, entry->resources, -1);
+            running--;
+        }
+    }
+    zt_resource_pool_free(&pool);
+    free(jobs);
+    free(pfds);
+    free(items);
+}
+
+/* Persistent worker processes */
+
+/**
+ * zt_worker_process is a long-lived child process executing test cases.
+ *
+ * The parent sends a batch of test table indices over one pipe and the
+ * worker sends back one result per test case over another pipe. The batch
+ * is a range of the array of pending work. Results arrive in batch order,
+ * so the first test case without a result is the one being executed.
+ *
+ * Messages of test cases are written to an unlinked temporary file and
+ * each result carries the size of the file after the test case, which
+ * tells apart messages of consecutive test cases. Messages of a test case
+ * that crashed are at the end of the file.
+ **/
+typedef struct zt_worker_process {
+    pid_t pid; /**< process ID of the worker, zero if there is no process. */
+    int batch_fd; /**< write end of the pipe carrying batches. */
+    int result_fd; /**< read end of the pipe carrying results. */
+    int out_fd; /**< temporary file with messages of test cases. */
+    uint64_t out_offset; /**< offset of messages of the test case being executed. */
+    size_t first; /**< index of the first work item of the batch. */
+    size_t count; /**< number of work items in the batch. */
+    size_t completed; /**< number of results received for the batch. */
+} zt_worker_process;
+
+/** zt_read_all reads exactly size bytes, returning false on error or end of file. */
+static bool zt_read_all(int fd, void* buf, size_t size)
+{
+    char* p = (char*)buf;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * zt_worker_process_main executes batches of test cases until end of input.
+ *
+ * Each batch is read entirely before any test case is executed, so that
+ * neither side is blocked writing while the other one is blocked writing
+ * as well. The function does not return.
+ **/
+static void zt_worker_process_main(FILE* stream, FILE* stderr_fallback, zt_test_table* table,
+    size_t batch_size, int batch_fd, int result_fd)
+{
+    size_t* batch = (size_t*)calloc(batch_size, sizeof *batch);
+    size_t count;
+
+    if (batch == NULL) {
+        _exit(EXIT_FAILURE);
+    }
+    while (zt_read_all(batch_fd, &count, sizeof count)) {
+        size_t i;
+        if (count > batch_size || !zt_read_all(batch_fd, batch, count * sizeof *batch)) {
+            _exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < count; i++) {
+            const zt_test_entry* entry = &table->entries[batch[i]];
+            zt_result result;
+            memset(&result, 0, sizeof result);
+            result.index = batch[i];
+            result.outcome = zt_run_timed_test_case(stream, entry->func, entry->name,
+                entry->timeout, &result.elapsed);
+            fflush(NULL);
+            if (stream != stderr_fallback) {
+                off_t end = lseek(fileno(stream), 0, SEEK_CUR);
+                result.output_end = end > 0 ? (uint64_t)end : 0;
+            }
+            if (!zt_write_all(result_fd, &result, sizeof result)) {
+                _exit(EXIT_FAILURE);
+            }
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/** zt_worker_process_start forks a new worker process. */
+static bool zt_worker_process_start(zt_worker_process* workers, int num_workers, int w,
+    zt_test_runner* runner, zt_test_table* table, size_t batch_size,
+    void (*sigpipe_handler)(int))
+{
+    FILE* out_file;
+    int fds[5];
+    pid_t pid;
+    int i;
+
+    out_file = tmpfile();
+    if (out_file == NULL) {
+        return false;
+    }
+    fds[4] = dup(fileno(out_file));
+    fclose(out_file);
+    if (fds[4] < 0) {
+        return false;
+    }
+    for (i = 0; i < 4; i += 2) {
+        if (pipe(&fds[i]) < 0) {
+            while (i > 0) {
+                close(fds[--i]);
+            }
+            close(fds[4]);
+            return false;
+        }
+    }
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0) {
+        for (i = 0; i < 5; i++) {
+            close(fds[i]);
+        }
+        return false;
+    }
+    if (pid == 0) {
+        /* Other workers must see the end of input when the parent closes it. */
+        for (i = 0; i < num_workers; i++) {
+            if (workers[i].pid != 0) {
+                close(workers[i].batch_fd);
+                close(workers[i].result_fd);
+                close(workers[i].out_fd);
+            }
+        }
+        close(fds[1]);
+        close(fds[2]);
+        signal(SIGPIPE, sigpipe_handler);
+        zt_cpu_pin(zt_test_runner__cpu(runner, (size_t)w));
+        zt_worker_process_main(zt_open_output_stream(fds[4], runner->stream_err),
+            runner->stream_err, table, batch_size, fds[0], fds[3]);
+    }
+    close(fds[0]);
+    close(fds[3]);
+    workers[w].pid = pid;
+    workers[w].batch_fd = fds[1];
+    workers[w].result_fd = fds[2];
+    workers[w].out_fd = fds[4];
+    workers[w].out_offset = 0;
+    return true;
+}
+
+/** zt_worker_process_stop closes the pipes and waits for the worker to exit. */
+static int zt_worker_process_stop(zt_worker_process* worker)
+{
+    int status = 0;
+    close(worker->batch_fd);
+    close(worker->result_fd);
+    close(worker->out_fd);
+    while (waitpid(worker->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    worker->pid = 0;
+    return status;
+}
+
+/**
+ * zt_worker_process_read_output moves messages of a test case to its entry.
+ *
+ * Messages are read from the current offset up to a given end offset or,
+ * when the worker has crashed, up to the end of the file.
+ **/
+static void zt_worker_process_read_output(zt_worker_process* worker, zt_test_entry* entry,
+    bool crashed, uint64_t end)
+{
+    if (crashed) {
+        struct stat st;
+        end = fstat(worker->out_fd, &st) == 0 && st.st_size > 0 ? (uint64_t)st.st_size : 0;
+    }
+    while (worker->out_offset < end) {
+        ssize_t n;
+        size_t len = end - worker->out_offset < 4096 ? (size_t)(end - worker->out_offset) : 4096;
+        if (!zt_buffer_reserve(&entry->output, len)) {
+            break;
+        }
+        n = pread(worker->out_fd, entry->output.data + entry->output.len, len, (off_t)worker->out_offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        entry->output.len += (size_t)n;
+        worker->out_offset += (uint64_t)n;
+    }
+}
+
+/** zt_worker_process_send sends the remaining part of the batch to the worker. */
+static bool zt_worker_process_send(zt_worker_process* worker, const size_t* items,
+    size_t* buf)
+{
+    size_t count = worker->count - worker->completed;
+    buf[0] = count;
+    memcpy(&buf[1], &items[worker->first + worker->completed], count * sizeof *buf);
+    return zt_write_all(worker->batch_fd, buf, (count + 1) * sizeof *buf);
+}
+
+/**
+ * zt_run_tests_in_workers runs test cases from a table in persistent workers.
+ *
+ * Up to num_workers processes execute batches of up to batch_size test
+ * cases each, amortizing the cost of creating processes. When a worker dies
+ * the test case it was executing is failed, a new worker is started and
+ * the remaining part of the batch is resent to the new worker. Test cases
+ * using resources are not batched, they are executed afterwards, one per
+ * process, honoring the capacities of resources.
+ **/
+static void zt_run_tests_in_workers(zt_test_runner* runner, zt_test_table* table,
+    int num_workers, size_t batch_size, const char* capacities)
+{
+    zt_worker_process* workers;
+    struct pollfd* pfds;
+    size_t* items;
+    size_t* buf;
+    size_t num_items;
+    size_t num_tagged = 0;
+    size_t next = 0;
+    size_t i;
+    int w;
+    void (*sigpipe_handler)(int);
+
+    workers = (zt_worker_process*)calloc((size_t)num_workers, sizeof *workers);
+    pfds = (struct pollfd*)calloc((size_t)num_workers, sizeof *pfds);
+    items = (size_t*)calloc(table->len + 1, sizeof *items);
+    buf = (size_t*)calloc(batch_size + 1, sizeof *buf);
+    if (workers == NULL || pfds == NULL || items == NULL || buf == NULL) {
+        free(workers);
+        free(pfds);
+        free(items);
+        free(buf);
+        zt_run_tests_in_process(runner, table);
+        return;
+    }
+    num_items = zt_test_table_pending_cases(table, items);
+    for (i = 0; i < num_items; i++) {
+        if (table->entries[items[i]].resources != NULL) {
+            num_tagged++;
+        } else {
+            items[i - num_tagged] = items[i];
+        }
+    }
+    num_items -= num_tagged;
+    /* Writing to a pipe of a worker that crashed must not kill the runner. */
+    sigpipe_handler = signal(SIGPIPE, SIG_IGN);
+    for (;;) {
+        int num_pfds = 0;
+        int num_busy = 0;
+
+        if (zt_test_table_stopped(table)) {
+            /* Fail fast, killing busy workers and cancelling the rest of their batches. */
+            for (w = 0; w < num_workers; w++) {
+                zt_worker_process* worker = &workers[w];
+                if (worker->completed < worker->count) {
+                    if (worker->pid != 0) {
+                        kill(worker->pid, SIGKILL);
+                    }
+                    for (i = worker->first + worker->completed; i < worker->first + worker->count; i++) {
+                        zt_test_entry__cancel(&table->entries[items[i]]);
+                    }
+                    worker->count = worker->completed;
+                }
+            }
+            for (; next < num_items; next++) {
+                zt_test_entry__cancel(&table->entries[items[next]]);
+            }
+        }
+        /* Hand out batches to idle workers, starting them as necessary. */
+        for (w = 0; w < num_workers && next < num_items; w++) {
+            zt_worker_process* worker = &workers[w];
+            if (worker->completed < worker->count) {
+                continue;
+            }
+            if (worker->pid == 0 && !zt_worker_process_start(workers, num_workers, w, runner, table, batch_size, sigpipe_handler)) {
+                continue;
+            }
+            worker->first = next;
+            worker->count = num_items - next < batch_size ? num_items - next : batch_size;
+            worker->completed = 0;
+            next += worker->count;
+            /* If the worker is gone this is noticed when reading results. */
+            (void)zt_worker_process_send(worker, items, buf);
+        }
+        zt_test_runner__report_entries(runner, table);
+        for (w = 0; w < num_workers; w++) {
+            if (workers[w].completed < workers[w].count) {
+                pfds[num_busy].fd = workers[w].result_fd;
+                pfds[num_busy].events = POLLIN;
+                pfds[num_busy].revents = 0;
+                num_busy++;
+            }
+        }
+        if (num_busy == 0) {
+            break;
+        }
+        if (poll(pfds, (nfds_t)num_busy, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (w = 0; w < num_workers; w++) {
+            zt_worker_process* worker = &workers[w];
+            zt_test_entry* entry;
+            zt_result result;
+            size_t index;
+            if (worker->completed == worker->count) {
+                continue;
+            }
+            if (pfds[num_pfds++].revents == 0) {
+                continue;
+            }
+            index = items[worker->first + worker->completed];
+            entry = &table->entries[index];
+            if (zt_read_all(worker->result_fd, &result, sizeof result) && result.index == index) {
+                zt_worker_process_read_output(worker, entry, false, result.output_end);
+                zt_test_entry__place(entry, zt_test_runner__cpu(runner, (size_t)w));
+                entry->outcome = result.outcome;
+                entry->elapsed = result.elapsed;
+                entry->timed = true;
+                zt_test_table_finish(table, entry);
+                worker->completed++;
+            } else {
+                zt_worker_process_read_output(worker, entry, true, 0);
+                zt_test_entry__place(entry, zt_test_runner__cpu(runner, (size_t)w));
+                zt_test_entry__record_crash(entry, zt_worker_process_stop(worker));
+                zt_test_table_finish(table, entry);
+                worker->completed++;
+                /* Carry on with the rest of the batch in a new worker. */
+                if (worker->completed < worker->count && !zt_test_table_stopped(table)) {
+                    if (!zt_worker_process_start(workers, num_workers, w, runner, table, batch_size, sigpipe_handler)
+                        || !zt_worker_process_send(worker, items, buf)) {
+                        /* Give the rest of the batch back to the in-process runner. */
+                        worker->count = worker->completed;
+                    }
+                }
+            }
+        }
+    }
+    for (w = 0; w < num_workers; w++) {
+        if (workers[w].pid != 0) {
+            zt_worker_process_stop(&workers[w]);
+        }
+    }
+    free(workers);
+    free(pfds);
+    free(items);
+    free(buf);
+    signal(SIGPIPE, sigpipe_handler);
+    if (num_tagged > 0) {
+        zt_run_tests_in_parallel(runner, table, num_workers, capacities);
+    }
+    /* Test cases without a worker process are executed in-process. */
+    zt_run_tests_in_process(runner, table);
+}
+
+/* Duration history */
+
+/** ZT_HISTORY_MAGIC identifies history files, it reads "ZTDH" on little-endian machines. */
+#define ZT_HISTORY_MAGIC 0x4844545au
+#define ZT_HISTORY_VERSION 1u
+
+/**
+ * zt_history_header is stored at the start of a duration history file.
+ *
+ * The header is followed by an array of len sorted path hashes and by an
+ * array of len durations, in microseconds, of the corresponding test cases.
+ * All the values are stored in native byte order, files coming from a
+ * machine with different byte order are ignored.
+ **/
+typedef struct zt_history_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t len;
+} zt_history_header;
+
+/** zt_history is a read-only memory mapping of a duration history file. */
+typedef struct zt_history {
+    void* map;
+    size_t map_size;
+    const uint64_t* hashes; /**< sorted path hashes of test cases. */
+    const uint32_t* durations; /**< durations in microseconds, parallel to hashes. */
+    size_t len;
+} zt_history;
+
+/** zt_history_record is one record of a history file during an update. */
+typedef struct zt_history_record {
+    uint64_t hash;
+    uint32_t duration;
+    uint32_t age; /**< zero for measured durations, one for old durations. */
+} zt_history_record;
+
+/**
+ * zt_history_open maps a duration history file into memory.
+ *
+ * A file that does not exist or is not valid is treated like an empty
+ * history. It is replaced when the history is saved.
+ **/
+static void zt_history_open(zt_history* history, const char* path)
+{
+    zt_history_header header;
+    struct stat st;
+    void* map;
+    int fd;
+
+    memset(history, 0, sizeof *history);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof header) {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    memcpy(&header, map, sizeof header);
+    if (header.magic != ZT_HISTORY_MAGIC || header.version != ZT_HISTORY_VERSION
+        || header.len > ((size_t)st.st_size - sizeof header) / (sizeof(uint64_t) + sizeof(uint32_t))
+        || sizeof header + header.len * (sizeof(uint64_t) + sizeof(uint32_t)) != (size_t)st.st_size) {
+        munmap(map, (size_t)st.st_size);
+        return;
+    }
+    history->map = map;
+    history->map_size = (size_t)st.st_size;
+    history->len = (size_t)header.len;
+    history->hashes = (const uint64_t*)((const char*)map + sizeof header);
+    history->durations = (const uint32_t*)(history->hashes + history->len);
+}
+
+static void zt_history_close(zt_history* history)
+{
+    if (history->map != NULL) {
+        munmap(history->map, history->map_size);
+    }
+    memset(history, 0, sizeof *history);
+}
+
+/** zt_history_find looks up the duration of a test case with a given path hash. */
+static bool zt_history_find(const zt_history* history, uint64_t hash, uint32_t* duration)
+{
+    size_t lo = 0;
+    size_t hi = history->len;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (history->hashes[mid] < hash) {
+            lo = mid + 1;
+        } else if (history->hashes[mid] > hash) {
+            hi = mid;
+        } else {
+            *duration = history->durations[mid];
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * zt_history_estimate sets the expected duration of each test case.
+ *
+ * Test cases without history are expected to take the mean duration of
+ * the test cases with history. Unless no test case has history, the table
+ * is scheduled longest first.
+ **/
+static void zt_history_estimate(const zt_history* history, zt_test_table* table)
+{
+    uint64_t sum = 0;
+    size_t num_known = 0;
+    uint32_t mean = 0;
+    size_t i;
+
+    for (i = 0; i < table->len; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        if (entry->kind == ZT_ENTRY_CASE && zt_history_find(history, entry->path_hash, &entry->expected)) {
+            sum += entry->expected;
+            num_known++;
+        }
+    }
+    if (num_known > 0) {
+        mean = (uint32_t)(sum / num_known);
+    }
+    for (i = 0; i < table->len; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        uint32_t duration;
+        if (entry->kind == ZT_ENTRY_CASE && !zt_history_find(history, entry->path_hash, &duration)) {
+            entry->expected = mean;
+        }
+    }
+    table->longest_first = num_known > 0;
+}
+
+static int zt_compare_history_records(const void* a, const void* b)
+{
+    const zt_history_record* rec_a = (const zt_history_record*)a;
+    const zt_history_record* rec_b = (const zt_history_record*)b;
+    if (rec_a->hash != rec_b->hash) {
+        return rec_a->hash < rec_b->hash ? -1 : 1;
+    }
+    return rec_a->age < rec_b->age ? -1 : rec_a->age > rec_b->age;
+}
+
+/**
+ * zt_history_save stores measured durations of test cases in a history file.
+ *
+ * Each measured duration is averaged with the previous one, if any, to
+ * smooth out noise. Durations of test cases that were not executed are
+ * kept. The new file is written next to the old one and renamed over it,
+ * so that concurrent readers never see a partially written file.
+ **/
+static bool zt_history_save(const zt_history* history, const zt_test_table* table,
+    const char* path, FILE* stream_err)
+{
+    zt_history_record* records;
+    zt_history_header header;
+    char* buf = NULL;
+    char* tmp_path;
+    size_t num_records = 0;
+    size_t len = 0;
+    size_t size;
+    size_t i;
+    bool ok = false;
+    int fd;
+
+    records = (zt_history_record*)calloc(table->len + history->len + 1, sizeof *records);
+    tmp_path = (char*)malloc(strlen(path) + 32);
+    if (records == NULL || tmp_path == NULL) {
+        free(records);
+        free(tmp_path);
+        if (stream_err) {
+            fprintf(stream_err, "cannot save test durations to %s: %s\n", path, strerror(ENOMEM));
+        }
+        return false;
+    }
+    for (i = 0; i < table->len; i++) {
+        const zt_test_entry* entry = &table->entries[i];
+        if (entry->timed) {
+            zt_history_record* rec = &records[num_records++];
+            uint32_t old;
+            rec->hash = entry->path_hash;
+            rec->duration = entry->elapsed;
+            if (zt_history_find(history, entry->path_hash, &old)) {
+                rec->duration = (uint32_t)(((uint64_t)old + entry->elapsed + 1) / 2);
+            }
+        }
+    }
+    for (i = 0; i < history->len; i++) {
+        zt_history_record* rec = &records[num_records++];
+        rec->hash = history->hashes[i];
+        rec->duration = history->durations[i];
+        rec->age = 1;
+    }
+    qsort(records, num_records, sizeof *records, zt_compare_history_records);
+    /* Keep the most recent record for each hash. */
+    for (i = 0; i < num_records; i++) {
+        if (len == 0 || records[len - 1].hash != records[i].hash) {
+            records[len++] = records[i];
+        }
+    }
+    size = sizeof header + len * (sizeof(uint64_t) + sizeof(uint32_t));
+    buf = (char*)malloc(size);
+    if (buf != NULL) {
+        uint64_t* hashes = (uint64_t*)(buf + sizeof header);
+        uint32_t* durations = (uint32_t*)(hashes + len);
+        memset(&header, 0, sizeof header);
+        header.magic = ZT_HISTORY_MAGIC;
+        header.version = ZT_HISTORY_VERSION;
+        header.len = len;
+        memcpy(buf, &header, sizeof header);
+        for (i = 0; i < len; i++) {
+            hashes[i] = records[i].hash;
+            durations[i] = records[i].duration;
+        }
+        sprintf(tmp_path, "%s.%ld.tmp", path, (long)getpid());
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            ok = zt_write_all(fd, buf, size);
+            ok = close(fd) == 0 && ok;
+            ok = ok && rename(tmp_path, path) == 0;
+            if (!ok) {
+                int saved_errno = errno;
+                unlink(tmp_path);
+                errno = saved_errno;
+            }
+        }
+    } else {
+        errno = ENOMEM;
+    }
+    if (!ok && stream_err) {
+        fprintf(stream_err, "cannot save test durations to %s: %s\n", path, strerror(errno));
+    }
+    free(buf);
+    free(tmp_path);
+    free(records);
+    return ok;
+}
+
+/* Failed test cases state */
+
+/** ZT_FAILED_STATE_FILE is the default state file of --failed-first and --only-failed. */
+#define ZT_FAILED_STATE_FILE ".zt-failed"
+
+static int zt_compare_hashes(const void* a, const void* b)
+{
+    uint64_t hash_a = *(const uint64_t*)a;
+    uint64_t hash_b = *(const uint64_t*)b;
+    return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+/** zt_sort_hashes sorts hashes and removes duplicates, returning the new length. */
+static size_t zt_sort_hashes(uint64_t* hashes, size_t len)
+{
+    size_t n = 0;
+    size_t i;
+
+    if (len == 0) {
+        return 0;
+    }
+    qsort(hashes, len, sizeof *hashes, zt_compare_hashes);
+    for (i = 0; i < len; i++) {
+        if (n == 0 || hashes[n - 1] != hashes[i]) {
+            hashes[n++] = hashes[i];
+        }
+    }
+    return n;
+}
+
+/** zt_read_fd appends everything that can be read from a file descriptor to a buffer. */
+static bool zt_read_fd(int fd, zt_buffer* buf)
+{
+    char chunk[4096];
+    for (;;) {
+        ssize_t n = read(fd, chunk, sizeof chunk);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        if (!zt_buffer_append(buf, chunk, (size_t)n)) {
+            errno = ENOMEM;
+            return false;
+        }
+    }
+}
+
+/**
+ * zt_failed_state__next_line finds the next line of a state file.
+ *
+ * The path is set to the part of the line after the first tab, or to NULL
+ * if the line does not contain a tab. Returns the start of the next line.
+ **/
+static const char* zt_failed_state__next_line(const char* line, const char* end,
+    const char** path, const char** path_end)
+{
+    const char* eol = (const char*)memchr(line, '\n', (size_t)(end - line));
+    const char* tab;
+
+    if (eol == NULL) {
+        eol = end;
+    }
+    tab = (const char*)memchr(line, '\t', (size_t)(eol - line));
+    *path = tab != NULL ? tab + 1 : NULL;
+    *path_end = eol;
+    return eol < end ? eol + 1 : end;
+}
+
+/** zt_failed_state__is_program returns true for a line of the given test program. */
+static bool zt_failed_state__is_program(const char* line, const char* path, const char* program)
+{
+    size_t len = strlen(program);
+    return path != NULL && (size_t)(path - 1 - line) == len && memcmp(line, program, len) == 0;
+}
+
+/** zt_fnv1a_range continues computing the 64 bit FNV-1a hash of a range of characters. */
+static uint64_t zt_fnv1a_range(uint64_t hash, const char* str, const char* end)
+{
+    for (; str < end; str++) {
+        hash ^= (unsigned char)*str;
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+static void zt_failed_state_free(zt_failed_state* state)
+{
+    free(state->cases);
+    free(state->suites);
+    memset(state, 0, sizeof *state);
+}
+
+/**
+ * zt_failed_state_load reads test cases of a test program that failed previously.
+ *
+ * A file that does not exist is treated like an empty one. Path hashes of
+ * the suites containing failed test cases are computed as well, so that
+ * other suites can be skipped without being entered.
+ **/
+static bool zt_failed_state_load(zt_failed_state* state, const char* path, const char* program)
+{
+    zt_buffer buf;
+    const char* line;
+    const char* end;
+    size_t max_cases = 0;
+    size_t max_suites = 0;
+    bool ok;
+    int fd;
+
+    memset(state, 0, sizeof *state);
+    memset(&buf, 0, sizeof buf);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    ok = zt_read_fd(fd, &buf);
+    close(fd);
+    end = buf.data + buf.len;
+    for (line = buf.data; ok && line < end;) {
+        const char* p;
+        const char* p_end;
+        const char* next = zt_failed_state__next_line(line, end, &p, &p_end);
+        if (zt_failed_state__is_program(line, p, program)) {
+            max_cases++;
+            for (; p < p_end; p++) {
+                max_suites += *p == '/';
+            }
+        }
+        line = next;
+    }
+    if (ok && max_cases > 0) {
+        state->cases = (uint64_t*)malloc(max_cases * sizeof *state->cases);
+        state->suites = (uint64_t*)malloc((max_suites + 1) * sizeof *state->suites);
+        ok = state->cases != NULL && state->suites != NULL;
+    }
+    for (line = buf.data; ok && line < end;) {
+        const char* p;
+        const char* p_end;
+        const char* next = zt_failed_state__next_line(line, end, &p, &p_end);
+        if (zt_failed_state__is_program(line, p, program)) {
+            const char* q;
+            for (q = p; q < p_end; q++) {
+                if (*q == '/') {
+                    state->suites[state->num_suites++] = zt_fnv1a_range(ZT_FNV1A_OFFSET, p, q);
+                }
+            }
+            state->cases[state->num_cases++] = zt_fnv1a_range(ZT_FNV1A_OFFSET, p, p_end);
+        }
+        line = next;
+    }
+    zt_buffer_free(&buf);
+    if (!ok) {
+        zt_failed_state_free(state);
+        return false;
+    }
+    state->num_cases = zt_sort_hashes(state->cases, state->num_cases);
+    state->num_suites = zt_sort_hashes(state->suites, state->num_suites);
+    return true;
+}
+
+/**
+ * zt_test_table__copy_failed_first copies siblings, moving those with failed test cases first.
+ *
+ * The siblings start at begin and end before end. Suites containing test
+ * cases that failed previously, and such test cases, are copied before the
+ * other siblings, recursively. Setup functions are never moved, siblings
+ * only move within the group between two setup functions. Returns the
+ * number of copied entries.
+ **/
+static size_t zt_test_table__copy_failed_first(const zt_test_entry* src, size_t begin, size_t end,
+    zt_test_entry* dst, const zt_failed_state* state)
+{
+    size_t out = 0;
+    size_t group;
+    size_t i;
+
+    for (group = begin; group < end;) {
+        size_t group_end = zt_test_table__group_end(src, begin, end, group);
+        int pass;
+        for (pass = 0; pass < 2; pass++) {
+            for (i = group; i < group_end;) {
+                const zt_test_entry* entry = &src[i];
+                size_t subtree_end = zt_test_table__subtree_end(src, i, group_end);
+                bool failed = entry->kind == ZT_ENTRY_SUITE
+                    ? zt_hashes_contain(state->suites, state->num_suites, entry->path_hash)
+                    : zt_hashes_contain(state->cases, state->num_cases, entry->path_hash);
+                if (failed == (pass == 0)) {
+                    dst[out++] = *entry;
+                    out += zt_test_table__copy_failed_first(src, i + 1, subtree_end, dst + out, state);
+                }
+                i = subtree_end;
+            }
+        }
+        if (group_end < end) {
+            dst[out++] = src[group_end++];
+        }
+        group = group_end;
+    }
+    return out;
+}
+
+/**
+ * zt_test_table_failed_first reorders the table to execute failed test cases first.
+ *
+ * The structure of suites is preserved, so that the output describes it
+ * faithfully. Returns false if memory cannot be allocated.
+ **/
+static bool zt_test_table_failed_first(zt_test_table* table, const zt_failed_state* state)
+{
+    zt_test_entry* entries;
+
+    if (table->len == 0) {
+        return true;
+    }
+    entries = (zt_test_entry*)malloc(table->cap * sizeof *entries);
+    if (entries == NULL) {
+        return false;
+    }
+    zt_test_table__copy_failed_first(table->entries, 0, table->len, entries, state);
+    free(table->entries);
+    table->entries = entries;
+    zt_test_table__link_parents(table);
+    return true;
+}
+
+/** zt_state_update describes the outcome of this run for updating a state file. */
+typedef struct zt_state_update {
+    const zt_test_table* table;
+    const char* program;
+    const uint64_t* executed; /**< sorted path hashes of executed test cases. */
+    size_t num_executed;
+} zt_state_update;
+
+/**
+ * zt_failed_state__update computes the new content of a state file.
+ *
+ * Lines of other test programs are kept, as are lines of test cases that
+ * were not executed in this run, identified by the sorted path hashes of
+ * executed test cases. Lines of test cases that failed in this run follow.
+ **/
+static bool zt_failed_state__update(const zt_buffer* old, zt_buffer* out, void* data)
+{
+    const zt_state_update* update = (const zt_state_update*)data;
+    const zt_test_table* table = update->table;
+    const char* program = update->program;
+    const uint64_t* executed = update->executed;
+    size_t num_executed = update->num_executed;
+    const char* line = old->data;
+    const char* end = old->data + old->len;
+    size_t i;
+
+    while (line < end) {
+        const char* p;
+        const char* p_end;
+        const char* next = zt_failed_state__next_line(line, end, &p, &p_end);
+        bool keep = p != NULL
+            && (!zt_failed_state__is_program(line, p, program)
+                || !zt_hashes_contain(executed, num_executed, zt_fnv1a_range(ZT_FNV1A_OFFSET, p, p_end)));
+        if (keep && (!zt_buffer_append(out, line, (size_t)(p_end - line)) || !zt_buffer_append(out, "\n", 1))) {
+            return false;
+        }
+        line = next;
+    }
+    for (i = 0; i < table->len; i++) {
+        const zt_test_entry* entry = &table->entries[i];
+        if (entry->kind == ZT_ENTRY_CASE && (entry->num_failures > 0 || zt_test_entry__failed(entry))) {
+            if (!zt_buffer_printf(out, "%s\t", program)
+                || !zt_test_table_append_path(table, i, out)
+                || !zt_buffer_append(out, "\n", 1)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * zt_state_file__lock opens and locks the current state file.
+ *
+ * The state file is replaced by renaming, so after the lock is acquired
+ * the file is checked to be still the current one. Returns the locked file
+ * descriptor, or -1 on error.
+ **/
+static int zt_state_file__lock(const char* path)
+{
+    for (;;) {
+        struct stat st_fd;
+        struct stat st_path;
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            return -1;
+        }
+        if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st_fd) < 0) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        if (stat(path, &st_path) == 0 && st_path.st_dev == st_fd.st_dev && st_path.st_ino == st_fd.st_ino) {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+/**
+ * zt_state_file_update replaces the content of a state file.
+ *
+ * The new content is computed from the old one by the update function.
+ * Concurrent updates, even by different test programs, are serialized with
+ * a lock. The new file is written next to the old one and renamed over it,
+ * so that readers never see a partially written file. Returns false and
+ * sets errno on error.
+ **/
+static bool zt_state_file_update(const char* path,
+    bool (*update)(const zt_buffer* old, zt_buffer* out, void* data), void* data)
+{
+    zt_buffer old;
+    zt_buffer out;
+    char* tmp_path;
+    bool ok = false;
+    int lock_fd = -1;
+    int saved_errno;
+    int fd;
+
+    memset(&old, 0, sizeof old);
+    memset(&out, 0, sizeof out);
+    tmp_path = (char*)malloc(strlen(path) + 32);
+    if (tmp_path != NULL) {
+        lock_fd = zt_state_file__lock(path);
+    } else {
+        errno = ENOMEM;
+    }
+    if (lock_fd >= 0 && zt_read_fd(lock_fd, &old)) {
+        if (update(&old, &out, data)) {
+            sprintf(tmp_path, "%s.%ld.tmp", path, (long)getpid());
+            fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0) {
+                ok = zt_write_all(fd, out.data, out.len);
+                ok = close(fd) == 0 && ok;
+                ok = ok && rename(tmp_path, path) == 0;
+                if (!ok) {
+                    saved_errno = errno;
+                    unlink(tmp_path);
+                    errno = saved_errno;
+                }
+            }
+        } else {
+            errno = ENOMEM;
+        }
+    }
+    saved_errno = errno;
+    if (lock_fd >= 0) {
+        /* Closing the file releases the lock, after the new file is in place. */
+        close(lock_fd);
+    }
+    zt_buffer_free(&old);
+    zt_buffer_free(&out);
+    free(tmp_path);
+    errno = saved_errno;
+    return ok;
+}
+
+/** zt_failed_state_save stores test cases that failed in this run in a state file. */
+static bool zt_failed_state_save(const zt_test_table* table, const char* path,
+    const char* program, FILE* stream_err)
+{
+    zt_state_update update;
+    uint64_t* executed;
+    size_t num_executed = 0;
+    size_t i;
+    bool ok = false;
+
+    executed = (uint64_t*)malloc((table->len + 1) * sizeof *executed);
+    if (executed != NULL) {
+        for (i = 0; i < table->len; i++) {
+            const zt_test_entry* entry = &table->entries[i];
+            if (entry->kind == ZT_ENTRY_CASE
+                && (entry->num_runs > 0 || (entry->done && !entry->excluded && !entry->cancelled))) {
+                executed[num_executed++] = entry->path_hash;
+            }
+        }
+        update.table = table;
+        update.program = program;
+        update.executed = executed;
+        update.num_executed = zt_sort_hashes(executed, num_executed);
+        ok = zt_state_file_update(path, zt_failed_state__update, &update);
+    } else {
+        errno = ENOMEM;
+    }
+    if (!ok && stream_err) {
+        fprintf(stream_err, "cannot save failed test cases to %s: %s\n", path, strerror(errno));
+    }
+    free(executed);
+    return ok;
+}
+
+/* Result journal */
+
+/** ZT_JOURNAL_MAGIC identifies journal files, it reads "ZTRJ" on little-endian machines. */
+#define ZT_JOURNAL_MAGIC 0x4a52545au
+#define ZT_JOURNAL_VERSION 1u
+
+/** ZT_JOURNAL_GROWTH is the number of records by which a journal file grows. */
+#define ZT_JOURNAL_GROWTH 65536u
+
+/**
+ * zt_journal_header is stored at the start of a journal file.
+ *
+ * The header is followed by an array of records, the file is extended
+ * in advance with records filled with zeros. Like duration history files,
+ * journal files use native byte order.
+ **/
+typedef struct zt_journal_header {
+    uint32_t magic;
+    uint32_t version;
+} zt_journal_header;
+
+/**
+ * zt_journal_record is the outcome of one execution of a test case.
+ *
+ * The checksum is written last. A record with a wrong checksum, like a
+ * record filled with zeros or one torn by a crash of the machine, ends
+ * the valid part of the journal.
+ **/
+typedef struct zt_journal_record {
+    uint64_t hash; /**< path hash of the test case. */
+    uint32_t outcome;
+    uint32_t checksum;
+} zt_journal_record;
+
+/**
+ * zt_journal is a shared, writable memory mapping of a journal file.
+ *
+ * Appending a record is a store into the mapping, no system call is made.
+ * Records reach the file even if the test program is killed right after,
+ * the kernel writes them back in the background.
+ **/
+typedef struct zt_journal {
+    void* map;
+    size_t map_size;
+    zt_journal_record* records;
+    size_t len; /**< number of valid records. */
+    size_t cap; /**< number of records that fit into the file. */
+    size_t num_skipped; /**< number of test cases skipped because they passed before. */
+    int fd;
+} zt_journal;
+
+/** zt_journal__checksum computes the checksum of a record, never zero for a record of zeros. */
+static uint32_t zt_journal__checksum(uint64_t hash, uint32_t outcome)
+{
+    uint64_t state = hash ^ ((uint64_t)outcome << 32 | ZT_JOURNAL_MAGIC);
+    return (uint32_t)(zt_random_next(&state) >> 32);
+}
+
+/** zt_journal__map maps a journal file with room for cap records. */
+static bool zt_journal__map(zt_journal* journal, size_t cap)
+{
+    size_t map_size = sizeof(zt_journal_header) + cap * sizeof(zt_journal_record);
+    void* map;
+
+    if (ftruncate(journal->fd, (off_t)map_size) < 0) {
+        return false;
+    }
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    if (journal->map != NULL) {
+        munmap(journal->map, journal->map_size);
+    }
+    journal->map = map;
+    journal->map_size = map_size;
+    journal->records = (zt_journal_record*)((char*)map + sizeof(zt_journal_header));
+    journal->cap = cap;
+    return true;
+}
+
+/**
+ * zt_journal_open opens a journal file for appending.
+ *
+ * Without resume the file is truncated. Otherwise the valid records of an
+ * existing file are kept, while a file that is not a journal is replaced.
+ * Returns false and sets errno on error.
+ **/
+static bool zt_journal_open(zt_journal* journal, const char* path, bool resume)
+{
+    zt_journal_header header;
+    struct stat st;
+    size_t len = 0;
+
+    memset(journal, 0, sizeof *journal);
+    journal->fd = open(path, O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+    if (journal->fd < 0) {
+        return false;
+    }
+    if (fstat(journal->fd, &st) == 0 && st.st_size >= (off_t)sizeof header) {
+        len = ((size_t)st.st_size - sizeof header) / sizeof(zt_journal_record);
+    }
+    if (!zt_journal__map(journal, len + ZT_JOURNAL_GROWTH)) {
+        int saved_errno = errno;
+        close(journal->fd);
+        journal->fd = -1;
+        errno = saved_errno;
+        return false;
+    }
+    memcpy(&header, journal->map, sizeof header);
+    if (header.magic != ZT_JOURNAL_MAGIC || header.version != ZT_JOURNAL_VERSION) {
+        header.magic = ZT_JOURNAL_MAGIC;
+        header.version = ZT_JOURNAL_VERSION;
+        memcpy(journal->map, &header, sizeof header);
+        memset(journal->records, 0, len * sizeof(zt_journal_record));
+        len = 0;
+    }
+    while (journal->len < len) {
+        const zt_journal_record* rec = &journal->records[journal->len];
+        if (rec->checksum != zt_journal__checksum(rec->hash, rec->outcome)) {
+            break;
+        }
+        journal->len++;
+    }
+    /* Records after a torn one are not trusted, they are overwritten. */
+    memset(journal->records + journal->len, 0, (len - journal->len) * sizeof(zt_journal_record));
+    return true;
+}
+
+/** zt_journal_close unmaps an open journal file and trims records that were not used. */
+static void zt_journal_close(zt_journal* journal)
+{
+    munmap(journal->map, journal->map_size);
+    if (ftruncate(journal->fd, (off_t)(sizeof(zt_journal_header) + journal->len * sizeof(zt_journal_record))) < 0) {
+        /* Unused records are filled with zeros and ignored anyway. */
+    }
+    close(journal->fd);
+    memset(journal, 0, sizeof *journal);
+}
+
+/**
+ * zt_journal_append appends the outcome of a test case to the journal.
+ *
+ * The file grows in large steps, so that remapping is rare. If it cannot
+ * grow, outcomes are no longer journaled and such test cases are executed
+ * again when resuming.
+ **/
+static void zt_journal_append(struct zt_journal* journal, const zt_test_entry* entry)
+{
+    zt_journal_record* rec;
+
+    if (journal->len == journal->cap && !zt_journal__map(journal, journal->cap + ZT_JOURNAL_GROWTH)) {
+        return;
+    }
+    rec = &journal->records[journal->len++];
+    rec->hash = entry->path_hash;
+    rec->outcome = (uint32_t)entry->outcome;
+    rec->checksum = zt_journal__checksum(rec->hash, rec->outcome);
+}
+
+/** zt_compare_journal_records orders records by hash, then by position in the journal. */
+static int zt_compare_journal_records(const void* a, const void* b)
+{
+    const zt_journal_record* rec_a = *(const zt_journal_record* const*)a;
+    const zt_journal_record* rec_b = *(const zt_journal_record* const*)b;
+    if (rec_a->hash != rec_b->hash) {
+        return rec_a->hash < rec_b->hash ? -1 : 1;
+    }
+    return rec_a < rec_b ? -1 : rec_a > rec_b;
+}
+
+/**
+ * zt_journal_skip_passed excludes test cases whose last journaled outcome is a pass.
+ *
+ * Such test cases are neither executed nor reported. Returns false if
+ * memory cannot be allocated.
+ **/
+static bool zt_journal_skip_passed(zt_journal* journal, zt_test_table* table)
+{
+    const zt_journal_record** sorted;
+    uint64_t* passed;
+    size_t num_passed = 0;
+    size_t i;
+
+    sorted = (const zt_journal_record**)malloc((journal->len + 1) * sizeof *sorted);
+    passed = (uint64_t*)malloc((journal->len + 1) * sizeof *passed);
+    if (sorted == NULL || passed == NULL) {
+        free(sorted);
+        free(passed);
+        return false;
+    }
+    for (i = 0; i < journal->len; i++) {
+        sorted[i] = &journal->records[i];
+    }
+    qsort(sorted, journal->len, sizeof *sorted, zt_compare_journal_records);
+    for (i = 0; i < journal->len; i++) {
+        bool last = i + 1 == journal->len || sorted[i + 1]->hash != sorted[i]->hash;
+        if (last && (sorted[i]->outcome == ZT_PASSED || sorted[i]->outcome == ZT_PENDING)) {
+            passed[num_passed++] = sorted[i]->hash;
+        }
+    }
+    for (i = 0; i < table->len; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        if (entry->kind == ZT_ENTRY_CASE && !entry->done && zt_hashes_contain(passed, num_passed, entry->path_hash)) {
+            entry->excluded = true;
+            entry->done = true;
+            journal->num_skipped++;
+        }
+    }
+    free(sorted);
+    free(passed);
+    return true;
+}
+
+#ifdef ZT_HAVE_CODE_HASH
+/* Machine code hashes */
+
+/** ZT_CODE_CACHE_FILE is the default file of --skip-unchanged. */
+#define ZT_CODE_CACHE_FILE ".zt-code"
+
+/** ZT_NO_SYMBOL is the index of a function not found in the symbol table. */
+#define ZT_NO_SYMBOL ((size_t)-1)
+
+/** zt_code_symbol is a function found in the symbol table of the test program. */
+typedef struct zt_code_symbol {
+    uint64_t addr; /**< link-time address of the function. */
+    uint64_t size;
+    const unsigned char* code; /**< machine code in the mapped file. */
+    const char* name;
+    uint64_t hash; /**< hash of the machine code, valid if hashed is set. */
+    size_t first_callee; /**< index of the first callee in the array of callees. */
+    size_t num_callees;
+    uint32_t visited; /**< number of the last closure that visited the function. */
+    bool hashed;
+} zt_code_symbol;
+
+/**
+ * zt_code_map describes functions of the test program and their calls.
+ *
+ * The executable file is mapped read-only. Functions are sorted by address,
+ * their code is hashed and their direct calls are decoded on demand.
+ **/
+typedef struct zt_code_map {
+    void* map;
+    size_t map_size;
+    zt_code_symbol* symbols;
+    size_t num_symbols;
+    size_t* callees; /**< indices of called functions, in runs per function. */
+    size_t num_callees;
+    size_t cap_callees;
+    size_t* stack; /**< functions left to visit by a closure. */
+    const Elf64_Shdr* symtab; /**< symbol table the functions were read from. */
+    uintptr_t bias; /**< difference between run-time and link-time addresses. */
+    uint64_t objects_hash; /**< hash of shared objects loaded into the test program. */
+    size_t num_objects; /**< number of loaded objects visited, including the program. */
+    uint32_t num_closures;
+} zt_code_map;
+
+/** zt_code_stats counts test cases by the reason why they are executed or not. */
+typedef struct zt_code_stats {
+    unsigned long unchanged; /**< not executed, code did not change since they passed. */
+    unsigned long changed; /**< code changed since they passed. */
+    unsigned long unrecorded; /**< not known to have passed with any code. */
+    unsigned long unknown; /**< code could not be hashed. */
+} zt_code_stats;
+
+/** zt_code_cache_record is the hash of the code of a test case that passed. */
+typedef struct zt_code_cache_record {
+    uint64_t path_hash;
+    uint64_t code_hash;
+} zt_code_cache_record;
+
+static int zt_code_map__find_program(struct dl_phdr_info* info, size_t size, void* data)
+{
+    (void)size;
+    /* The test program itself is always visited first. */
+    *(uintptr_t*)data = (uintptr_t)info->dlpi_addr;
+    return 1;
+}
+
+/** zt_code_map__hash_bytes adds bytes to a hash. */
+static uint64_t zt_code_map__hash_bytes(uint64_t hash, const unsigned char* data, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+/**
+ * zt_code_map__hash_build_id adds the GNU build ID found among notes to a hash.
+ *
+ * Names and descriptors of notes are padded to the given alignment.
+ * Returns false if there is no build ID.
+ **/
+static bool zt_code_map__hash_build_id(uint64_t* hash, const unsigned char* notes, size_t size,
+    size_t align)
+{
+    size_t offset = 0;
+
+    while (size - offset >= sizeof(Elf64_Nhdr)) {
+        Elf64_Nhdr note;
+        size_t name_size;
+        size_t desc_size;
+        memcpy(&note, notes + offset, sizeof note);
+        offset += sizeof note;
+        name_size = (note.n_namesz + align - 1) & ~(align - 1);
+        desc_size = (note.n_descsz + align - 1) & ~(align - 1);
+        if (name_size > size - offset || desc_size > size - offset - name_size) {
+            return false;
+        }
+        if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4 && memcmp(notes + offset, "GNU", 4) == 0) {
+            *hash = zt_code_map__hash_bytes(*hash, notes + offset + name_size, note.n_descsz);
+            return true;
+        }
+        offset += name_size + desc_size;
+    }
+    return false;
+}
+
+/**
+ * zt_code_map__hash_object adds a shared object loaded into the test program to its hash.
+ *
+ * Test cases may behave differently when code of a shared library they
+ * call changes, which symbols of the test program do not show. Objects
+ * are identified by their GNU build ID, or by their executable segments
+ * as mapped, if the linker did not record one. The test program itself,
+ * always visited first, is hashed function by function instead. The vDSO
+ * of the kernel, which has no file name, is left out.
+ **/
+static int zt_code_map__hash_object(struct dl_phdr_info* info, size_t size, void* data)
+{
+    zt_code_map* map = (zt_code_map*)data;
+    const unsigned char* base = (const unsigned char*)info->dlpi_addr;
+    bool identified = false;
+    int i;
+
+    (void)size;
+    if (map->num_objects++ == 0 || info->dlpi_name == NULL || strchr(info->dlpi_name, '/') == NULL) {
+        return 0;
+    }
+    for (i = 0; i < info->dlpi_phnum && !identified; i++) {
+        const Elf64_Phdr* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_NOTE) {
+            identified = zt_code_map__hash_build_id(&map->objects_hash, base + phdr->p_vaddr,
+                (size_t)phdr->p_memsz, phdr->p_align == 8 ? 8 : 4);
+        }
+    }
+    for (i = 0; i < info->dlpi_phnum && !identified; i++) {
+        const Elf64_Phdr* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X) != 0) {
+            map->objects_hash = zt_code_map__hash_bytes(map->objects_hash, base + phdr->p_vaddr,
+                (size_t)phdr->p_filesz);
+        }
+    }
+    return 0;
+}
+
+static int zt_compare_code_symbols(const void* a, const void* b)
+{
+    const zt_code_symbol* sym_a = (const zt_code_symbol*)a;
+    const zt_code_symbol* sym_b = (const zt_code_symbol*)b;
+    return sym_a->addr < sym_b->addr ? -1 : sym_a->addr > sym_b->addr;
+}
+
+/**
+ * zt_code_map__section returns a section header, if it lies within the file.
+ *
+ * Only sections with data in the file are returned.
+ **/
+static const Elf64_Shdr* zt_code_map__section(const zt_code_map* map, size_t index)
+{
+    const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*)map->map;
+    const Elf64_Shdr* shdr;
+
+    if (index == SHN_UNDEF || index >= ehdr->e_shnum) {
+        return NULL;
+    }
+    shdr = (const Elf64_Shdr*)((const char*)map->map + ehdr->e_shoff) + index;
+    if (shdr->sh_type == SHT_NOBITS || shdr->sh_offset > map->map_size
+        || shdr->sh_size > map->map_size - shdr->sh_offset) {
+        return NULL;
+    }
+    return shdr;
+}
+
+/**
+ * zt_code_map__read_symbols collects functions from a symbol table.
+ *
+ * Only functions with code in executable sections of the file are used.
+ * Aliases at the same address are dropped after sorting.
+ **/
+static bool zt_code_map__read_symbols(zt_code_map* map, const Elf64_Shdr* symtab)
+{
+    const Elf64_Shdr* strtab = zt_code_map__section(map, symtab->sh_link);
+    const Elf64_Sym* syms = (const Elf64_Sym*)((const char*)map->map + symtab->sh_offset);
+    const char* strs;
+    size_t num_syms = (size_t)(symtab->sh_size / sizeof *syms);
+    size_t n = 0;
+    size_t i;
+
+    if (strtab == NULL || strtab->sh_size == 0) {
+        return false;
+    }
+    strs = (const char*)map->map + strtab->sh_offset;
+    if (strs[strtab->sh_size - 1] != '\0') {
+        return false;
+    }
+    map->symbols = (zt_code_symbol*)calloc(num_syms + 1, sizeof *map->symbols);
+    if (map->symbols == NULL) {
+        return false;
+    }
+    for (i = 0; i < num_syms; i++) {
+        const Elf64_Sym* sym = &syms[i];
+        const Elf64_Shdr* text = NULL;
+        if (ELF64_ST_TYPE(sym->st_info) == STT_FUNC && sym->st_size > 0 && sym->st_name < strtab->sh_size) {
+            text = zt_code_map__section(map, sym->st_shndx);
+        }
+        if (text == NULL || (text->sh_flags & SHF_EXECINSTR) == 0 || sym->st_value < text->sh_addr
+            || sym->st_value - text->sh_addr > text->sh_size
+            || sym->st_size > text->sh_size - (sym->st_value - text->sh_addr)) {
+            continue;
+        }
+        map->symbols[n].addr = sym->st_value;
+        map->symbols[n].size = sym->st_size;
+        map->symbols[n].code = (const unsigned char*)map->map + text->sh_offset + (sym->st_value - text->sh_addr);
+        map->symbols[n].name = strs + sym->st_name;
+        n++;
+    }
+    qsort(map->symbols, n, sizeof *map->symbols, zt_compare_code_symbols);
+    for (i = 0; i < n; i++) {
+        if (map->num_symbols == 0 || map->symbols[map->num_symbols - 1].addr != map->symbols[i].addr) {
+            map->symbols[map->num_symbols++] = map->symbols[i];
+        }
+    }
+    return true;
+}
+
+static void zt_code_map_close(zt_code_map* map)
+{
+    if (map->map != NULL) {
+        munmap(map->map, map->map_size);
+    }
+    free(map->symbols);
+    free(map->callees);
+    free(map->stack);
+    memset(map, 0, sizeof *map);
+}
+
+/**
+ * zt_code_map_open maps the executable file of the test program.
+ *
+ * The full symbol table is used, or the dynamic one of stripped programs.
+ * Shared objects loaded into the program are hashed as a whole. Returns
+ * false and sets errno if the file cannot be used, or if it has no
+ * functions, as stripped programs often do.
+ **/
+static bool zt_code_map_open(zt_code_map* map)
+{
+    const Elf64_Ehdr* ehdr;
+    const Elf64_Shdr* symtab = NULL;
+    struct stat st;
+    size_t i;
+    int fd;
+
+    memset(map, 0, sizeof *map);
+    fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof *ehdr) {
+        close(fd);
+        errno = ENOEXEC;
+        return false;
+    }
+    map->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map->map == MAP_FAILED) {
+        map->map = NULL;
+        return false;
+    }
+    map->map_size = (size_t)st.st_size;
+    ehdr = (const Elf64_Ehdr*)map->map;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64
+        || ehdr->e_shentsize != sizeof(Elf64_Shdr) || ehdr->e_shoff > map->map_size
+        || ehdr->e_shnum > (map->map_size - ehdr->e_shoff) / sizeof(Elf64_Shdr)) {
+        zt_code_map_close(map);
+        errno = ENOEXEC;
+        return false;
+    }
+    for (i = 1; i < ehdr->e_shnum; i++) {
+        const Elf64_Shdr* shdr = zt_code_map__section(map, i);
+        if (shdr != NULL && (shdr->sh_type == SHT_SYMTAB || (shdr->sh_type == SHT_DYNSYM && symtab == NULL))) {
+            symtab = shdr;
+        }
+    }
+    if (symtab == NULL || !zt_code_map__read_symbols(map, symtab) || map->num_symbols == 0) {
+        zt_code_map_close(map);
+        errno = ENOEXEC;
+        return false;
+    }
+    map->symtab = symtab;
+    map->stack = (size_t*)malloc((map->num_symbols + 1) * sizeof *map->stack);
+    if (map->stack == NULL) {
+        zt_code_map_close(map);
+        errno = ENOMEM;
+        return false;
+    }
+    dl_iterate_phdr(zt_code_map__find_program, &map->bias);
+    map->objects_hash = ZT_FNV1A_OFFSET;
+    dl_iterate_phdr(zt_code_map__hash_object, map);
+    if (map->objects_hash == 0) {
+        map->objects_hash = 1;
+    }
+    return true;
+}
+
+/** zt_code_map__find returns the index of the function starting at a link-time address. */
+static size_t zt_code_map__find(const zt_code_map* map, uint64_t addr)
+{
+    size_t lo = 0;
+    size_t hi = map->num_symbols;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (map->symbols[mid].addr < addr) {
+            lo = mid + 1;
+        } else if (map->symbols[mid].addr > addr) {
+            hi = mid;
+        } else {
+            return mid;
+        }
+    }
+    return ZT_NO_SYMBOL;
+}
+
+/**
+ * zt_code_map__hash hashes the code of a function and finds its callees.
+ *
+ * Direct calls and jumps to other functions are recognized by their
+ * opcodes, 0xe8 and 0xe9 with a 32 bit displacement. Bytes which merely
+ * look like such instructions only add callees, which is conservative.
+ * Displacements of calls are hashed as names of the callees, so that
+ * moving functions around does not change the hash. Returns false if
+ * memory cannot be allocated.
+ **/
+static bool zt_code_map__hash(zt_code_map* map, size_t index)
+{
+    zt_code_symbol* sym = &map->symbols[index];
+    uint64_t hash = ZT_FNV1A_OFFSET;
+    uint64_t i;
+
+    sym->first_callee = map->num_callees;
+    for (i = 0; i < sym->size; i++) {
+        unsigned char op = sym->code[i];
+        size_t callee = ZT_NO_SYMBOL;
+        if ((op == 0xe8 || op == 0xe9) && i + 5 <= sym->size) {
+            int32_t disp;
+            memcpy(&disp, sym->code + i + 1, sizeof disp);
+            callee = zt_code_map__find(map, sym->addr + i + 5 + (uint64_t)(int64_t)disp);
+        }
+        hash = (hash ^ op) * UINT64_C(1099511628211);
+        if (callee == ZT_NO_SYMBOL) {
+            continue;
+        }
+        if (map->num_callees == map->cap_callees) {
+            size_t cap = map->cap_callees != 0 ? map->cap_callees * 2 : 256;
+            size_t* callees = (size_t*)realloc(map->callees, cap * sizeof *callees);
+            if (callees == NULL) {
+                map->num_callees = sym->first_callee;
+                return false;
+            }
+            map->callees = callees;
+            map->cap_callees = cap;
+        }
+        map->callees[map->num_callees++] = callee;
+        hash = zt_fnv1a(hash, map->symbols[callee].name);
+        i += 4;
+    }
+    sym->num_callees = map->num_callees - sym->first_callee;
+    sym->hash = hash;
+    sym->hashed = true;
+    return true;
+}
+
+/**
+ * zt_code_map_hash computes the hash of a function and all the functions it calls.
+ *
+ * Functions reached through direct calls, transitively, are combined in a
+ * way that does not depend on the order of calls. Returns zero if the
+ * function is not found in the test program, for example because it is
+ * defined in a shared library, or if memory cannot be allocated.
+ **/
+static uint64_t zt_code_map_hash(zt_code_map* map, zt_test_case_func func)
+{
+    size_t index = zt_code_map__find(map, (uint64_t)((uintptr_t)func - map->bias));
+    size_t depth = 0;
+    uint64_t hash = 0;
+
+    if (index == ZT_NO_SYMBOL) {
+        return 0;
+    }
+    map->num_closures++;
+    map->symbols[index].visited = map->num_closures;
+    map->stack[depth++] = index;
+    while (depth > 0) {
+        zt_code_symbol* sym = &map->symbols[map->stack[--depth]];
+        uint64_t mixed;
+        size_t i;
+        if (!sym->hashed && !zt_code_map__hash(map, (size_t)(sym - map->symbols))) {
+            return 0;
+        }
+        mixed = sym->hash;
+        hash += zt_random_next(&mixed);
+        for (i = 0; i < sym->num_callees; i++) {
+            size_t callee = map->callees[sym->first_callee + i];
+            if (map->symbols[callee].visited != map->num_closures) {
+                map->symbols[callee].visited = map->num_closures;
+                map->stack[depth++] = callee;
+            }
+        }
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/** zt_code_hash_combine combines hashes of code, zero stands for unknown code. */
+static uint64_t zt_code_hash_combine(uint64_t a, uint64_t b)
+{
+    uint64_t hash;
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    hash = a ^ b;
+    hash = zt_random_next(&hash);
+    return hash != 0 ? hash : 1;
+}
+
+/**
+ * zt_test_table_hash_code computes code hashes of test cases of a table.
+ *
+ * The hash of a test case includes the code of setup functions preceding
+ * it in its suite and in enclosing suites, and the shared objects loaded
+ * into the test program. Returns false if memory cannot be allocated.
+ **/
+static bool zt_test_table_hash_code(zt_test_table* table, zt_code_map* map)
+{
+    uint64_t* level_hashes;
+    int max_nesting = 0;
+    size_t i;
+
+    for (i = 0; i < table->len; i++) {
+        if (table->entries[i].nesting > max_nesting) {
+            max_nesting = table->entries[i].nesting;
+        }
+    }
+    level_hashes = (uint64_t*)malloc((size_t)(max_nesting + 2) * sizeof *level_hashes);
+    if (level_hashes == NULL) {
+        return false;
+    }
+    level_hashes[0] = map->objects_hash;
+    for (i = 0; i < table->len; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        uint64_t* level = &level_hashes[entry->nesting];
+        switch (entry->kind) {
+        case ZT_ENTRY_SUITE:
+            level[1] = level[0];
+            break;
+        case ZT_ENTRY_SETUP:
+            *level = zt_code_hash_combine(*level, zt_code_map_hash(map, entry->func));
+            break;
+        case ZT_ENTRY_CASE:
+        default:
+            entry->code_hash = zt_code_hash_combine(*level, zt_code_map_hash(map, entry->func));
+            break;
+        }
+    }
+    free(level_hashes);
+    return true;
+}
+
+/** zt_compare_code_cache_records orders records by path hash. */
+static int zt_compare_code_cache_records(const void* a, const void* b)
+{
+    const zt_code_cache_record* rec_a = (const zt_code_cache_record*)a;
+    const zt_code_cache_record* rec_b = (const zt_code_cache_record*)b;
+    return rec_a->path_hash < rec_b->path_hash ? -1 : rec_a->path_hash > rec_b->path_hash;
+}
+
+/**
+ * zt_code_cache__split_line finds the path and the code hash in a line of a code cache.
+ *
+ * Lines hold the name of the test program, the path of a test case that
+ * passed and the hash of its code in hexadecimal, separated by tabs.
+ * Returns false for malformed lines.
+ **/
+static bool zt_code_cache__split_line(const char* path, const char* line_end,
+    const char** path_end, uint64_t* code_hash)
+{
+    const char* p = line_end;
+    int digits = 0;
+
+    while (p > path && p[-1] != '\t') {
+        p--;
+    }
+    if (p == path) {
+        return false;
+    }
+    *path_end = p - 1;
+    *code_hash = 0;
+    for (; p < line_end; p++, digits++) {
+        int c = tolower((unsigned char)*p);
+        if (digits == 16 || !isxdigit((unsigned char)c)) {
+            return false;
+        }
+        *code_hash = *code_hash << 4 | (uint64_t)(isdigit((unsigned char)c) ? c - '0' : c - 'a' + 10);
+    }
+    return digits == 16;
+}
+
+/**
+ * zt_code_cache_load reads hashes of the code of test cases that passed.
+ *
+ * A missing file is like an empty one. Records are sorted by path hash.
+ * Returns false and sets errno on error.
+ **/
+static bool zt_code_cache_load(zt_code_cache_record** records, size_t* len,
+    const char* path, const char* program)
+{
+    zt_buffer buf;
+    const char* line;
+    const char* end;
+    bool ok;
+    int fd;
+
+    *records = NULL;
+    *len = 0;
+    memset(&buf, 0, sizeof buf);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    ok = zt_read_fd(fd, &buf);
+    close(fd);
+    if (!ok) {
+        zt_buffer_free(&buf);
+        return false;
+    }
+    /* Each record takes at least one line. */
+    *records = (zt_code_cache_record*)malloc((buf.len / 2 + 1) * sizeof **records);
+    if (*records == NULL) {
+        zt_buffer_free(&buf);
+        errno = ENOMEM;
+        return false;
+    }
+    end = buf.data + buf.len;
+    for (line = buf.data; line < end;) {
+        const char* p;
+        const char* p_end;
+        const char* next = zt_failed_state__next_line(line, end, &p, &p_end);
+        zt_code_cache_record* rec = &(*records)[*len];
+        if (zt_failed_state__is_program(line, p, program) && zt_code_cache__split_line(p, p_end, &p_end, &rec->code_hash)) {
+            rec->path_hash = zt_fnv1a_range(ZT_FNV1A_OFFSET, p, p_end);
+            (*len)++;
+        }
+        line = next;
+    }
+    zt_buffer_free(&buf);
+    qsort(*records, *len, sizeof **records, zt_compare_code_cache_records);
+    return true;
+}
+
+/**
+ * zt_test_table_skip_unchanged excludes test cases whose code did not change since they passed.
+ *
+ * Test cases with unknown code hashes are always executed.
+ **/
+static void zt_test_table_skip_unchanged(zt_test_table* table, const zt_code_cache_record* records,
+    size_t len, zt_code_stats* stats)
+{
+    size_t i;
+
+    for (i = 0; i < table->len; i++) {
+        zt_test_entry* entry = &table->entries[i];
+        zt_code_cache_record key;
+        const zt_code_cache_record* rec;
+        if (entry->kind != ZT_ENTRY_CASE || entry->done) {
+            continue;
+        }
+        if (entry->code_hash == 0) {
+            stats->unknown++;
+            continue;
+        }
+        key.path_hash = entry->path_hash;
+        rec = (const zt_code_cache_record*)bsearch(&key, records, len, sizeof *records,
+            zt_compare_code_cache_records);
+        if (rec == NULL) {
+            stats->unrecorded++;
+        } else if (rec->code_hash != entry->code_hash) {
+            stats->changed++;
+        } else {
+            entry->excluded = true;
+            entry->unchanged = true;
+            entry->done = true;
+            stats->unchanged++;
+        }
+    }
+}
+
+/**
+ * zt_select_changed_tests excludes test cases whose code did not change since they passed.
+ *
+ * When the code of the test program cannot be read, all the test cases
+ * are executed. Returns false if the cache cannot be read.
+ **/
+static bool zt_select_changed_tests(zt_test_table* table, const char* path, const char* program,
+    zt_code_stats* stats, FILE* stream_err)
+{
+    zt_code_cache_record* records;
+    zt_code_map map;
+    size_t len;
+
+    if (!zt_code_cache_load(&records, &len, path, program)) {
+        if (stream_err) {
+            fprintf(stream_err, "cannot load code hashes from %s: %s\n", path, strerror(errno));
+        }
+        return false;
+    }
+    if (!zt_code_map_open(&map)) {
+        if (stream_err) {
+            fprintf(stream_err, "cannot read the code of the test program: %s\n", strerror(errno));
+        }
+    } else if (!zt_test_table_hash_code(table, &map)) {
+        if (stream_err) {
+            fprintf(stream_err, "cannot allocate memory to hash the code of test cases\n");
+        }
+        zt_code_map_close(&map);
+    } else {
+        zt_code_map_close(&map);
+    }
+    zt_test_table_skip_unchanged(table, records, len, stats);
+    free(records);
+    return true;
+}
+
+/** zt_code_stats_report reports why test cases were executed or not. */
+static void zt_code_stats_report(const zt_code_stats* stats, FILE* stream_err)
+{
+    if (stream_err == NULL) {
+        return;
+    }
+    if (stats->unchanged > 0) {
+        fprintf(stream_err, "test cases not executed because their code did not change since they passed: %lu\n", stats->unchanged);
+    }
+    if (stats->changed > 0) {
+        fprintf(stream_err, "test cases executed because their code changed: %lu\n", stats->changed);
+    }
+    if (stats->unrecorded > 0) {
+        fprintf(stream_err, "test cases executed because they did not pass before: %lu\n", stats->unrecorded);
+    }
+    if (stats->unknown > 0) {
+        fprintf(stream_err, "test cases executed because their code is unknown: %lu\n", stats->unknown);
+    }
+}
+
+/**
+ * zt_code_cache__update computes the new content of a code cache.
+ *
+ * Lines of other test programs are kept, as are lines of test cases that
+ * were neither executed nor skipped in this run. Test cases that passed or
+ * were skipped are stored with their current code hash.
+ **/
+static bool zt_code_cache__update(const zt_buffer* old, zt_buffer* out, void* data)
+{
+    const zt_state_update* update = (const zt_state_update*)data;
+    const zt_test_table* table = update->table;
+    const char* line = old->data;
+    const char* end = old->data + old->len;
+    size_t i;
+
+    while (line < end) {
+        const char* p;
+        const char* p_end;
+        const char* next = zt_failed_state__next_line(line, end, &p, &p_end);
+        const char* line_end = p_end;
+        uint64_t code_hash;
+        bool keep = p != NULL
+            && (!zt_failed_state__is_program(line, p, update->program)
+                || !zt_code_cache__split_line(p, p_end, &p_end, &code_hash)
+                || !zt_hashes_contain(update->executed, update->num_executed, zt_fnv1a_range(ZT_FNV1A_OFFSET, p, p_end)));
+        if (keep && (!zt_buffer_append(out, line, (size_t)(line_end - line)) || !zt_buffer_append(out, "\n", 1))) {
+            return false;
+        }
+        line = next;
+    }
+    for (i = 0; i < table->len; i++) {
+        const zt_test_entry* entry = &table->entries[i];
+        bool passed = entry->unchanged
+            || (entry->done && !entry->excluded && !entry->cancelled && entry->num_failures == 0
+                && !zt_test_entry__failed(entry));
+        if (entry->kind == ZT_ENTRY_CASE && entry->code_hash != 0 && passed) {
+            if (!zt_buffer_printf(out, "%s\t", update->program)
+                || !zt_test_table_append_path(table, i, out)
+                || !zt_buffer_printf(out, "\t%08lx%08lx\n", (unsigned long)(entry->code_hash >> 32),
+                    (unsigned long)(entry->code_hash & 0xffffffffu))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/** zt_code_cache_save stores code hashes of test cases that passed in this run. */
+static bool zt_code_cache_save(const zt_test_table* table, const char* path,
+    const char* program, FILE* stream_err)
+{
+    zt_state_update update;
+    uint64_t* executed;
+    size_t num_executed = 0;
+    size_t i;
+    bool ok = false;
+
+    executed = (uint64_t*)malloc((table->len + 1) * sizeof *executed);
+    if (executed != NULL) {
+        for (i = 0; i < table->len; i++) {
+            const zt_test_entry* entry = &table->entries[i];
+            if (entry->kind == ZT_ENTRY_CASE
+                && (entry->unchanged || entry->num_runs > 0 || (entry->done && !entry->excluded && !entry->cancelled))) {
+                executed[num_executed++] = entry->path_hash;
+            }
+        }
+        update.table = table;
+        update.program = program;
+        update.executed = executed;
+        update.num_executed = zt_sort_hashes(executed, num_executed);
+        ok = zt_state_file_update(path, zt_code_cache__update, &update);
+    } else {
+        errno = ENOMEM;
+    }
+    if (!ok && stream_err) {
+        fprintf(stream_err, "cannot save code hashes to %s: %s\n", path, strerror(errno));
+    }
+    free(executed);
+    return ok;
+}
+#endif
+
+#ifdef ZT_HAVE_COVERAGE
+/* Coverage map */
+
+/** ZT_GCOV_COUNTERS_PREFIX starts names of arrays of gcov arc counters of each function. */
+#define ZT_GCOV_COUNTERS_PREFIX "__gcov0."
+
+/** zt_coverage_function is a function instrumented by gcov. */
+typedef struct zt_coverage_function {
+    const uint64_t* counters; /**< arc counters of the function in memory. */
+    size_t num_counters;
+    const char* name;
+    const char* source; /**< name of the source file, from the symbol table. */
+} zt_coverage_function;
+
+/**
+ * zt_coverage collects functions covered by each test case.
+ *
+ * Arc counters of instrumented functions are found in the symbol table of
+ * the test program. Each test case executes in a child process which
+ * resets the counters, executes the test case, appends lines of functions
+ * with non-zero counters to the map file and dumps the counters to gcov
+ * data files, which would otherwise be lost when the child exits.
+ **/
+typedef struct zt_coverage {
+    zt_code_map code; /**< mapped test program, holding names of functions. */
+    zt_coverage_function* functions;
+    size_t num_functions;
+    const zt_test_table* table;
+    const char* program;
+    int fd; /**< map file, open for appending. */
+} zt_coverage;
+
+/**
+ * zt_coverage__read_counters collects arrays of arc counters from the symbol table.
+ *
+ * Counters are local symbols following the file symbol of their source
+ * file. Counters of functions without a name are skipped.
+ **/
+static bool zt_coverage__read_counters(zt_coverage* coverage)
+{
+    const zt_code_map* map = &coverage->code;
+    const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*)map->map;
+    const Elf64_Shdr* shdrs = (const Elf64_Shdr*)((const char*)map->map + ehdr->e_shoff);
+    const Elf64_Shdr* strtab = zt_code_map__section(map, map->symtab->sh_link);
+    const Elf64_Sym* syms = (const Elf64_Sym*)((const char*)map->map + map->symtab->sh_offset);
+    size_t num_syms = (size_t)(map->symtab->sh_size / sizeof *syms);
+    size_t prefix_len = strlen(ZT_GCOV_COUNTERS_PREFIX);
+    const char* strs;
+    const char* source = "";
+    size_t i;
+
+    if (strtab == NULL) {
+        return false;
+    }
+    strs = (const char*)map->map + strtab->sh_offset;
+    coverage->functions = (zt_coverage_function*)calloc(num_syms + 1, sizeof *coverage->functions);
+    if (coverage->functions == NULL) {
+        return false;
+    }
+    for (i = 0; i < num_syms; i++) {
+        const Elf64_Sym* sym = &syms[i];
+        const Elf64_Shdr* data;
+        const char* name;
+        zt_coverage_function* func;
+        if (sym->st_name >= strtab->sh_size) {
+            continue;
+        }
+        name = strs + sym->st_name;
+        if (ELF64_ST_TYPE(sym->st_info) == STT_FILE) {
+            source = name;
+            continue;
+        }
+        if (ELF64_ST_TYPE(sym->st_info) != STT_OBJECT || sym->st_size < sizeof(uint64_t)
+            || strncmp(name, ZT_GCOV_COUNTERS_PREFIX, prefix_len) != 0 || name[prefix_len] == '\0'
+            || sym->st_shndx == SHN_UNDEF || sym->st_shndx >= ehdr->e_shnum) {
+            continue;
+        }
+        data = &shdrs[sym->st_shndx];
+        if ((data->sh_flags & (SHF_ALLOC | SHF_WRITE)) != (SHF_ALLOC | SHF_WRITE)
+            || sym->st_value < data->sh_addr || sym->st_value - data->sh_addr > data->sh_size
+            || sym->st_size > data->sh_size - (sym->st_value - data->sh_addr)) {
+            continue;
+        }
+        func = &coverage->functions[coverage->num_functions++];
+        func->counters = (const uint64_t*)(uintptr_t)(sym->st_value + map->bias);
+        func->num_counters = (size_t)(sym->st_size / sizeof(uint64_t));
+        func->name = name + prefix_len;
+        func->source = source;
+    }
+    return true;
+}
+
+static void zt_coverage_close(zt_coverage* coverage)
+{
+    if (coverage->fd >= 0) {
+        close(coverage->fd);
+    }
+    free(coverage->functions);
+    zt_code_map_close(&coverage->code);
+    memset(coverage, 0, sizeof *coverage);
+    coverage->fd = -1;
+}
+
+/**
+ * zt_coverage_open prepares collection of coverage of test cases from a table.
+ *
+ * The map file is truncated. Returns false and sets errno if the file
+ * cannot be created or if the test program has no instrumented functions.
+ **/
+static bool zt_coverage_open(zt_coverage* coverage, const char* path,
+    const zt_test_table* table, const char* program)
+{
+    memset(coverage, 0, sizeof *coverage);
+    coverage->fd = -1;
+    if (!zt_code_map_open(&coverage->code)) {
+        return false;
+    }
+    if (!zt_coverage__read_counters(coverage)) {
+        zt_coverage_close(coverage);
+        errno = ENOMEM;
+        return false;
+    }
+    if (coverage->num_functions == 0) {
+        zt_coverage_close(coverage);
+        errno = ENOEXEC;
+        return false;
+    }
+    coverage->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+    if (coverage->fd < 0) {
+        int saved_errno = errno;
+        zt_coverage_close(coverage);
+        errno = saved_errno;
+        return false;
+    }
+    coverage->table = table;
+    coverage->program = program;
+    return true;
+}
+
+/**
+ * zt_coverage_record records functions covered by a test case since the counters were reset.
+ *
+ * Called in the child process that executed the test case. The map gets
+ * one line per covered function: the name of the test program, the path
+ * of the test case, the source file and the name of the function,
+ * separated by tabs. Lines of one test case are appended with one write,
+ * so that children executing concurrently do not interleave them.
+ **/
+static void zt_coverage_record(const zt_coverage* coverage, size_t index)
+{
+    zt_buffer path;
+    zt_buffer lines;
+    size_t i;
+
+    memset(&path, 0, sizeof path);
+    memset(&lines, 0, sizeof lines);
+    if (zt_test_table_append_path(coverage->table, index, &path) && zt_buffer_append(&path, "", 1)) {
+        for (i = 0; i < coverage->num_functions; i++) {
+            const zt_coverage_function* func = &coverage->functions[i];
+            size_t j;
+            for (j = 0; j < func->num_counters && func->counters[j] == 0; j++) {
+            }
+            if (j < func->num_counters
+                && !zt_buffer_printf(&lines, "%s\t%s\t%s\t%s\n", coverage->program, path.data, func->source, func->name)) {
+                lines.len = 0;
+                break;
+            }
+        }
+        (void)zt_write_all(coverage->fd, lines.data, lines.len);
+    }
+    zt_buffer_free(&lines);
+    zt_buffer_free(&path);
+    __gcov_dump();
+}
+#endif
+#endif
+
+/** zt_run_tests_from_table runs test cases from a table as selected by options. */
+static void zt_run_tests_from_table(zt_test_runner* runner, zt_test_table* table,
+    const zt_options* opts)
+{
+    size_t i;
+#ifdef ZT_HAVE_POSIX
+    zt_output_queue queue;
+    int jobs = opts->jobs;
+    int threads = opts->threads;
+    int batch = opts->batch;
+#endif
+
+    /* Failures found while collecting the table count towards fail-fast.
+     * Until-fail mode stops at the first failure, like fail-fast mode. */
+    table->max_failures = opts->until_fail ? 1 : opts->max_failures;
+    for (i = 0; i < table->len; i++) {
+        if (zt_test_entry__failed(&table->entries[i])) {
+            table->num_failed++;
+        }
+    }
+#ifdef ZT_HAVE_POSIX
+    /* Coverage is collected from a separate child process for each test case. */
+    if (runner->coverage != NULL) {
+        jobs = jobs > 0 ? jobs : 1;
+        threads = 0;
+        batch = 0;
+    }
+    if ((threads > 0 || jobs > 0)
+        && zt_output_queue_start(&queue, runner->stream_out, runner->stream_err)) {
+        runner->output = &queue;
+    }
+    if (threads > 0 || jobs > 0) {
+        zt_setup_state setup;
+        size_t begin = 0;
+        memset(&setup, 0, sizeof setup);
+        /* Test cases are executed in segments, each after its setup functions. */
+        while (begin < table->len) {
+            begin = zt_test_table_run_setups(table, &setup, begin, runner->stream_err);
+            if (threads > 0) {
+                zt_run_tests_in_threads(runner, table, threads);
+            }
+            if (jobs > 0 && batch > 0) {
+                zt_run_tests_in_workers(runner, table, jobs, (size_t)batch, opts->resources);
+            } else if (jobs > 0) {
+                zt_run_tests_in_parallel(runner, table, jobs, opts->resources);
+            } else {
+                zt_run_tests_in_process(runner, table);
+            }
+        }
+        table->limit = 0;
+    } else {
+        zt_run_tests_in_process(runner, table);
+    }
+    if (runner->output != NULL) {
+        zt_test_runner__flush(runner);
+        zt_output_queue_stop(runner->output);
+        zt_buffer_free(&runner->pending);
+        runner->output = NULL;
+    }
+#else
+    (void)opts;
+    zt_run_tests_in_process(runner, table);
+#endif
+}
+
+/**
+ * zt_repeat_tests__report reports failure statistics of repeated test cases.
+ *
+ * In shuffle mode the seed of the first failed iteration is reported, so
+ * that its order can be replayed.
+ **/
+static void zt_repeat_tests__report(const zt_test_table* table, FILE* stream_err,
+    const zt_options* opts, unsigned long iterations, unsigned long first_failure)
+{
+    zt_buffer path;
+    size_t i;
+
+    fprintf(stream_err, "iterations executed: %lu\n", iterations);
+    if (first_failure == 0) {
+        return;
+    }
+    if (opts->shuffle) {
+        fprintf(stream_err, "first failure in iteration: %lu, with --shuffle=%lu\n", first_failure,
+            opts->seed + (first_failure - 1));
+    } else {
+        fprintf(stream_err, "first failure in iteration: %lu\n", first_failure);
+    }
+    memset(&path, 0, sizeof path);
+    for (i = 0; i < table->len; i++) {
+        const zt_test_entry* entry = &table->entries[i];
+        if (entry->kind != ZT_ENTRY_CASE || entry->num_failures == 0) {
+            continue;
+        }
+        path.len = 0;
+        if (zt_test_table_append_path(table, i, &path) && zt_buffer_append(&path, "", 1)) {
+            fprintf(stream_err, "failure rate of %s: %lu of %lu (%.1f%%)\n", path.data,
+                (unsigned long)entry->num_failures, (unsigned long)entry->num_runs,
+                100.0 * entry->num_failures / entry->num_runs);
+        }
+    }
+    zt_buffer_free(&path);
+}
+
+/**
+ * zt_repeat_tests_from_table runs test cases from a table repeatedly.
+ *
+ * The table is collected once and rewound between iterations, so that
+ * each iteration costs only the execution of test cases, in the mode
+ * selected by options. Setup functions are executed in the first iteration
+ * only, a failed setup function ends repetition. Repetition also ends
+ * after the requested number of iterations or when fail-fast mode stops an
+ * iteration. Until-fail mode stops an iteration at its first failure,
+ * without starting any more test cases. In shuffle mode each iteration
+ * uses the next seed.
+ **/
+static void zt_repeat_tests_from_table(zt_test_runner* runner, zt_test_table* table,
+    const zt_options* opts)
+{
+    size_t* items;
+    size_t num_items;
+    unsigned long iteration;
+    unsigned long first_failure = 0;
+    size_t i;
+
+    items = (size_t*)malloc((table->len + 1) * sizeof *items);
+    if (items == NULL) {
+        if (runner->stream_err) {
+            fprintf(runner->stream_err, "cannot allocate memory for repeating test cases\n");
         }
-        func(&test);
+        runner->num_failed++;
+        return;
     }
-    switch (test.outcome) {
-    case ZT_PENDING:
-    case ZT_PASSED:
-        if (runner->verbose && runner->stream_out) {
-            fprintf(runner->stream_out, " ok\n");
+    for (iteration = 1;; iteration++) {
+        bool setup_failed = false;
+        /* Test cases that failed while collecting the table are not executed. */
+        num_items = 0;
+        for (i = 0; i < table->len; i++) {
+            if (table->entries[i].kind == ZT_ENTRY_CASE && !table->entries[i].done) {
+                items[num_items++] = i;
+            }
         }
-        runner->num_passed++;
-        break;
-    case ZT_FAILED:
-        if (runner->verbose && runner->stream_out) {
-            fprintf(runner->stream_out, " failed\n");
+        zt_run_tests_from_table(runner, table, opts);
+        for (i = 0; i < table->len; i++) {
+            zt_test_entry* entry = &table->entries[i];
+            if (entry->kind == ZT_ENTRY_SETUP) {
+                setup_failed = setup_failed || zt_test_entry__failed(entry);
+            } else if (entry->kind == ZT_ENTRY_CASE && entry->done && !entry->excluded && !entry->cancelled) {
+                entry->num_runs++;
+                if (zt_test_entry__failed(entry)) {
+                    entry->num_failures++;
+                }
+            }
         }
-        runner->num_failed++;
-        break;
-    default:
-        if (runner->verbose && runner->stream_out) {
-            fprintf(runner->stream_out, " outcome code %d (?)\n", test.outcome);
+        if (table->num_failed > 0 && first_failure == 0) {
+            first_failure = iteration;
         }
-        if (runner->stream_err) {
-            fprintf(runner->stream_err, "%*c %s - unexpected outcome code %d\n",
-                runner->nesting * 3, '-', name, test.outcome);
+        if (setup_failed || zt_test_table_stopped(table)
+            || (opts->repeat > 0 && iteration >= (unsigned long)opts->repeat)) {
+            break;
+        }
+        zt_test_table_rewind(table, items, num_items);
+        if (opts->shuffle && !zt_test_table_shuffle(table, opts->seed + iteration)) {
+            if (runner->stream_err) {
+                fprintf(runner->stream_err, "cannot allocate memory to shuffle test cases\n");
+            }
+            runner->num_failed++;
+            break;
         }
-        runner->num_failed++;
-        break;
     }
-}
-
-static const zt_visitor_vtab zt_test_runner__visitor_vtab = {
-    /* .visit_case = */ zt_runner_visitor__visit_case,
-    /* .visit_suite = */ zt_runner_visitor__visit_suite,
-};
-
-static zt_visitor zt_visitor_from_test_runner(zt_test_runner* runner)
-{
-    zt_visitor visitor;
-    visitor.id = runner;
-    visitor.vtab = &zt_test_runner__visitor_vtab;
-    return visitor;
+    free(items);
+    if (runner->stream_err) {
+        zt_repeat_tests__report(table, runner->stream_err, opts, iteration, first_failure);
+    }
 }
 
 /** zt_run_tests_from runs tests from given suite and returns the outcome. */
-static zt_outcome zt_run_tests_from(FILE* stream_out, FILE* stream_err, bool verbose,
-    void (*test_suite_func)(zt_visitor))
+static zt_outcome zt_run_tests_from(FILE* stream_out, FILE* stream_err,
+    const zt_options* opts, void (*test_suite_func)(zt_visitor))
 {
     zt_test_runner runner;
+    zt_test_table table;
+    const zt_failed_state* only_failed = NULL;
+#ifdef ZT_HAVE_POSIX
+    zt_failed_state failed;
+#endif
+#ifdef ZT_HAVE_AFFINITY
+    zt_cpu_topology cpus;
+#endif
     memset(&runner, 0, sizeof runner);
     runner.stream_out = stream_out;
     runner.stream_err = stream_err;
-    runner.verbose = verbose;
-    test_suite_func(zt_visitor_from_test_runner(&runner));
+    runner.verbose = opts->verbose;
+#ifdef ZT_HAVE_AFFINITY
+    if (opts->jobs > 0 && (opts->cpus != NULL || opts->no_smt)) {
+        if (!zt_cpu_topology_init(&cpus, opts->cpus != NULL ? opts->cpus : "all", opts->no_smt)) {
+            if (stream_err) {
+                fprintf(stream_err, "cannot find CPUs to pin test processes to\n");
+            }
+            zt_cpu_topology_free(&cpus);
+            return ZT_FAILED;
+        }
+        runner.cpus = &cpus;
+    }
+#endif
+#ifdef ZT_HAVE_POSIX
+    memset(&failed, 0, sizeof failed);
+    if (opts->failed_state != NULL && !zt_failed_state_load(&failed, opts->failed_state, opts->program)) {
+        if (stream_err) {
+            fprintf(stream_err, "cannot load failed test cases from %s: %s\n", opts->failed_state, strerror(errno));
+        }
+    }
+    /* When no test case is known to have failed, all of them are executed. */
+    if (opts->only_failed && failed.num_cases > 0) {
+        only_failed = &failed;
+    }
+#endif
+    memset(&table, 0, sizeof table);
+    if (zt_collect_selected_tests_from(&table, test_suite_func, opts->pattern, only_failed)) {
+        bool sharded = true;
+        bool shuffled = true;
+        bool selected = true;
+#ifdef ZT_HAVE_POSIX
+        zt_history history;
+        zt_journal journal;
+#endif
+#ifdef ZT_HAVE_CODE_HASH
+        zt_code_stats code_stats;
+#endif
+#ifdef ZT_HAVE_COVERAGE
+        zt_coverage coverage;
+#endif
+#ifdef ZT_HAVE_POSIX
+        if (opts->history != NULL) {
+            zt_history_open(&history, opts->history);
+            zt_history_estimate(&history, &table);
+        }
+#endif
+        /* Shards are assigned in the order of collection, which is the same
+         * on every machine, before any reordering. */
+        if (opts->num_shards > 0) {
+            sharded = zt_test_table_shard(&table, opts->shard, opts->num_shards);
+        }
+        if (opts->shuffle) {
+            if (stream_err) {
+                fprintf(stream_err, "shuffling test cases with --shuffle=%lu\n", opts->seed);
+            }
+            shuffled = zt_test_table_shuffle(&table, opts->seed);
+        }
+#ifdef ZT_HAVE_POSIX
+        if (opts->failed_first && failed.num_cases > 0) {
+            zt_test_table_failed_first(&table, &failed);
+        }
+#endif
+#ifdef ZT_HAVE_CODE_HASH
+        memset(&code_stats, 0, sizeof code_stats);
+        if (opts->code_cache != NULL && !zt_select_changed_tests(&table, opts->code_cache, opts->program, &code_stats, stream_err)) {
+            runner.num_failed++;
+            selected = false;
+        }
+#endif
+        if (!shuffled) {
+            if (stream_err) {
+                fprintf(stream_err, "cannot allocate memory to shuffle test cases\n");
+            }
+            runner.num_failed++;
+        } else if (!selected) {
+            /* The reason was already reported. */
+        } else if (!sharded) {
+            if (stream_err) {
+                fprintf(stream_err, "cannot allocate memory for %d shards\n", opts->num_shards);
+            }
+            runner.num_failed++;
+#ifdef ZT_HAVE_POSIX
+        } else if (opts->journal != NULL && !zt_journal_open(&journal, opts->journal, opts->resume)) {
+            if (stream_err) {
+                fprintf(stream_err, "cannot open journal %s: %s\n", opts->journal, strerror(errno));
+            }
+            runner.num_failed++;
+        } else if (opts->journal != NULL && opts->resume && !zt_journal_skip_passed(&journal, &table)) {
+            if (stream_err) {
+                fprintf(stream_err, "cannot allocate memory to resume from journal %s\n", opts->journal);
+            }
+            zt_journal_close(&journal);
+            runner.num_failed++;
+#endif
+#ifdef ZT_HAVE_COVERAGE
+        } else if (opts->coverage_map != NULL
+            && !zt_coverage_open(&coverage, opts->coverage_map, &table, opts->program)) {
+            if (stream_err) {
+                fprintf(stream_err, "cannot collect coverage to %s: %s\n", opts->coverage_map, strerror(errno));
+            }
+            if (opts->journal != NULL) {
+                zt_journal_close(&journal);
+            }
+            runner.num_failed++;
+#endif
+        } else {
+#ifdef ZT_HAVE_POSIX
+            if (opts->journal != NULL) {
+                table.journal = &journal;
+            }
+#endif
+#ifdef ZT_HAVE_COVERAGE
+            if (opts->coverage_map != NULL) {
+                runner.coverage = &coverage;
+            }
+#endif
+#ifdef ZT_HAVE_CRASH_RECOVERY
+            if (opts->catch_signals && !zt_crash_recovery_start() && stream_err) {
+                fprintf(stream_err, "cannot catch crash signals: %s\n", strerror(errno));
+            }
+#endif
+            if (zt_test_table_apply_timeout(&table, (uint32_t)opts->timeout)) {
+#ifdef ZT_HAVE_WATCHDOG
+                if (!zt_watchdog_start() && stream_err) {
+                    fprintf(stream_err, "cannot start the watchdog: %s\n", strerror(errno));
+                }
+#endif
+            }
+            if (opts->repeat > 0 || opts->until_fail) {
+                zt_repeat_tests_from_table(&runner, &table, opts);
+            } else {
+                zt_run_tests_from_table(&runner, &table, opts);
+            }
+#ifdef ZT_HAVE_WATCHDOG
+            if (zt_watchdog) {
+                zt_watchdog_stop();
+            }
+#endif
+#ifdef ZT_HAVE_CRASH_RECOVERY
+            if (zt_crash_recovery) {
+                zt_crash_recovery_stop();
+            }
+            zt_thread_guard_release();
+#endif
+#ifdef ZT_HAVE_COVERAGE
+            if (runner.coverage != NULL) {
+                zt_coverage_close(&coverage);
+                runner.coverage = NULL;
+            }
+#endif
+        }
+#ifdef ZT_HAVE_POSIX
+        if (table.journal != NULL) {
+            if (journal.num_skipped > 0 && stream_err) {
+                fprintf(stream_err, "test cases not executed because they passed before: %lu\n",
+                    (unsigned long)journal.num_skipped);
+            }
+            zt_journal_close(&journal);
+            table.journal = NULL;
+        }
+        if (opts->history != NULL) {
+            zt_history_save(&history, &table, opts->history, stream_err);
+            zt_history_close(&history);
+        }
+        if (opts->failed_state != NULL) {
+            zt_failed_state_save(&table, opts->failed_state, opts->program, stream_err);
+        }
+#endif
+#ifdef ZT_HAVE_CODE_HASH
+        if (opts->code_cache != NULL && selected) {
+            zt_code_cache_save(&table, opts->code_cache, opts->program, stream_err);
+            zt_code_stats_report(&code_stats, stream_err);
+        }
+#endif
+    } else {
+        if (stream_err) {
+            fprintf(stream_err, "cannot allocate memory for the test table\n");
+        }
+        runner.num_failed++;
+    }
+    zt_test_table_free(&table);
+#ifdef ZT_HAVE_POSIX
+    zt_failed_state_free(&failed);
+#endif
+    if (runner.num_cancelled > 0 && stream_err) {
+        fprintf(stream_err, "test cases not executed because of %s: %d\n",
+            opts->until_fail ? "--until-fail" : "--fail-fast", runner.num_cancelled);
+    }
+#ifdef ZT_HAVE_AFFINITY
+    if (runner.cpus != NULL) {
+        zt_cpu_topology_free(&cpus);
+    }
+#endif
     if (runner.num_failed > 0) {
         return ZT_FAILED;
     }
@@ -486,6 +6504,8 @@ static zt_outcome zt_run_tests_from(FILE* stream_out, FILE* stream_err, bool ver
 
 /* claim verifier and test failure */
 
+static bool zt_claim_holds(const zt_claim* claim);
+
 static bool zt_verify_claim(zt_test* test, const zt_claim* claim)
 {
     zt_verifier verifier = claim->make_verifier();
@@ -535,6 +6555,10 @@ static bool zt_verify_claim(zt_test* test, const zt_claim* claim)
 
 void zt_check(zt_test* test, zt_claim claim)
 {
+    if (zt_claim_holds(&claim)) {
+        test->location = claim.location;
+        return;
+    }
     if (!zt_verify_claim(test, &claim)) {
         test->outcome = ZT_FAILED;
     }
@@ -542,6 +6566,10 @@ void zt_check(zt_test* test, zt_claim claim)
 
 void zt_assert(zt_test* test, zt_claim claim)
 {
+    if (zt_claim_holds(&claim)) {
+        test->location = claim.location;
+        return;
+    }
     if (!zt_verify_claim(test, &claim)) {
         test->outcome = ZT_FAILED;
 #if defined(_WIN32) || defined(__WATCOMC__)
@@ -580,21 +6608,405 @@ static FILE* zt_stderr(void)
     return stderr;
 }
 
+/** zt_parse_int parses a decimal integer not smaller than min. */
+static bool zt_parse_int(const char* text, int min, int* result)
+{
+    char* end = NULL;
+    long value;
+
+    if (text == NULL || *text == '\0') {
+        return false;
+    }
+    errno = 0;
+    value = strtol(text, &end, 10);
+    if (errno != 0 || end == NULL || *end != '\0' || value < min || value > INT_MAX) {
+        return false;
+    }
+    *result = (int)value;
+    return true;
+}
+
+/**
+ * zt_option_value returns the value of an option with a mandatory argument.
+ *
+ * Both "-jN" and "-j N" forms are supported. The index of the current
+ * argument is advanced if the value is stored in the next argument.
+ **/
+static const char* zt_option_value(int argc, char** argv, int* i, const char* opt)
+{
+    const char* arg = argv[*i] + strlen(opt);
+    if (*arg != '\0') {
+        return arg;
+    }
+    if (*i + 1 < argc) {
+        (*i)++;
+        return argv[*i];
+    }
+    return NULL;
+}
+
+/** zt_parse_seed parses a non-negative decimal seed of the random order. */
+static bool zt_parse_seed(const char* text, unsigned long* seed)
+{
+    char* end = NULL;
+
+    if (!isdigit((unsigned char)*text)) {
+        return false;
+    }
+    errno = 0;
+    *seed = strtoul(text, &end, 10);
+    return errno == 0 && end != NULL && *end == '\0';
+}
+
+/** zt_parse_list_format parses the name of a listing format. */
+static bool zt_parse_list_format(const char* text, zt_list_format* format)
+{
+    if (text == NULL) {
+        return false;
+    }
+    if (strcmp(text, "human") == 0) {
+        *format = ZT_LIST_HUMAN;
+    } else if (strcmp(text, "json") == 0) {
+        *format = ZT_LIST_JSON;
+    } else if (strcmp(text, "lines") == 0) {
+        *format = ZT_LIST_LINES;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * zt_parse_shard parses the value of the --shard option.
+ *
+ * The value has the form I/N, where I is the one-based index of the shard
+ * to execute and N is the number of shards.
+ **/
+static bool zt_parse_shard(const char* text, int* shard, int* num_shards)
+{
+    char* end = NULL;
+    long index;
+    long count;
+
+    if (text == NULL || !isdigit((unsigned char)*text)) {
+        return false;
+    }
+    errno = 0;
+    index = strtol(text, &end, 10);
+    if (errno != 0 || *end != '/' || !isdigit((unsigned char)end[1])) {
+        return false;
+    }
+    count = strtol(end + 1, &end, 10);
+    if (errno != 0 || *end != '\0' || index < 1 || count > INT_MAX || index > count) {
+        return false;
+    }
+    *shard = (int)index - 1;
+    *num_shards = (int)count;
+    return true;
+}
+
+/**
+ * zt_parse_failed_state parses the optional state file of --failed-first and --only-failed.
+ *
+ * The value is either empty, selecting the default state file, or an equals
+ * sign followed by the name of the state file.
+ **/
+static bool zt_parse_failed_state(zt_options* opts, const char* value, const char* opt,
+    FILE* stream_err)
+{
+#ifdef ZT_HAVE_POSIX
+    if (*value == '\0') {
+        opts->failed_state = ZT_FAILED_STATE_FILE;
+        return true;
+    }
+    if (value[1] != '\0') {
+        opts->failed_state = value + 1;
+        return true;
+    }
+    if (stream_err) {
+        fprintf(stream_err, "option %s requires a file name after =\n", opt);
+    }
+#else
+    (void)opts;
+    (void)value;
+    if (stream_err) {
+        fprintf(stream_err, "option %s is not supported on this platform\n", opt);
+    }
+#endif
+    return false;
+}
+
+/**
+ * zt_parse_code_cache parses the optional value of the --skip-unchanged option.
+ *
+ * The value is either empty, for the default file, or "=FILE".
+ **/
+static bool zt_parse_code_cache(zt_options* opts, const char* value, FILE* stream_err)
+{
+#ifdef ZT_HAVE_CODE_HASH
+    if (*value == '\0') {
+        opts->code_cache = ZT_CODE_CACHE_FILE;
+        return true;
+    }
+    if (value[1] != '\0') {
+        opts->code_cache = value + 1;
+        return true;
+    }
+    if (stream_err) {
+        fprintf(stream_err, "option --skip-unchanged requires a file name after =\n");
+    }
+#else
+    (void)opts;
+    (void)value;
+    if (stream_err) {
+        fprintf(stream_err, "option --skip-unchanged is not supported on this platform\n");
+    }
+#endif
+    return false;
+}
+
+/**
+ * zt_parse_coverage_map parses the value of the --coverage-map option.
+ *
+ * The option is only available in test programs built for coverage.
+ **/
+static bool zt_parse_coverage_map(zt_options* opts, const char* value, FILE* stream_err)
+{
+#ifdef ZT_HAVE_COVERAGE
+    if (value != NULL && *value != '\0') {
+        opts->coverage_map = value;
+        return true;
+    }
+    if (stream_err) {
+        fprintf(stream_err, "option --coverage-map requires a file name\n");
+    }
+#else
+    (void)opts;
+    (void)value;
+    if (stream_err) {
+        fprintf(stream_err, "option --coverage-map requires a test program built with --coverage and ZT_WITH_GCOV\n");
+    }
+#endif
+    return false;
+}
+
+/** zt_parse_options parses command line arguments of zt_main. */
+static bool zt_parse_options(zt_options* opts, int argc, char** argv, FILE* stream_err)
+{
+    int i;
+
+    memset(opts, 0, sizeof *opts);
+    opts->program = "";
+    if (argc > 0) {
+        const char* slash = strrchr(argv[0], '/');
+        opts->program = slash != NULL ? slash + 1 : argv[0];
+    }
+    for (i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-l") == 0) {
+            opts->list = true;
+        } else if (strcmp(arg, "-v") == 0) {
+            opts->verbose = true;
+        } else if (strcmp(arg, "--format") == 0 || strncmp(arg, "--format=", 9) == 0) {
+            const char* value = arg[8] == '=' ? arg + 9 : (i + 1 < argc ? argv[++i] : NULL);
+            if (!zt_parse_list_format(value, &opts->format)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option --format requires one of human, json or lines\n");
+                }
+                return false;
+            }
+        } else if (strncmp(arg, "-j", 2) == 0) {
+            const char* value = zt_option_value(argc, argv, &i, "-j");
+            if (!zt_parse_int(value, 1, &opts->jobs)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option -j requires a positive number of jobs\n");
+                }
+                return false;
+            }
+        } else if (strncmp(arg, "-b", 2) == 0) {
+            const char* value = zt_option_value(argc, argv, &i, "-b");
+            if (!zt_parse_int(value, 1, &opts->batch)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option -b requires a positive batch size\n");
+                }
+                return false;
+            }
+        } else if (strcmp(arg, "--shard") == 0 || strncmp(arg, "--shard=", 8) == 0) {
+            const char* value = arg[7] == '=' ? arg + 8 : (i + 1 < argc ? argv[++i] : NULL);
+            if (!zt_parse_shard(value, &opts->shard, &opts->num_shards)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option --shard requires a value I/N, with I from 1 to N\n");
+                }
+                return false;
+            }
+        } else if (strncmp(arg, "-d", 2) == 0) {
+            opts->history = zt_option_value(argc, argv, &i, "-d");
+            if (opts->history == NULL || *opts->history == '\0') {
+                if (stream_err) {
+                    fprintf(stream_err, "option -d requires a file name\n");
+                }
+                return false;
+            }
+        } else if (strcmp(arg, "--cpus") == 0 || strncmp(arg, "--cpus=", 7) == 0) {
+#ifdef ZT_HAVE_AFFINITY
+            cpu_set_t set;
+            opts->cpus = arg[6] == '=' ? arg + 7 : (i + 1 < argc ? argv[++i] : NULL);
+            if (opts->cpus == NULL || !zt_cpu_list_parse(opts->cpus, &set)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option --cpus requires a list of CPUs, like 0-3,8, or all\n");
+                }
+                return false;
+            }
+#else
+            if (stream_err) {
+                fprintf(stream_err, "option --cpus is not supported on this platform\n");
+            }
+            return false;
+#endif
+        } else if (strcmp(arg, "--catch-signals") == 0) {
+#ifdef ZT_HAVE_CRASH_RECOVERY
+            opts->catch_signals = true;
+#else
+            if (stream_err) {
+                fprintf(stream_err, "option --catch-signals is not supported on this platform\n");
+            }
+            return false;
+#endif
+        } else if (strcmp(arg, "--timeout") == 0 || strncmp(arg, "--timeout=", 10) == 0) {
+            const char* value = arg[9] == '=' ? arg + 10 : (i + 1 < argc ? argv[++i] : NULL);
+            if (!zt_parse_int(value, 1, &opts->timeout)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option --timeout requires a positive number of seconds\n");
+                }
+                return false;
+            }
+#ifndef ZT_HAVE_POSIX
+            if (stream_err) {
+                fprintf(stream_err, "option --timeout is not supported on this platform\n");
+            }
+            return false;
+#endif
+        } else if (strcmp(arg, "--no-smt") == 0) {
+            opts->no_smt = true;
+        } else if (strcmp(arg, "--fail-fast") == 0) {
+            opts->max_failures = 1;
+        } else if (strncmp(arg, "--fail-fast=", 12) == 0) {
+            if (!zt_parse_int(arg + 12, 1, &opts->max_failures)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option --fail-fast requires a positive number of failures\n");
+                }
+                return false;
+            }
+        } else if (strncmp(arg, "--failed-first", 14) == 0 && (arg[14] == '\0' || arg[14] == '=')) {
+            opts->failed_first = true;
+            if (!zt_parse_failed_state(opts, arg + 14, "--failed-first", stream_err)) {
+                return false;
+            }
+        } else if (strncmp(arg, "--only-failed", 13) == 0 && (arg[13] == '\0' || arg[13] == '=')) {
+            opts->only_failed = true;
+            if (!zt_parse_failed_state(opts, arg + 13, "--only-failed", stream_err)) {
+                return false;
+            }
+        } else if (strcmp(arg, "--repeat") == 0 || strncmp(arg, "--repeat=", 9) == 0) {
+            const char* value = arg[8] == '=' ? arg + 9 : (i + 1 < argc ? argv[++i] : NULL);
+            if (!zt_parse_int(value, 1, &opts->repeat)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option --repeat requires a positive number of iterations\n");
+                }
+                return false;
+            }
+        } else if (strcmp(arg, "--until-fail") == 0) {
+            opts->until_fail = true;
+        } else if (strcmp(arg, "--journal") == 0 || strncmp(arg, "--journal=", 10) == 0
+            || strcmp(arg, "--resume") == 0 || strncmp(arg, "--resume=", 9) == 0) {
+            const char* opt = arg[2] == 'j' ? "--journal" : "--resume";
+            size_t n = strlen(opt);
+            opts->journal = arg[n] == '=' ? arg + n + 1 : (i + 1 < argc ? argv[++i] : NULL);
+            opts->resume = arg[2] == 'r';
+            if (opts->journal == NULL || *opts->journal == '\0') {
+                if (stream_err) {
+                    fprintf(stream_err, "option %s requires a file name\n", opt);
+                }
+                return false;
+            }
+#ifndef ZT_HAVE_POSIX
+            if (stream_err) {
+                fprintf(stream_err, "option %s is not supported on this platform\n", opt);
+            }
+            return false;
+#endif
+        } else if (strncmp(arg, "--skip-unchanged", 16) == 0 && (arg[16] == '\0' || arg[16] == '=')) {
+            if (!zt_parse_code_cache(opts, arg + 16, stream_err)) {
+                return false;
+            }
+        } else if (strcmp(arg, "--coverage-map") == 0 || strncmp(arg, "--coverage-map=", 15) == 0) {
+            const char* value = arg[14] == '=' ? arg + 15 : (i + 1 < argc ? argv[++i] : NULL);
+            if (!zt_parse_coverage_map(opts, value, stream_err)) {
+                return false;
+            }
+        } else if (strcmp(arg, "--shuffle") == 0) {
+            opts->shuffle = true;
+            opts->seed = ((unsigned long)time(NULL) ^ (unsigned long)zt_clock_usec()) & 0xffffffffUL;
+        } else if (strncmp(arg, "--shuffle=", 10) == 0) {
+            opts->shuffle = true;
+            if (!zt_parse_seed(arg + 10, &opts->seed)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option --shuffle requires a number as the seed\n");
+                }
+                return false;
+            }
+        } else if (strncmp(arg, "-r", 2) == 0) {
+            opts->pattern = zt_option_value(argc, argv, &i, "-r");
+            if (opts->pattern == NULL || *opts->pattern == '\0') {
+                if (stream_err) {
+                    fprintf(stream_err, "option -r requires a pattern\n");
+                }
+                return false;
+            }
+        } else if (strncmp(arg, "-R", 2) == 0) {
+            opts->resources = zt_option_value(argc, argv, &i, "-R");
+            if (opts->resources == NULL || *opts->resources == '\0' || !zt_resources_valid(opts->resources, false)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option -R requires a list of resource capacities NAME=N\n");
+                }
+                return false;
+            }
+        } else if (strncmp(arg, "-t", 2) == 0) {
+            const char* value = zt_option_value(argc, argv, &i, "-t");
+            if (!zt_parse_int(value, 1, &opts->threads)) {
+                if (stream_err) {
+                    fprintf(stream_err, "option -t requires a positive number of threads\n");
+                }
+                return false;
+            }
+        } else {
+            if (stream_err) {
+                fprintf(stream_err, "unknown option: %s\n", arg);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
 int zt_main(int argc, char** argv, ZT_UNUSED char** envp,
     zt_test_suite_func tsuite)
 {
+    zt_options opts;
     (void)envp;
-    if (argc == 2 && strcmp(argv[1], "-l") == 0) {
-        zt_list_tests_from(zt_stdout(), tsuite);
+    if (!zt_parse_options(&opts, argc, argv, zt_stderr())) {
+        return EXIT_FAILURE;
+    }
+    if (opts.list) {
+        if (!zt_list_tests_from(zt_stdout(), tsuite, opts.pattern, opts.format)) {
+            fprintf(zt_stderr(), "cannot allocate memory for the test table\n");
+            return EXIT_FAILURE;
+        }
         return EXIT_SUCCESS;
-    } else {
-        bool verbose = argc == 2 && strcmp(argv[1], "-v") == 0;
-        return zt_run_tests_from(
-                   zt_stdout(), zt_stderr(), verbose, tsuite)
-                == ZT_PASSED
-            ? EXIT_SUCCESS
-            : EXIT_FAILURE;
     }
+    return zt_run_tests_from(zt_stdout(), zt_stderr(), &opts, tsuite) == ZT_PASSED
+        ? EXIT_SUCCESS
+        : EXIT_FAILURE;
 }
 
 /* verifiers and verification functions */
@@ -788,6 +7200,7 @@ static bool zt_verify_rune_relation(zt_test* test, zt_value left, zt_value rel,
     if (test->stream) {
         const zt_location loc = test->location;
         FILE* stream = test->stream;
+        zt_lock_stream(stream);
         fprintf(stream, "%s:%d: ", loc.fname, loc.lineno);
         fprintf(stream, "assertion %s %s %s failed because ",
             zt_source_of(left), zt_binary_relation_as_text(bin_rel),
@@ -796,6 +7209,7 @@ static bool zt_verify_rune_relation(zt_test* test, zt_value left, zt_value rel,
         fprintf(stream, " %s ", zt_binary_relation_as_text(zt_invert_binary_relation(bin_rel)));
         zt_quote_rune(stream, right.as.rune);
         fprintf(stream, "\n");
+        zt_unlock_stream(stream);
     }
     return false;
 }
@@ -1081,6 +7495,7 @@ static bool zt_verify_string_relation(zt_test* test, zt_value left, zt_value rel
     if (test->stream) {
         const zt_location loc = test->location;
         FILE* stream = test->stream;
+        zt_lock_stream(stream);
         fprintf(stream, "%s:%d: ", loc.fname, loc.lineno);
         fprintf(stream, "assertion %s %s %s failed because ", zt_source_of(left),
             rel.as.string, zt_source_of(right));
@@ -1088,6 +7503,7 @@ static bool zt_verify_string_relation(zt_test* test, zt_value left, zt_value rel
         fprintf(stream, " %s ", zt_binary_relation_as_text(zt_invert_binary_relation(bin_rel)));
         zt_quote_string(stream, right.as.string);
         fprintf(stream, "\n");
+        zt_unlock_stream(stream);
     }
     return false;
 }
@@ -1252,3 +7668,154 @@ zt_claim zt_cmp_ptr(zt_location location, zt_value left, zt_value rel, zt_value
     claim.args[2] = right;
     return claim;
 }
+
+/**
+ * zt_claim__relate completes a claim of a relation between its arguments.
+ *
+ * The left and right hand sides must be stored in args[0] and args[2]. They
+ * are promoted and the kind of the left hand side selects the verifier. The
+ * relation, encoded at compile time by ZT_RELATION, is stored as a pointer
+ * to its text in zt_relation_texts, which carries the code to
+ * zt_claim_holds and the text to failure messages.
+ **/
+static void zt_claim__relate(zt_claim* claim, int relation)
+{
+    const char* text = zt_relation_text(relation);
+    claim->args[1] = zt_pack_string(text, text);
+    zt_promote_value(&claim->args[0]);
+    zt_promote_value(&claim->args[2]);
+    switch (zt_value_kind_of(claim->args[0])) {
+    case ZT_BOOLEAN:
+        claim->make_verifier = zt_verifier_for_boolean_relation;
+        break;
+    case ZT_RUNE:
+        claim->make_verifier = zt_verifier_for_rune_relation;
+        break;
+    case ZT_UINTMAX:
+        claim->make_verifier = zt_verifier_for_unsigned_relation;
+        break;
+    case ZT_STRING:
+        claim->make_verifier = zt_verifier_for_string_relation;
+        break;
+    case ZT_POINTER:
+        claim->make_verifier = zt_verifier_for_pointer_relation;
+        break;
+    /* List all possible cases to silence Visual Studio warning C4061. */
+    case ZT_NOTHING:
+    case ZT_INTEGER:
+    case ZT_UNSIGNED:
+    case ZT_INTMAX:
+    default:
+        claim->make_verifier = zt_verifier_for_integer_relation;
+        break;
+    }
+}
+
+/**
+ * zt_cmp constructs a claim of a relation between two values.
+ *
+ * The kind of the left hand side selects the verifier, exactly like the
+ * choice of zt_cmp_int, zt_cmp_cstr and the other constructors. The relation
+ * is encoded at compile time by ZT_RELATION, the claim carries its text
+ * for failure messages.
+ **/
+zt_claim zt_cmp(zt_location location, zt_value left, int relation, zt_value right)
+{
+    zt_claim claim;
+    memset(&claim, 0, sizeof claim);
+    claim.location = location;
+    claim.args[0] = left;
+    claim.args[2] = right;
+    zt_claim__relate(&claim, relation);
+    return claim;
+}
+
+/**
+ * zt_cmp_at constructs a claim of a relation described by a claim site.
+ *
+ * The site is a static descriptor defined by the ZT_CMP_* macros, only the
+ * compared values are computed at runtime. The claim is the same as the one
+ * made by zt_cmp with the location, relation and values from the site.
+ **/
+zt_claim zt_cmp_at(const zt_claim_site* site, zt_scalar left, zt_scalar right)
+{
+    zt_claim claim;
+    claim.location = site->location;
+    claim.args[0].as = left;
+    claim.args[0].source = site->left_source;
+    claim.args[0].kind = site->kind;
+    claim.args[2].as = right;
+    claim.args[2].source = site->right_source;
+    claim.args[2].kind = site->kind;
+    if (site->kind == ZT_RUNE) {
+        /* Normalize negative runes like zt_pack_rune does. */
+        claim.args[0] = zt_pack_rune(left.rune, site->left_source);
+        claim.args[2] = zt_pack_rune(right.rune, site->right_source);
+    }
+    zt_claim__relate(&claim, site->relation);
+    return claim;
+}
+
+/* fast path of passing claims */
+
+/** ZT_COMPARE returns the sign of the comparison of two scalar values. */
+#define ZT_COMPARE(a, b) (((a) > (b)) - ((a) < (b)))
+
+/**
+ * zt_claim_holds returns true if a claim made by a claim constructor holds.
+ *
+ * This is the fast path of zt_check and zt_assert, which neither makes a
+ * verifier nor looks at any strings. Relations are recovered from the code
+ * carried by claims made by zt_cmp and zt_cmp_at. It returns false for
+ * claims which fail, have arguments of unexpected kinds or a relation given
+ * as text, as well as for string relations. Such claims are verified by
+ * zt_verify_claim, which also reports failures.
+ **/
+static bool zt_claim_holds(const zt_claim* claim)
+{
+    zt_verifier (*make_verifier)(void) = claim->make_verifier;
+    const zt_value* args = claim->args;
+    int rel;
+
+    if (make_verifier == zt_verifier_for_true) {
+        return args[0].kind == ZT_BOOLEAN && args[0].as.boolean;
+    }
+    if (make_verifier == zt_verifier_for_false) {
+        return args[0].kind == ZT_BOOLEAN && !args[0].as.boolean;
+    }
+    if (make_verifier == zt_verifier_for_null) {
+        return args[0].kind == ZT_POINTER && args[0].as.pointer == NULL;
+    }
+    if (make_verifier == zt_verifier_for_not_null) {
+        return args[0].kind == ZT_POINTER && args[0].as.pointer != NULL;
+    }
+    if (args[1].kind != ZT_STRING || args[1].as.string != args[1].source) {
+        return false;
+    }
+    rel = zt_relation_code(args[1].as.string);
+    if (make_verifier == zt_verifier_for_integer_relation) {
+        return args[0].kind == ZT_INTMAX && args[2].kind == ZT_INTMAX
+            && zt_relation_code_holds(rel, ZT_COMPARE(args[0].as.intmax, args[2].as.intmax));
+    }
+    if (make_verifier == zt_verifier_for_unsigned_relation) {
+        return args[0].kind == ZT_UINTMAX && args[2].kind == ZT_UINTMAX
+            && zt_relation_code_holds(rel, ZT_COMPARE(args[0].as.uintmax, args[2].as.uintmax));
+    }
+    if (make_verifier == zt_verifier_for_rune_relation) {
+        return args[0].kind == ZT_RUNE && args[2].kind == ZT_RUNE
+            && zt_relation_code_holds(rel, ZT_COMPARE(args[0].as.rune, args[2].as.rune));
+    }
+    /* Booleans and pointers are only equal or not equal. */
+    if (rel != 1 && rel != 6) {
+        return false;
+    }
+    if (make_verifier == zt_verifier_for_boolean_relation) {
+        return args[0].kind == ZT_BOOLEAN && args[2].kind == ZT_BOOLEAN
+            && zt_relation_code_holds(rel, args[0].as.boolean != args[2].as.boolean);
+    }
+    if (make_verifier == zt_verifier_for_pointer_relation) {
+        return args[0].kind == ZT_POINTER && args[2].kind == ZT_POINTER
+            && zt_relation_code_holds(rel, args[0].as.pointer != args[2].as.pointer);
+    }
+    return false;
+}
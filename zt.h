@@ -44,9 +44,48 @@ int zt_main(int argc, char** argv, char** envp, zt_test_suite_func tsuite);
 
 void zt_visit_test_suite(zt_visitor v, zt_test_suite_func func, const char* name);
 void zt_visit_test_case(zt_visitor v, zt_test_case_func func, const char* name);
+void zt_visit_test_case_mt(zt_visitor v, zt_test_case_func func, const char* name);
+void zt_visit_suite_setup(zt_visitor v, zt_test_case_func func, const char* name);
+void zt_visit_test_case_with(zt_visitor v, zt_test_case_func func, const char* name,
+    const char* resources);
 
 #define ZT_VISIT_TEST_SUITE(v, tsuite) zt_visit_test_suite(v, tsuite, #tsuite)
-#define ZT_VISIT_TEST_CASE(v, tcase) zt_visit_test_case(v, tcase, #tcase)
+#define ZT_VISIT_TEST_CASE(v, tcase) zt_visit_test_case_at(v, tcase, #tcase, ZT_CURRENT_LOCATION())
+#define ZT_VISIT_TEST_CASE_MT(v, tcase) zt_visit_test_case_mt_at(v, tcase, #tcase, ZT_CURRENT_LOCATION())
+#define ZT_VISIT_SUITE_SETUP(v, tsetup) zt_visit_suite_setup(v, tsetup, #tsetup)
+#define ZT_VISIT_TEST_CASE_WITH(v, tcase, resources) \
+    zt_visit_test_case_with_at(v, tcase, #tcase, resources, ZT_CURRENT_LOCATION())
+
+typedef struct zt_test_registration {
+    zt_test_case_func func;
+    const char* name;
+    const char* fname;
+    int lineno;
+} zt_test_registration;
+
+void zt_visit_registered_tests(zt_visitor v, const zt_test_registration* begin,
+    const zt_test_registration* end);
+
+#if defined(__GNUC__) && defined(__ELF__)
+/* The linker defines these symbols around the zt_tests section of each
+ * executable or shared object, or leaves them null if there is none. */
+extern const zt_test_registration __start_zt_tests[] __attribute__((weak, visibility("hidden")));
+extern const zt_test_registration __stop_zt_tests[] __attribute__((weak, visibility("hidden")));
+
+#define ZT_TEST(tcase)                                                \
+    static void tcase(zt_t);                                          \
+    static const zt_test_registration zt_test_registration__##tcase   \
+        __attribute__((used, section("zt_tests"), aligned(sizeof(void*)))) \
+        = { tcase, #tcase, __FILE__, __LINE__ };                      \
+    static void tcase(zt_t t)
+
+#define ZT_VISIT_REGISTERED_TESTS(v) zt_visit_registered_tests(v, __start_zt_tests, __stop_zt_tests)
+
+static inline void zt_registered_tests(zt_visitor v)
+{
+    ZT_VISIT_REGISTERED_TESTS(v);
+}
+#endif
 
 typedef enum zt_value_kind {
     ZT_NOTHING,
@@ -60,17 +99,19 @@ typedef enum zt_value_kind {
     ZT_UINTMAX
 } zt_value_kind;
 
+typedef union zt_scalar {
+    bool boolean;
+    int rune;
+    int integer; /* Deprecated. */
+    unsigned unsigned_integer; /* Deprecated. */
+    const char* string;
+    const void* pointer;
+    intmax_t intmax;
+    uintmax_t uintmax;
+} zt_scalar;
+
 typedef struct zt_value {
-    union {
-        bool boolean;
-        int rune;
-        int integer; /* Deprecated. */
-        unsigned unsigned_integer; /* Deprecated. */
-        const char* string;
-        const void* pointer;
-        intmax_t intmax;
-        uintmax_t uintmax;
-    } as;
+    zt_scalar as;
     const char* source;
     zt_value_kind kind;
 } zt_value;
@@ -146,6 +187,13 @@ static inline zt_location zt_location_at(const char* fname, int lineno)
 
 #define ZT_CURRENT_LOCATION() zt_location_at(__FILE__, __LINE__)
 
+void zt_visit_test_case_at(zt_visitor v, zt_test_case_func func, const char* name,
+    zt_location location);
+void zt_visit_test_case_mt_at(zt_visitor v, zt_test_case_func func, const char* name,
+    zt_location location);
+void zt_visit_test_case_with_at(zt_visitor v, zt_test_case_func func, const char* name,
+    const char* resources, zt_location location);
+
 struct zt_verifier;
 typedef struct zt_claim {
     struct zt_verifier (*make_verifier)(void);
@@ -166,6 +214,20 @@ zt_claim zt_cmp_uint(zt_location location, zt_value left, zt_value rel, zt_value
 zt_claim zt_cmp_cstr(zt_location location, zt_value left, zt_value rel, zt_value right);
 zt_claim zt_null(zt_location location, zt_value value);
 zt_claim zt_not_null(zt_location location, zt_value value);
+zt_claim zt_cmp(zt_location location, zt_value left, int relation, zt_value right);
+
+/*
+ * ZT_RELATION encodes a relational operator as a constant, the set of
+ * outcomes of comparing two values for which the relation holds: 1 for
+ * equal, 2 for less and 4 for greater. Anything other than ==, !=, <, <=, >
+ * and >= fails to compile, as a syntax error or as an array of negative size.
+ */
+#define ZT_RELATION(rel) \
+    ((int)(0 * sizeof(char[ZT_RELATION_VALID_(rel) ? 1 : -1])) + ZT_RELATION_CODE_(rel))
+#define ZT_RELATION_CODE_(rel) ((1 rel 1) + 2 * (1 rel 2) + 4 * (2 rel 1))
+#define ZT_RELATION_VALID_(rel)                                                 \
+    ((1 rel 1) == (2 rel 2) && (1 rel 2) == (3 rel 5) && (2 rel 1) == (5 rel 3) \
+        && ZT_RELATION_CODE_(rel) >= 1 && ZT_RELATION_CODE_(rel) <= 6)
 
 #define ZT_TRUE(value)         \
     zt_true(                   \
@@ -177,47 +239,134 @@ zt_claim zt_not_null(zt_location location, zt_value value);
         ZT_CURRENT_LOCATION(), \
         zt_pack_boolean((value), #value))
 
+/*
+ * zt_claim_site holds the constant part of a comparison: its location, the
+ * source code of both operands, the relation encoded by ZT_RELATION and the
+ * kind of the values. Only the values themselves are passed to zt_cmp_at.
+ */
+typedef struct zt_claim_site {
+    zt_location location;
+    const char* left_source;
+    const char* right_source;
+    int relation;
+    zt_value_kind kind;
+} zt_claim_site;
+
+zt_claim zt_cmp_at(const zt_claim_site* site, zt_scalar left, zt_scalar right);
+
+static inline zt_scalar zt_scalar_boolean(bool value)
+{
+    zt_scalar s;
+    s.boolean = value;
+    return s;
+}
+
+static inline zt_scalar zt_scalar_rune(int value)
+{
+    zt_scalar s;
+    s.rune = value;
+    return s;
+}
+
+static inline zt_scalar zt_scalar_integer(intmax_t value)
+{
+    zt_scalar s;
+    s.intmax = value;
+    return s;
+}
+
+static inline zt_scalar zt_scalar_unsigned(uintmax_t value)
+{
+    zt_scalar s;
+    s.uintmax = value;
+    return s;
+}
+
+static inline zt_scalar zt_scalar_string(const char* value)
+{
+    zt_scalar s;
+    s.string = value;
+    return s;
+}
+
+static inline zt_scalar zt_scalar_pointer(const void* value)
+{
+    zt_scalar s;
+    s.pointer = value;
+    return s;
+}
+
+#if defined(__GNUC__)
+/* Each comparison keeps a static descriptor, so that the call site only
+ * computes the two values and passes them along with its address. The
+ * alignment keeps the compiler from padding each descriptor. */
+#define ZT_CMP_AT_(left_source, rel, right_source, kind, left, right)                        \
+    __extension__({                                                                          \
+        static const zt_claim_site zt_claim_site_ __attribute__((aligned(sizeof(void*))))    \
+            = { { __FILE__, __LINE__ }, left_source, right_source, ZT_RELATION(rel), kind }; \
+        zt_cmp_at(&zt_claim_site_, left, right);                                             \
+    })
+
+#define ZT_CMP_BOOL(left, rel, right) \
+    ZT_CMP_AT_(#left, rel, #right, ZT_BOOLEAN, zt_scalar_boolean((left)), zt_scalar_boolean((right)))
+
+#define ZT_CMP_RUNE(left, rel, right) \
+    ZT_CMP_AT_(#left, rel, #right, ZT_RUNE, zt_scalar_rune((left)), zt_scalar_rune((right)))
+
+#define ZT_CMP_INT(left, rel, right) \
+    ZT_CMP_AT_(#left, rel, #right, ZT_INTMAX, zt_scalar_integer((left)), zt_scalar_integer((right)))
+
+#define ZT_CMP_UINT(left, rel, right) \
+    ZT_CMP_AT_(#left, rel, #right, ZT_UINTMAX, zt_scalar_unsigned((left)), zt_scalar_unsigned((right)))
+
+#define ZT_CMP_CSTR(left, rel, right) \
+    ZT_CMP_AT_(#left, rel, #right, ZT_STRING, zt_scalar_string((left)), zt_scalar_string((right)))
+
+#define ZT_CMP_PTR(left, rel, right) \
+    ZT_CMP_AT_(#left, rel, #right, ZT_POINTER, zt_scalar_pointer((left)), zt_scalar_pointer((right)))
+#else
 #define ZT_CMP_BOOL(left, rel, right)   \
-    zt_cmp_bool(                        \
+    zt_cmp(                             \
         ZT_CURRENT_LOCATION(),          \
         zt_pack_boolean((left), #left), \
-        zt_pack_string(#rel, #rel),     \
+        ZT_RELATION(rel),               \
         zt_pack_boolean((right), #right))
 
 #define ZT_CMP_RUNE(left, rel, right) \
-    zt_cmp_rune(                      \
+    zt_cmp(                           \
         ZT_CURRENT_LOCATION(),        \
         zt_pack_rune((left), #left),  \
-        zt_pack_string(#rel, #rel),   \
+        ZT_RELATION(rel),             \
         zt_pack_rune((right), #right))
 
 #define ZT_CMP_INT(left, rel, right)    \
-    zt_cmp_int(                         \
+    zt_cmp(                             \
         ZT_CURRENT_LOCATION(),          \
         zt_pack_integer((left), #left), \
-        zt_pack_string(#rel, #rel),     \
+        ZT_RELATION(rel),               \
         zt_pack_integer((right), #right))
 
 #define ZT_CMP_UINT(left, rel, right)    \
-    zt_cmp_uint(                         \
+    zt_cmp(                              \
         ZT_CURRENT_LOCATION(),           \
         zt_pack_unsigned((left), #left), \
-        zt_pack_string(#rel, #rel),      \
+        ZT_RELATION(rel),                \
         zt_pack_unsigned((right), #right))
 
 #define ZT_CMP_CSTR(left, rel, right)  \
-    zt_cmp_cstr(                       \
+    zt_cmp(                            \
         ZT_CURRENT_LOCATION(),         \
         zt_pack_string((left), #left), \
-        zt_pack_string(#rel, #rel),    \
+        ZT_RELATION(rel),              \
         zt_pack_string((right), #right))
 
 #define ZT_CMP_PTR(left, rel, right)    \
-    zt_cmp_ptr(                         \
+    zt_cmp(                             \
         ZT_CURRENT_LOCATION(),          \
         zt_pack_pointer((left), #left), \
-        zt_pack_string(#rel, #rel),     \
+        ZT_RELATION(rel),               \
         zt_pack_pointer((right), #right))
+#endif
 
 #define ZT_NULL(value)         \
     zt_null(                   \